@@ -5,7 +5,10 @@
 #include <glfw/glfw3.h>
 
 #include <cstring>
+#include <fstream>
 #include <sstream>
+#include <stdio.h>
+#include <vector>
 
 #ifdef DEBUG
   #include <array>
@@ -19,6 +22,8 @@ constexpr XrEnvironmentBlendMode environmentBlendMode = XR_ENVIRONMENT_BLEND_MOD
 
 const std::string applicationName = "OpenXR Vulkan Example";
 const std::string engineName = "OpenXR Vulkan Example";
+
+constexpr const char* pipelineCacheFilename = "PipelineCache.bin";
 } // namespace
 
 // [tdbe] XrInxtance and VkInstance.
@@ -113,6 +118,22 @@ Context::Context()
       }
     }
 
+    // Add the optional extensions, without the visibility mask the renderer falls back to a conservative mask, and
+    // without depth layers only the color of the eyes is submitted
+    for (const XrExtensionProperties& supportedExtension : supportedOpenXRInstanceExtensions)
+    {
+      if (strcmp(XR_KHR_VISIBILITY_MASK_EXTENSION_NAME, supportedExtension.extensionName) == 0)
+      {
+        extensions.push_back(XR_KHR_VISIBILITY_MASK_EXTENSION_NAME);
+        visibilityMaskSupported = true;
+      }
+      else if (strcmp(XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME, supportedExtension.extensionName) == 0)
+      {
+        extensions.push_back(XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME);
+        compositionLayerDepthSupported = true;
+      }
+    }
+
     XrInstanceCreateInfo instanceCreateInfo{ XR_TYPE_INSTANCE_CREATE_INFO };
     instanceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
     instanceCreateInfo.enabledExtensionNames = extensions.data();
@@ -159,6 +180,17 @@ Context::Context()
     return;
   }
 
+  // Load the optional OpenXR extension functions
+  if (visibilityMaskSupported &&
+      !util::loadXrExtensionFunction(xrInstance, "xrGetVisibilityMaskKHR",
+                                     reinterpret_cast<PFN_xrVoidFunction*>(&xrGetVisibilityMaskKHR)))
+  {
+    xrGetVisibilityMaskKHR = nullptr;
+  }
+
+  printf("\n[Context][log] Visibility mask %s",
+         xrGetVisibilityMaskKHR ? "supported" : "not supported, using a conservative fallback mask");
+
 #ifdef DEBUG
   // Create an OpenXR debug utils messenger for validation
   {
@@ -505,6 +537,17 @@ Context::~Context()
   }
 
   // Clean up Vulkan
+  if (device && pipelineCache)
+  {
+    savePipelineCache();
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+  }
+
+  if (device && drawTimelineSemaphore)
+  {
+    vkDestroySemaphore(device, drawTimelineSemaphore, nullptr);
+  }
+
   if (device)
   {
     vkDestroyDevice(device, nullptr);
@@ -562,6 +605,7 @@ bool Context::createDevice(VkSurfaceKHR mirrorSurface)
       if (queueFamilyCandidate.queueFlags & VK_QUEUE_GRAPHICS_BIT)
       {
         drawQueueFamilyIndex = static_cast<uint32_t>(queueFamilyIndexCandidate);
+        drawQueueTimestampValidBits = queueFamilyCandidate.timestampValidBits;
         drawQueueFamilyIndexFound = true;
         break;
       }
@@ -688,12 +732,38 @@ bool Context::createDevice(VkSurfaceKHR mirrorSurface)
     }
   }
 
+  // Add the optional extended dynamic state extension, which allows to set the blend equation per draw
+  bool extendedDynamicState3Supported = false;
+  for (const VkExtensionProperties& supportedExtension : supportedVulkanDeviceExtensions)
+  {
+    if (strcmp(supportedExtension.extensionName, VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME) == 0)
+    {
+      vulkanDeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+      extendedDynamicState3Supported = true;
+      break;
+    }
+  }
+
+  // Check for the optional mesh shader extension, which is only added once its features turn out to be sufficient
+  bool meshShaderExtensionSupported = false;
+  for (const VkExtensionProperties& supportedExtension : supportedVulkanDeviceExtensions)
+  {
+    if (strcmp(supportedExtension.extensionName, VK_EXT_MESH_SHADER_EXTENSION_NAME) == 0)
+    {
+      meshShaderExtensionSupported = true;
+      break;
+    }
+  }
+
   // Create a device
   {
     // Retrieve the physical device properties
     VkPhysicalDeviceProperties physicalDeviceProperties;
     vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
     uniformBufferOffsetAlignment = physicalDeviceProperties.limits.minUniformBufferOffsetAlignment;
+    storageBufferOffsetAlignment = physicalDeviceProperties.limits.minStorageBufferOffsetAlignment;
+    maxDrawIndirectCount = physicalDeviceProperties.limits.maxDrawIndirectCount; // 1 without multi-draw indirect
+    timestampPeriod = (drawQueueTimestampValidBits > 0u ? physicalDeviceProperties.limits.timestampPeriod : 0.0f);
 
     // Determine the best supported multisample count, up to 4x MSAA
     const VkSampleCountFlags sampleCountFlags = physicalDeviceProperties.limits.framebufferColorSampleCounts &
@@ -716,11 +786,43 @@ bool Context::createDevice(VkSurfaceKHR mirrorSurface)
       return false;
     }
 
+    if (!physicalDeviceFeatures.drawIndirectFirstInstance)
+    {
+      util::error(Error::FeatureNotSupported, "Vulkan physical device feature \"drawIndirectFirstInstance\"");
+      return false;
+    }
+
     VkPhysicalDeviceFeatures2 physicalDeviceFeatures2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
     VkPhysicalDeviceMultiviewFeatures physicalDeviceMultiviewFeatures{
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES
     };
+    VkPhysicalDeviceVulkan12Features physicalDeviceVulkan12Features{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES
+    };
+    VkPhysicalDeviceVulkan13Features physicalDeviceVulkan13Features{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES
+    };
     physicalDeviceFeatures2.pNext = &physicalDeviceMultiviewFeatures;
+    physicalDeviceMultiviewFeatures.pNext = &physicalDeviceVulkan12Features;
+    physicalDeviceVulkan12Features.pNext = &physicalDeviceVulkan13Features;
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT physicalDeviceExtendedDynamicState3Features{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT
+    };
+    VkPhysicalDeviceMeshShaderFeaturesEXT physicalDeviceMeshShaderFeatures{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT
+    };
+    void** next = &physicalDeviceVulkan13Features.pNext;
+    if (extendedDynamicState3Supported)
+    {
+      *next = &physicalDeviceExtendedDynamicState3Features;
+      next = &physicalDeviceExtendedDynamicState3Features.pNext;
+    }
+    void** meshShaderFeaturesLink = nullptr; // Last in the chain, so that it can be unlinked again
+    if (meshShaderExtensionSupported)
+    {
+      meshShaderFeaturesLink = next;
+      *next = &physicalDeviceMeshShaderFeatures;
+    }
     vkGetPhysicalDeviceFeatures2(physicalDevice, &physicalDeviceFeatures2);
     if (!physicalDeviceMultiviewFeatures.multiview)
     {
@@ -728,8 +830,59 @@ bool Context::createDevice(VkSurfaceKHR mirrorSurface)
       return false;
     }
 
+    if (!physicalDeviceVulkan12Features.timelineSemaphore)
+    {
+      util::error(Error::FeatureNotSupported, "Vulkan physical device feature \"timelineSemaphore\"");
+      return false;
+    }
+
+    if (!physicalDeviceVulkan13Features.synchronization2)
+    {
+      util::error(Error::FeatureNotSupported, "Vulkan physical device feature \"synchronization2\"");
+      return false;
+    }
+
     physicalDeviceFeatures.shaderStorageImageMultisample = VK_TRUE; // Needed for some OpenXR implementations
+    physicalDeviceFeatures.drawIndirectFirstInstance = VK_TRUE;     // Needed to locate the object data of draws
     physicalDeviceMultiviewFeatures.multiview = VK_TRUE;            // Needed for stereo rendering
+    physicalDeviceVulkan12Features.timelineSemaphore = VK_TRUE;     // Needed for the frame and upload synchronization
+    physicalDeviceVulkan13Features.synchronization2 = VK_TRUE;      // Needed for the frame graph barriers
+
+    // Optional, the renderer falls back to the render passes of the headset without it
+    dynamicRenderingSupported = static_cast<bool>(physicalDeviceVulkan13Features.dynamicRendering);
+
+    // Optional, the pipelines bake the blend equation in without it
+    dynamicBlendEquationSupported =
+      static_cast<bool>(physicalDeviceExtendedDynamicState3Features.extendedDynamicState3ColorBlendEquation);
+
+    // Optional, the renderer falls back to indexed draws without it. Mesh shaders have to render into the multiview
+    // render pass with both eyes, and only the task and mesh stages are enabled.
+    if (meshShaderExtensionSupported)
+    {
+      VkPhysicalDeviceMeshShaderPropertiesEXT physicalDeviceMeshShaderProperties{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_EXT
+      };
+      VkPhysicalDeviceProperties2 physicalDeviceProperties2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+      physicalDeviceProperties2.pNext = &physicalDeviceMeshShaderProperties;
+      vkGetPhysicalDeviceProperties2(physicalDevice, &physicalDeviceProperties2);
+
+      meshShaderSupported =
+        physicalDeviceMeshShaderFeatures.taskShader && physicalDeviceMeshShaderFeatures.meshShader &&
+        physicalDeviceMeshShaderFeatures.multiviewMeshShader &&
+        physicalDeviceMeshShaderProperties.maxMeshMultiviewViewCount >= 2u;
+
+      physicalDeviceMeshShaderFeatures.primitiveFragmentShadingRateMeshShader = VK_FALSE;
+      physicalDeviceMeshShaderFeatures.meshShaderQueries = VK_FALSE;
+      if (meshShaderSupported)
+      {
+        vulkanDeviceExtensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+      }
+      else
+      {
+        // Unlink the features again, they must not be passed without the extension
+        *meshShaderFeaturesLink = nullptr;
+      }
+    }
 
     constexpr float queuePriority = 1.0f;
 
@@ -785,9 +938,123 @@ bool Context::createDevice(VkSurfaceKHR mirrorSurface)
     return false;
   }
 
+  // Create the timeline semaphore of the draw queue, starting at zero
+  VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+  semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  semaphoreTypeCreateInfo.initialValue = 0u;
+
+  VkSemaphoreCreateInfo semaphoreCreateInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+  semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+  if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &drawTimelineSemaphore) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    return false;
+  }
+
+  if (dynamicBlendEquationSupported)
+  {
+    vkCmdSetColorBlendEquationEXT = reinterpret_cast<PFN_vkCmdSetColorBlendEquationEXT>(
+      vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEquationEXT"));
+    if (!vkCmdSetColorBlendEquationEXT)
+    {
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+  }
+
+  if (meshShaderSupported)
+  {
+    vkCmdDrawMeshTasksEXT =
+      reinterpret_cast<PFN_vkCmdDrawMeshTasksEXT>(vkGetDeviceProcAddr(device, "vkCmdDrawMeshTasksEXT"));
+    if (!vkCmdDrawMeshTasksEXT)
+    {
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+  }
+
+  if (!createPipelineCache())
+  {
+    return false;
+  }
+
   return true;
 }
 
+bool Context::createPipelineCache()
+{
+  // Load the cache data saved by a previous run, if any
+  std::vector<char> data;
+  std::ifstream file(pipelineCacheFilename, std::ios::ate | std::ios::binary);
+  if (file.is_open())
+  {
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(data.data(), data.size());
+    file.close();
+  }
+
+  // Discard the data unless it was written by the same driver for the same device, a driver update changes the cache
+  // UUID. Vulkan implementations are required to reject incompatible data themselves, but not all of them are robust
+  // against it.
+  if (!data.empty())
+  {
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+    VkPipelineCacheHeaderVersionOne header;
+    bool compatible = (data.size() >= sizeof(header));
+    if (compatible)
+    {
+      memcpy(&header, data.data(), sizeof(header));
+      compatible = header.headerSize >= sizeof(header) && header.headerSize <= data.size() &&
+                   header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                   header.vendorID == physicalDeviceProperties.vendorID &&
+                   header.deviceID == physicalDeviceProperties.deviceID &&
+                   memcmp(header.pipelineCacheUUID, physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    if (!compatible)
+    {
+      data.clear();
+    }
+  }
+
+  VkPipelineCacheCreateInfo pipelineCacheCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+  pipelineCacheCreateInfo.initialDataSize = data.size();
+  pipelineCacheCreateInfo.pInitialData = data.empty() ? nullptr : data.data();
+  if (vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    return false;
+  }
+
+  pipelineCacheWarm = !data.empty();
+  return true;
+}
+
+void Context::savePipelineCache() const
+{
+  size_t size = 0u;
+  if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0u)
+  {
+    return;
+  }
+
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) != VK_SUCCESS)
+  {
+    return;
+  }
+
+  // Failing to save the cache only makes the next startup slower
+  std::ofstream file(pipelineCacheFilename, std::ios::binary | std::ios::trunc);
+  if (file.is_open())
+  {
+    file.write(data.data(), size);
+  }
+}
+
 void Context::sync() const
 {
   vkDeviceWaitIdle(device);
@@ -848,7 +1115,87 @@ VkDeviceSize Context::getUniformBufferOffsetAlignment() const
   return uniformBufferOffsetAlignment;
 }
 
+VkDeviceSize Context::getStorageBufferOffsetAlignment() const
+{
+  return storageBufferOffsetAlignment;
+}
+
 VkSampleCountFlagBits Context::getMultisampleCount() const
 {
   return multisampleCount;
 }
+
+VkPipelineCache Context::getVkPipelineCache() const
+{
+  return pipelineCache;
+}
+
+bool Context::isPipelineCacheWarm() const
+{
+  return pipelineCacheWarm;
+}
+
+PFN_vkCmdSetColorBlendEquationEXT Context::getVkCmdSetColorBlendEquationEXT() const
+{
+  return vkCmdSetColorBlendEquationEXT;
+}
+
+PFN_vkCmdDrawMeshTasksEXT Context::getVkCmdDrawMeshTasksEXT() const
+{
+  return vkCmdDrawMeshTasksEXT;
+}
+
+bool Context::isDynamicRenderingSupported() const
+{
+  return dynamicRenderingSupported;
+}
+
+PFN_xrGetVisibilityMaskKHR Context::getXrGetVisibilityMaskKHR() const
+{
+  return xrGetVisibilityMaskKHR;
+}
+
+bool Context::isCompositionLayerDepthSupported() const
+{
+  return compositionLayerDepthSupported;
+}
+
+uint32_t Context::getMaxDrawIndirectCount() const
+{
+  return maxDrawIndirectCount;
+}
+
+float Context::getTimestampPeriod() const
+{
+  return timestampPeriod;
+}
+
+VkSemaphore Context::getDrawTimelineSemaphore() const
+{
+  return drawTimelineSemaphore;
+}
+
+uint64_t Context::getNextDrawTimelineValue() const
+{
+  return ++drawTimelineValue;
+}
+
+uint64_t Context::getLastDrawTimelineValue() const
+{
+  return drawTimelineValue;
+}
+
+bool Context::waitForDrawTimeline(uint64_t value) const
+{
+  VkSemaphoreWaitInfo semaphoreWaitInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+  semaphoreWaitInfo.semaphoreCount = 1u;
+  semaphoreWaitInfo.pSemaphores = &drawTimelineSemaphore;
+  semaphoreWaitInfo.pValues = &value;
+  if (vkWaitSemaphores(device, &semaphoreWaitInfo, UINT64_MAX) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    return false;
+  }
+
+  return true;
+}
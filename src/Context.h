@@ -9,7 +9,10 @@
  * The context class handles the initial loading of both OpenXR and Vulkan base functionality such as instances, OpenXR
  * sessions, Vulkan devices and queues, and so on. It also loads debug utility messengers for both OpenXR and Vulkan if
  * the preprocessor macro DEBUG is defined. This enables console output that is crucial to finding potential issues in
- * OpenXR or Vulkan.
+ * OpenXR or Vulkan. The context also owns the Vulkan pipeline cache, which is loaded from disk when the device is
+ * created and saved back when the context is destroyed, so that pipelines don't need to be compiled from scratch on
+ * every startup. Every submission to the draw queue signals the next value of a timeline semaphore, so that the CPU can
+ * wait for a specific submission to complete instead of for a fence or the whole queue.
  */
 class Context final
 {
@@ -34,8 +37,36 @@ public:
   VkQueue getVkPresentQueue() const;
 
   VkDeviceSize getUniformBufferOffsetAlignment() const;
+  VkDeviceSize getStorageBufferOffsetAlignment() const;
   VkSampleCountFlagBits getMultisampleCount() const;
 
+  VkPipelineCache getVkPipelineCache() const;
+  bool isPipelineCacheWarm() const; // Whether the pipeline cache was loaded from a compatible file on disk
+
+  // Returns nullptr if the blend equation can't be set dynamically
+  PFN_vkCmdSetColorBlendEquationEXT getVkCmdSetColorBlendEquationEXT() const;
+
+  // Returns nullptr if task and mesh shaders are not supported for multiview rendering
+  PFN_vkCmdDrawMeshTasksEXT getVkCmdDrawMeshTasksEXT() const;
+
+  bool isDynamicRenderingSupported() const;
+
+  // Returns nullptr if the runtime doesn't provide the visibility masks of the views
+  PFN_xrGetVisibilityMaskKHR getXrGetVisibilityMaskKHR() const;
+
+  bool isCompositionLayerDepthSupported() const; // Whether the depth of the eyes can be submitted with their color
+
+  // Returns 1 if multi-draw indirect is not supported
+  uint32_t getMaxDrawIndirectCount() const;
+
+  // Returns the nanoseconds per timestamp tick, or 0 if the draw queue can't write timestamps
+  float getTimestampPeriod() const;
+
+  VkSemaphore getDrawTimelineSemaphore() const;
+  uint64_t getNextDrawTimelineValue() const;      // Reserves the value to signal with the next draw queue submission
+  uint64_t getLastDrawTimelineValue() const;      // The value signaled by the last draw queue submission
+  bool waitForDrawTimeline(uint64_t value) const; // Blocks until the draw queue has signaled the value, false on error
+
 private:
   bool valid = true;
 
@@ -44,17 +75,34 @@ private:
   PFN_xrGetVulkanGraphicsDeviceKHR xrGetVulkanGraphicsDeviceKHR = nullptr;
   PFN_xrGetVulkanDeviceExtensionsKHR xrGetVulkanDeviceExtensionsKHR = nullptr;
   PFN_xrGetVulkanGraphicsRequirementsKHR xrGetVulkanGraphicsRequirementsKHR = nullptr;
+  PFN_xrGetVisibilityMaskKHR xrGetVisibilityMaskKHR = nullptr;
 
   XrInstance xrInstance = nullptr;
   XrSystemId systemId = 0u;
+  bool visibilityMaskSupported = false, compositionLayerDepthSupported = false;
 
   VkInstance vkInstance = nullptr;
   VkPhysicalDevice physicalDevice = nullptr;
   uint32_t drawQueueFamilyIndex = 0u, presentQueueFamilyIndex = 0u;
   VkDevice device = nullptr;
   VkQueue drawQueue = nullptr, presentQueue = nullptr;
-  VkDeviceSize uniformBufferOffsetAlignment = 0u;
+  VkDeviceSize uniformBufferOffsetAlignment = 0u, storageBufferOffsetAlignment = 0u;
+  uint32_t maxDrawIndirectCount = 1u;
+  uint32_t drawQueueTimestampValidBits = 0u;
+  float timestampPeriod = 0.0f;
   VkSampleCountFlagBits multisampleCount = VK_SAMPLE_COUNT_1_BIT;
+  VkPipelineCache pipelineCache = nullptr;
+  bool pipelineCacheWarm = false;
+  bool dynamicRenderingSupported = false;
+  bool dynamicBlendEquationSupported = false;
+  PFN_vkCmdSetColorBlendEquationEXT vkCmdSetColorBlendEquationEXT = nullptr;
+  bool meshShaderSupported = false;
+  PFN_vkCmdDrawMeshTasksEXT vkCmdDrawMeshTasksEXT = nullptr;
+  VkSemaphore drawTimelineSemaphore = nullptr;
+  mutable uint64_t drawTimelineValue = 0u; // Last reserved value, submissions only happen on the main thread
+
+  bool createPipelineCache();
+  void savePipelineCache() const;
 
 #ifdef DEBUG
   PFN_xrCreateDebugUtilsMessengerEXT xrCreateDebugUtilsMessengerEXT = nullptr;
@@ -92,22 +92,28 @@ bool DataBuffer::copyTo(const DataBuffer& target, VkCommandBuffer commandBuffer,
     return false;
   }
 
-  VkSubmitInfo submitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
-  submitInfo.commandBufferCount = 1u;
-  submitInfo.pCommandBuffers = &commandBuffer;
-  if (vkQueueSubmit(queue, 1u, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+  VkCommandBufferSubmitInfo commandBufferSubmitInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO };
+  commandBufferSubmitInfo.commandBuffer = commandBuffer;
+
+  // Signal the next draw timeline value and only wait for this copy to complete, rather than for the whole queue
+  const uint64_t timelineValue = context->getNextDrawTimelineValue();
+  VkSemaphoreSubmitInfo signalSemaphoreSubmitInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO };
+  signalSemaphoreSubmitInfo.semaphore = context->getDrawTimelineSemaphore();
+  signalSemaphoreSubmitInfo.value = timelineValue;
+  signalSemaphoreSubmitInfo.stageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+
+  VkSubmitInfo2 submitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO_2 };
+  submitInfo.commandBufferInfoCount = 1u;
+  submitInfo.pCommandBufferInfos = &commandBufferSubmitInfo;
+  submitInfo.signalSemaphoreInfoCount = 1u;
+  submitInfo.pSignalSemaphoreInfos = &signalSemaphoreSubmitInfo;
+  if (vkQueueSubmit2(queue, 1u, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
   {
     util::error(Error::GenericVulkan);
     return false;
   }
 
-  if (vkQueueWaitIdle(queue) != VK_SUCCESS)
-  {
-    util::error(Error::GenericVulkan);
-    return false;
-  }
-
-  return true;
+  return context->waitForDrawTimeline(timelineValue);
 }
 
 void* DataBuffer::map() const
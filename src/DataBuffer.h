@@ -18,6 +18,7 @@ public:
              VkDeviceSize size);
   ~DataBuffer();
 
+  // Blocks until the copy has completed, the queue has to be the draw queue whose timeline semaphore it signals
   bool copyTo(const DataBuffer& target, VkCommandBuffer commandBuffer, VkQueue queue) const;
   void* map() const;
   void unmap() const;
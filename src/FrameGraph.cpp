@@ -0,0 +1,527 @@
+#include "FrameGraph.h"
+
+#include "Context.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace
+{
+constexpr VkAccessFlags2 readAccessMask =
+  VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT |
+  VK_ACCESS_2_UNIFORM_READ_BIT | VK_ACCESS_2_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT |
+  VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+  VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_HOST_READ_BIT | VK_ACCESS_2_MEMORY_READ_BIT |
+  VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+} // namespace
+
+FrameGraph::FrameGraph(const Context* context) : context(context) {}
+
+FrameGraph::~FrameGraph()
+{
+  const VkDevice device = context->getVkDevice();
+  if (!device)
+  {
+    return;
+  }
+
+  for (const Resource& resource : resources)
+  {
+    if (!resource.transient)
+    {
+      continue;
+    }
+
+    if (resource.imageView)
+    {
+      vkDestroyImageView(device, resource.imageView, nullptr);
+    }
+
+    if (resource.image)
+    {
+      vkDestroyImage(device, resource.image, nullptr);
+    }
+  }
+
+  for (const MemoryBlock& memoryBlock : memoryBlocks)
+  {
+    if (memoryBlock.deviceMemory)
+    {
+      vkFreeMemory(device, memoryBlock.deviceMemory, nullptr);
+    }
+  }
+}
+
+size_t FrameGraph::importImage(VkImage image,
+                               VkImageAspectFlags aspect,
+                               const Access& initialAccess,
+                               const Access& finalAccess)
+{
+  Resource resource;
+  resource.aspect = aspect;
+  resource.initialAccess = initialAccess;
+  resource.finalAccess = finalAccess;
+  resources.push_back(resource);
+
+  const size_t resourceIndex = resources.size() - 1u;
+  setImage(resourceIndex, image);
+  return resourceIndex;
+}
+
+size_t FrameGraph::importBuffer(VkBuffer buffer)
+{
+  Resource resource;
+  resource.buffer = buffer;
+  resources.push_back(resource);
+  return resources.size() - 1u;
+}
+
+size_t FrameGraph::createTransientImage(VkExtent2D size,
+                                        VkFormat format,
+                                        VkImageUsageFlags usage,
+                                        VkImageAspectFlags aspect,
+                                        uint32_t mipLevelCount)
+{
+  Resource resource;
+  resource.aspect = aspect;
+  resource.transient = true;
+  resource.format = format;
+  resource.mipLevelCount = mipLevelCount;
+
+  // Create the image, its memory is bound once all lifetimes are known
+  VkImageCreateInfo imageCreateInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+  imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageCreateInfo.extent.width = size.width;
+  imageCreateInfo.extent.height = size.height;
+  imageCreateInfo.extent.depth = 1u;
+  imageCreateInfo.mipLevels = mipLevelCount;
+  imageCreateInfo.arrayLayers = 1u;
+  imageCreateInfo.format = format;
+  imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageCreateInfo.usage = usage;
+  imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (vkCreateImage(context->getVkDevice(), &imageCreateInfo, nullptr, &resource.image) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+  }
+
+  resources.push_back(resource);
+  return resources.size() - 1u;
+}
+
+void FrameGraph::setImage(size_t resource, VkImage image)
+{
+  Resource& importedResource = resources.at(resource);
+  importedResource.image = image;
+
+  // The initial access is treated like a write that the first use needs to wait for
+  importedResource.state = State();
+  importedResource.state.writeStageMask = importedResource.initialAccess.stageMask;
+  importedResource.state.writeAccessMask = importedResource.initialAccess.accessMask;
+  importedResource.state.layout = importedResource.initialAccess.layout;
+}
+
+void FrameGraph::setOutput(size_t resource, bool output)
+{
+  resources.at(resource).output = output;
+}
+
+size_t FrameGraph::addPass(const std::function<void(VkCommandBuffer)>& record)
+{
+  Pass pass;
+  pass.record = record;
+  passes.push_back(pass);
+  return passes.size() - 1u;
+}
+
+void FrameGraph::read(size_t pass, size_t resource, const Access& access)
+{
+  use(pass, resource, access, false);
+}
+
+void FrameGraph::write(size_t pass, size_t resource, const Access& access)
+{
+  use(pass, resource, access, true);
+}
+
+bool FrameGraph::compile()
+{
+  if (!valid)
+  {
+    return false;
+  }
+
+  const VkDevice device = context->getVkDevice();
+
+  // Find the lifetime of each transient image
+  std::vector<size_t> transientResources;
+  for (size_t resourceIndex = 0u; resourceIndex < resources.size(); ++resourceIndex)
+  {
+    Resource& resource = resources.at(resourceIndex);
+    if (!resource.transient)
+    {
+      continue;
+    }
+
+    resource.firstPassIndex = passes.size();
+    resource.lastPassIndex = 0u;
+    for (size_t passIndex = 0u; passIndex < passes.size(); ++passIndex)
+    {
+      for (const Use& use : passes.at(passIndex).uses)
+      {
+        if (use.resource == resourceIndex)
+        {
+          resource.firstPassIndex = std::min(resource.firstPassIndex, passIndex);
+          resource.lastPassIndex = std::max(resource.lastPassIndex, passIndex);
+        }
+      }
+    }
+
+    transientResources.push_back(resourceIndex);
+  }
+
+  // Place the largest images first, each into the first memory block that has no overlapping lifetime in it
+  std::vector<VkMemoryRequirements> memoryRequirements(resources.size());
+  for (const size_t resourceIndex : transientResources)
+  {
+    vkGetImageMemoryRequirements(device, resources.at(resourceIndex).image, &memoryRequirements.at(resourceIndex));
+  }
+
+  std::sort(transientResources.begin(), transientResources.end(), [&memoryRequirements](size_t a, size_t b)
+            { return memoryRequirements.at(a).size > memoryRequirements.at(b).size; });
+
+  std::vector<std::vector<size_t>> memoryBlockResources;
+  for (const size_t resourceIndex : transientResources)
+  {
+    Resource& resource = resources.at(resourceIndex);
+    const VkMemoryRequirements& requirements = memoryRequirements.at(resourceIndex);
+
+    bool placed = false;
+    for (size_t memoryBlockIndex = 0u; memoryBlockIndex < memoryBlocks.size(); ++memoryBlockIndex)
+    {
+      MemoryBlock& memoryBlock = memoryBlocks.at(memoryBlockIndex);
+      if (!(memoryBlock.memoryTypeBits & requirements.memoryTypeBits))
+      {
+        continue;
+      }
+
+      bool overlaps = false;
+      for (const size_t otherResourceIndex : memoryBlockResources.at(memoryBlockIndex))
+      {
+        const Resource& otherResource = resources.at(otherResourceIndex);
+        if (resource.firstPassIndex <= otherResource.lastPassIndex &&
+            otherResource.firstPassIndex <= resource.lastPassIndex)
+        {
+          overlaps = true;
+          break;
+        }
+      }
+
+      if (!overlaps)
+      {
+        memoryBlock.memoryTypeBits &= requirements.memoryTypeBits;
+        memoryBlockResources.at(memoryBlockIndex).push_back(resourceIndex);
+        resource.memoryBlockIndex = memoryBlockIndex;
+        placed = true;
+        break;
+      }
+    }
+
+    if (!placed)
+    {
+      MemoryBlock memoryBlock;
+      memoryBlock.size = requirements.size;
+      memoryBlock.memoryTypeBits = requirements.memoryTypeBits;
+      memoryBlocks.push_back(memoryBlock);
+      memoryBlockResources.push_back({ resourceIndex });
+      resource.memoryBlockIndex = memoryBlocks.size() - 1u;
+    }
+  }
+
+  // Allocate each memory block and bind its images to the start of it
+  for (size_t memoryBlockIndex = 0u; memoryBlockIndex < memoryBlocks.size(); ++memoryBlockIndex)
+  {
+    MemoryBlock& memoryBlock = memoryBlocks.at(memoryBlockIndex);
+
+    VkMemoryRequirements blockRequirements{};
+    blockRequirements.memoryTypeBits = memoryBlock.memoryTypeBits;
+    for (const size_t resourceIndex : memoryBlockResources.at(memoryBlockIndex))
+    {
+      blockRequirements.size = std::max(blockRequirements.size, memoryRequirements.at(resourceIndex).size);
+    }
+    memoryBlock.size = blockRequirements.size;
+
+    uint32_t suitableMemoryTypeIndex = 0u;
+    if (!util::findSuitableMemoryTypeIndex(context->getVkPhysicalDevice(), blockRequirements,
+                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, suitableMemoryTypeIndex))
+    {
+      util::error(Error::FeatureNotSupported, "Suitable transient image memory type");
+      valid = false;
+      return false;
+    }
+
+    VkMemoryAllocateInfo memoryAllocateInfo{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+    memoryAllocateInfo.allocationSize = memoryBlock.size;
+    memoryAllocateInfo.memoryTypeIndex = suitableMemoryTypeIndex;
+    if (vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &memoryBlock.deviceMemory) != VK_SUCCESS)
+    {
+      std::stringstream s;
+      s << memoryBlock.size << " bytes for transient images";
+      util::error(Error::OutOfMemory, s.str());
+      valid = false;
+      return false;
+    }
+
+    for (const size_t resourceIndex : memoryBlockResources.at(memoryBlockIndex))
+    {
+      Resource& resource = resources.at(resourceIndex);
+      if (vkBindImageMemory(device, resource.image, memoryBlock.deviceMemory, 0u) != VK_SUCCESS)
+      {
+        util::error(Error::GenericVulkan);
+        valid = false;
+        return false;
+      }
+
+      // Create an image view
+      VkImageViewCreateInfo imageViewCreateInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+      imageViewCreateInfo.image = resource.image;
+      imageViewCreateInfo.format = resource.format;
+      imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      imageViewCreateInfo.components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+                                         VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
+      imageViewCreateInfo.subresourceRange.aspectMask = resource.aspect;
+      imageViewCreateInfo.subresourceRange.baseArrayLayer = 0u;
+      imageViewCreateInfo.subresourceRange.layerCount = 1u;
+      imageViewCreateInfo.subresourceRange.baseMipLevel = 0u;
+      imageViewCreateInfo.subresourceRange.levelCount = resource.mipLevelCount;
+      if (vkCreateImageView(device, &imageViewCreateInfo, nullptr, &resource.imageView) != VK_SUCCESS)
+      {
+        util::error(Error::GenericVulkan);
+        valid = false;
+        return false;
+      }
+    }
+  }
+
+  compiled = true;
+  return true;
+}
+
+void FrameGraph::execute(VkCommandBuffer commandBuffer)
+{
+  if (!compiled)
+  {
+    return;
+  }
+
+  // Cull the passes that don't contribute to an output, walking backwards from the outputs
+  livePasses.assign(passes.size(), false);
+  neededResources.assign(resources.size(), false);
+  for (size_t resourceIndex = 0u; resourceIndex < resources.size(); ++resourceIndex)
+  {
+    neededResources.at(resourceIndex) = resources.at(resourceIndex).output;
+  }
+
+  for (size_t passIndex = passes.size(); passIndex-- > 0u;)
+  {
+    const Pass& pass = passes.at(passIndex);
+
+    bool live = false;
+    for (const Use& use : pass.uses)
+    {
+      if (use.write && neededResources.at(use.resource))
+      {
+        live = true;
+        break;
+      }
+    }
+
+    if (!live)
+    {
+      continue;
+    }
+
+    livePasses.at(passIndex) = true;
+
+    // A pass that only writes a resource doesn't need what was there before, everything it reads is needed
+    for (const Use& use : pass.uses)
+    {
+      if (use.write && !(use.access.accessMask & readAccessMask))
+      {
+        neededResources.at(use.resource) = false;
+      }
+    }
+
+    for (const Use& use : pass.uses)
+    {
+      if (!use.write || (use.access.accessMask & readAccessMask))
+      {
+        neededResources.at(use.resource) = true;
+      }
+    }
+  }
+
+  // Transient images start out undefined every frame
+  for (Resource& resource : resources)
+  {
+    if (resource.transient)
+    {
+      resource.firstUse = true;
+    }
+  }
+
+  VkMemoryBarrier2 memoryBarrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+
+  // Record the live passes, each preceded by the barriers it needs
+  for (size_t passIndex = 0u; passIndex < passes.size(); ++passIndex)
+  {
+    if (!livePasses.at(passIndex))
+    {
+      continue;
+    }
+
+    const Pass& pass = passes.at(passIndex);
+    for (const Use& use : pass.uses)
+    {
+      Resource& resource = resources.at(use.resource);
+      if (resource.transient && resource.firstUse)
+      {
+        // Wait for whichever image last used the shared memory, in this frame or the previous one
+        resource.state = State();
+        resource.state.writeStageMask = memoryBlocks.at(resource.memoryBlockIndex).stageMask;
+        resource.firstUse = false;
+      }
+
+      synchronize(resource, use.access, use.write, memoryBarrier);
+    }
+
+    flushBarriers(commandBuffer, memoryBarrier);
+    pass.record(commandBuffer);
+
+    for (const Use& use : pass.uses)
+    {
+      const Resource& resource = resources.at(use.resource);
+      if (resource.transient)
+      {
+        memoryBlocks.at(resource.memoryBlockIndex).stageMask =
+          resource.state.writeStageMask | resource.state.readStageMask;
+      }
+    }
+  }
+
+  // Hand the outputs over in their final layout
+  for (Resource& resource : resources)
+  {
+    if (resource.output && resource.image && resource.finalAccess.layout != VK_IMAGE_LAYOUT_UNDEFINED &&
+        resource.finalAccess.layout != resource.state.layout)
+    {
+      synchronize(resource, resource.finalAccess, false, memoryBarrier);
+    }
+  }
+
+  flushBarriers(commandBuffer, memoryBarrier);
+}
+
+bool FrameGraph::isValid() const
+{
+  return valid;
+}
+
+VkImage FrameGraph::getImage(size_t resource) const
+{
+  return resources.at(resource).image;
+}
+
+VkImageView FrameGraph::getImageView(size_t resource) const
+{
+  return resources.at(resource).imageView;
+}
+
+void FrameGraph::use(size_t pass, size_t resource, const Access& access, bool write)
+{
+  Use use;
+  use.resource = resource;
+  use.access = access;
+  use.write = write;
+  passes.at(pass).uses.push_back(use);
+}
+
+void FrameGraph::synchronize(Resource& resource, const Access& access, bool write, VkMemoryBarrier2& memoryBarrier)
+{
+  State& state = resource.state;
+  const bool layoutTransition = resource.image && access.layout != state.layout;
+
+  if (layoutTransition || write)
+  {
+    // Layout transitions and writes have to wait for all previous reads and writes
+    const VkPipelineStageFlags2 srcStageMask = state.writeStageMask | state.readStageMask;
+    if (layoutTransition)
+    {
+      VkImageMemoryBarrier2 imageMemoryBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+      imageMemoryBarrier.srcStageMask = srcStageMask;
+      imageMemoryBarrier.srcAccessMask = state.writeAccessMask;
+      imageMemoryBarrier.dstStageMask = access.stageMask;
+      imageMemoryBarrier.dstAccessMask = access.accessMask;
+      imageMemoryBarrier.oldLayout = state.layout;
+      imageMemoryBarrier.newLayout = access.layout;
+      imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      imageMemoryBarrier.image = resource.image;
+      imageMemoryBarrier.subresourceRange = { resource.aspect, 0u, VK_REMAINING_MIP_LEVELS, 0u,
+                                              VK_REMAINING_ARRAY_LAYERS };
+      imageMemoryBarriers.push_back(imageMemoryBarrier);
+    }
+    else if (srcStageMask != VK_PIPELINE_STAGE_2_NONE)
+    {
+      memoryBarrier.srcStageMask |= srcStageMask;
+      memoryBarrier.srcAccessMask |= state.writeAccessMask;
+      memoryBarrier.dstStageMask |= access.stageMask;
+      memoryBarrier.dstAccessMask |= access.accessMask;
+    }
+
+    // A layout transition counts as a write that the following readers in other stages need to wait for
+    state.writeStageMask = access.stageMask;
+    state.writeAccessMask = access.accessMask & ~readAccessMask;
+    state.readStageMask = (write ? VK_PIPELINE_STAGE_2_NONE : access.stageMask);
+    state.readAccessMask = (write ? VK_ACCESS_2_NONE : access.accessMask);
+    state.layout = access.layout;
+    return;
+  }
+
+  // Reads only need a barrier if the last write has not been made visible to them yet
+  const bool visible = ((state.readStageMask & access.stageMask) == access.stageMask) &&
+                       ((state.readAccessMask & access.accessMask) == access.accessMask);
+  if (state.writeStageMask != VK_PIPELINE_STAGE_2_NONE && !visible)
+  {
+    memoryBarrier.srcStageMask |= state.writeStageMask;
+    memoryBarrier.srcAccessMask |= state.writeAccessMask;
+    memoryBarrier.dstStageMask |= access.stageMask;
+    memoryBarrier.dstAccessMask |= access.accessMask;
+  }
+
+  state.readStageMask |= access.stageMask;
+  state.readAccessMask |= access.accessMask;
+}
+
+void FrameGraph::flushBarriers(VkCommandBuffer commandBuffer, VkMemoryBarrier2& memoryBarrier)
+{
+  const bool hasMemoryBarrier = (memoryBarrier.srcStageMask != VK_PIPELINE_STAGE_2_NONE);
+  if (!hasMemoryBarrier && imageMemoryBarriers.empty())
+  {
+    return;
+  }
+
+  VkDependencyInfo dependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+  dependencyInfo.memoryBarrierCount = (hasMemoryBarrier ? 1u : 0u);
+  dependencyInfo.pMemoryBarriers = &memoryBarrier;
+  dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageMemoryBarriers.size());
+  dependencyInfo.pImageMemoryBarriers = imageMemoryBarriers.data();
+  vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+  memoryBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+  imageMemoryBarriers.clear();
+}
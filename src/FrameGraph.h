@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <functional>
+#include <vector>
+
+class Context;
+
+/*
+ * The frame graph class schedules the passes of a frame and derives the synchronization between them. Passes are added
+ * in execution order and declare the resources they read and write, together with the pipeline stage, access, and
+ * image layout of each use. When the graph is executed, passes that do not contribute to an output resource are culled,
+ * and the barriers between the remaining passes are computed and merged into a single synchronization2 barrier per
+ * pass. Image layout transitions get an image barrier each, all other hazards share one global memory barrier.
+ * Resources are either imported, meaning that they are owned elsewhere and their state carries over from frame to
+ * frame, or transient, meaning that they are owned by the graph and their contents are discarded at the end of every
+ * frame. Transient images whose lifetimes in the graph do not overlap share the same memory. Note that transient images
+ * need to be created, and used by passes, before the graph is compiled. Passes without transient images can be added
+ * at any time.
+ */
+class FrameGraph final
+{
+public:
+  FrameGraph(const Context* context);
+  ~FrameGraph();
+
+  // A single use of a resource by a pass, the layout is ignored for buffers
+  struct Access
+  {
+    VkPipelineStageFlags2 stageMask = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 accessMask = VK_ACCESS_2_NONE;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  };
+
+  size_t importImage(VkImage image,
+                     VkImageAspectFlags aspect,
+                     const Access& initialAccess = {},
+                     const Access& finalAccess = {});
+  size_t importBuffer(VkBuffer buffer);
+  size_t createTransientImage(VkExtent2D size,
+                              VkFormat format,
+                              VkImageUsageFlags usage,
+                              VkImageAspectFlags aspect,
+                              uint32_t mipLevelCount);
+
+  // Rebinds an imported image, for example to the current swapchain image, and resets it to its initial access
+  void setImage(size_t resource, VkImage image);
+
+  // Outputs are consumed outside of the graph, they are transitioned to their final access at the end of the frame
+  void setOutput(size_t resource, bool output);
+
+  size_t addPass(const std::function<void(VkCommandBuffer)>& record);
+  void read(size_t pass, size_t resource, const Access& access);
+  void write(size_t pass, size_t resource, const Access& access);
+
+  bool compile();
+  void execute(VkCommandBuffer commandBuffer);
+
+  bool isValid() const;
+  VkImage getImage(size_t resource) const;
+  VkImageView getImageView(size_t resource) const;
+
+private:
+  bool valid = true;
+  bool compiled = false;
+
+  const Context* context = nullptr;
+
+  // The synchronization state of a resource, the readers are the accesses that the last write was made visible to
+  struct State
+  {
+    VkPipelineStageFlags2 writeStageMask = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 writeAccessMask = VK_ACCESS_2_NONE;
+    VkPipelineStageFlags2 readStageMask = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 readAccessMask = VK_ACCESS_2_NONE;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  };
+
+  struct Resource
+  {
+    VkImage image = nullptr;
+    VkBuffer buffer = nullptr;
+    VkImageAspectFlags aspect = 0u;
+    Access initialAccess, finalAccess;
+    bool output = false;
+    State state;
+
+    // Transient images only
+    bool transient = false;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t mipLevelCount = 1u;
+    VkImageView imageView = nullptr;
+    size_t memoryBlockIndex = 0u;
+    size_t firstPassIndex = 0u, lastPassIndex = 0u; // Lifetime in the graph
+    bool firstUse = true;
+  };
+  std::vector<Resource> resources;
+
+  struct Use
+  {
+    size_t resource;
+    Access access;
+    bool write;
+  };
+
+  struct Pass
+  {
+    std::function<void(VkCommandBuffer)> record;
+    std::vector<Use> uses;
+  };
+  std::vector<Pass> passes;
+
+  // Memory shared by transient images with disjoint lifetimes, the stage mask holds the last use of the memory
+  struct MemoryBlock
+  {
+    VkDeviceMemory deviceMemory = nullptr;
+    VkDeviceSize size = 0u;
+    uint32_t memoryTypeBits = ~0u;
+    VkPipelineStageFlags2 stageMask = VK_PIPELINE_STAGE_2_NONE;
+  };
+  std::vector<MemoryBlock> memoryBlocks;
+
+  // Reused every frame to avoid reallocation
+  std::vector<bool> livePasses, neededResources;
+  std::vector<VkImageMemoryBarrier2> imageMemoryBarriers;
+
+  void use(size_t pass, size_t resource, const Access& access, bool write);
+  void synchronize(Resource& resource, const Access& access, bool write, VkMemoryBarrier2& memoryBarrier);
+  void flushBarriers(VkCommandBuffer commandBuffer, VkMemoryBarrier2& memoryBarrier);
+};
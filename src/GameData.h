@@ -2,6 +2,7 @@
 #include <string>
 #include <array>
 #include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 
 //#include <vulkan/vulkan.h>
@@ -12,6 +13,8 @@
 struct Material 
 {
 	DynamicMaterialUniformData dynamicUniformData = {};
+	// [tdbe] increment after changing dynamicUniformData, the renderer only uploads it again when the version changes.
+	uint32_t dynamicUniformDataVersion = 0u;
 	// [tdbe] if you change any of the shaders, the renderer creates a new pipeline with the shaders.
 	std::string vertShaderName = "shaders/Diffuse.vert.spv";
 	std::string fragShaderName = "shaders/Diffuse.frag.spv";
@@ -21,23 +24,32 @@ struct Material
 	// VkDescriptorSet descriptorSet;
 	// and then use different pipelines for each pipeline layout here, as needed:
 	Pipeline* pipeline = nullptr; //vkPipeline; right now it points to just 2 or 3 pipelines, not really one per material.
+	// [tdbe] the mesh shader variant of the pipeline, only set by the renderer if the device and shaders support it.
+	Pipeline* meshPipeline = nullptr;
+	// [tdbe] the slot of this material in the material table, set by the renderer it is passed to.
+	uint32_t materialIndex = 0u;
 };
 
 /*
  * The model struct holds all required information to orientate and render a model. It handles orientation with a world
  * transformation matrix and has its indexing information populated by the mesh data class. This struct represents a
- * single draw call and is used by the renderer class to know how and where to draw a model.
+ * single draw call and is used by the renderer class to know how and where to draw a model. The bounding sphere in model
+ * space is used for culling.
  */
 struct Model final
 {
   size_t firstIndex = 0u;
   size_t indexCount = 0u;
+  glm::vec3 boundsCenter = glm::vec3(0.0f);
+  float boundsRadius = 0.0f;
 };
 
 struct GameObject{
 	std::string name = "game object";
 	// [tdbe] isVisible means whether or not it will be rendered
 	bool isVisible = true;
+	// [tdbe] isStatic means the object never moves, so the renderer can record its draw once and reuse it
+	bool isStatic = false;
 	// [tdbe] coordinate system: Y is up, Z is forward
 	glm::mat4 worldMatrix = glm::mat4(1.0f);
 	Model *model = nullptr;
@@ -2,108 +2,48 @@
 
 #include "Context.h"
 #include "ImageBuffer.h"
+#include "QuadLayer.h"
 #include "RenderTarget.h"
 #include "Util.h"
 
 #include <glm/mat4x4.hpp>
 
+#include <algorithm>
 #include <array>
+#include <stdio.h>
 
 namespace
 {
 constexpr XrReferenceSpaceType spaceType = XR_REFERENCE_SPACE_TYPE_STAGE;
 constexpr VkFormat colorFormat = VK_FORMAT_R8G8B8A8_SRGB;//_RGBA8UnormSrgb
 constexpr VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
+constexpr float nearClip = 0.01f, farClip = 250.0f; // Of the eye projections
+
+// Render with Vulkan 1.3 dynamic rendering instead of render passes and framebuffers where the device supports it
+constexpr bool preferDynamicRendering = true;
+
+// The hidden area for runtimes without visibility masks, a triangle in each corner of the eye that is outside of the
+// lenses of common headsets. It is kept small, as anything inside of it is never rendered.
+const std::array<glm::vec2, 12u> fallbackVisibilityMask = {
+  glm::vec2(-1.0f, -1.0f), glm::vec2(-0.7f, -1.0f), glm::vec2(-1.0f, -0.7f), // Top left
+  glm::vec2(1.0f, -1.0f),  glm::vec2(1.0f, -0.7f),  glm::vec2(0.7f, -1.0f),  // Top right
+  glm::vec2(-1.0f, 1.0f),  glm::vec2(-1.0f, 0.7f),  glm::vec2(-0.7f, 1.0f),  // Bottom left
+  glm::vec2(1.0f, 1.0f),   glm::vec2(0.7f, 1.0f),   glm::vec2(1.0f, 0.7f)    // Bottom right
+};
 } // namespace
 
 Headset::Headset(const Context* context) : context(context)
 {
   const VkDevice device = context->getVkDevice();
-  const VkSampleCountFlagBits multisampleCount = context->getMultisampleCount();
 
-  // Create a render pass
+  // Create the render passes, which are replaced by dynamic rendering where the device supports it. Dynamic rendering
+  // begins rendering into the attachment image views directly, without any render pass or framebuffers.
+  dynamicRendering = preferDynamicRendering && context->isDynamicRenderingSupported();
+  printf("\n[Headset][log] Dynamic rendering %s", dynamicRendering ? "enabled" : "disabled, using render passes");
+  if (!dynamicRendering && !createRenderPasses())
   {
-    constexpr uint32_t viewMask = 0b00000011;
-    constexpr uint32_t correlationMask = 0b00000011;
-
-    // [tdbe] Single pass / multiview explanation:
-    // [tdbe] We feed this multiview create info into the regular vk render pass creation.
-    // [tdbe] Vulklan will execute the render pipeline twice (or whatever number is in pViewMasks)
-    // [tdbe] To use multiview, in the shader you enable the GL_EXT_multiview extension, and then
-    // [tdbe] get a glViewIndex depending on what multiview view you are about to output to. So you
-    // [tdbe] can use e.g. an array of transformation matrixes indexed by this.
-    VkRenderPassMultiviewCreateInfo renderPassMultiviewCreateInfo{
-      VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO
-    };
-    renderPassMultiviewCreateInfo.subpassCount = 1u;
-    renderPassMultiviewCreateInfo.pViewMasks = &viewMask;
-    renderPassMultiviewCreateInfo.correlationMaskCount = 1u;
-    renderPassMultiviewCreateInfo.pCorrelationMasks = &correlationMask;
-
-    VkAttachmentDescription colorAttachmentDescription{};
-    colorAttachmentDescription.format = colorFormat;
-    colorAttachmentDescription.samples = multisampleCount;
-    colorAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference colorAttachmentReference;
-    colorAttachmentReference.attachment = 0u;
-    colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentDescription depthAttachmentDescription{};
-    depthAttachmentDescription.format = depthFormat;
-    depthAttachmentDescription.samples = multisampleCount;
-    depthAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    depthAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference depthAttachmentReference;
-    depthAttachmentReference.attachment = 1u;
-    depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentDescription resolveAttachmentDescription{};
-    resolveAttachmentDescription.format = colorFormat;
-    resolveAttachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
-    resolveAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    resolveAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    resolveAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    resolveAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    resolveAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    resolveAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference resolveAttachmentReference;
-    resolveAttachmentReference.attachment = 2u;
-    resolveAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkSubpassDescription subpassDescription{};
-    subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpassDescription.colorAttachmentCount = 1u;
-    subpassDescription.pColorAttachments = &colorAttachmentReference;
-    subpassDescription.pDepthStencilAttachment = &depthAttachmentReference;
-    subpassDescription.pResolveAttachments = &resolveAttachmentReference;
-
-    const std::array attachments = { colorAttachmentDescription, depthAttachmentDescription,
-                                     resolveAttachmentDescription };
-
-    VkRenderPassCreateInfo renderPassCreateInfo{ VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
-    renderPassCreateInfo.pNext = &renderPassMultiviewCreateInfo;
-    renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-    renderPassCreateInfo.pAttachments = attachments.data();
-    renderPassCreateInfo.subpassCount = 1u;
-    renderPassCreateInfo.pSubpasses = &subpassDescription;
-    if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &renderPass) != VK_SUCCESS)
-    {
-      util::error(Error::GenericVulkan);
-      valid = false;
-      return;
-    }
+    valid = false;
+    return;
   }
 
   const XrInstance xrInstance = context->getXrInstance();
@@ -183,7 +123,8 @@ Headset::Headset(const Context* context) : context(context)
     eyePose.next = nullptr;
   }
 
-  // Verify that the desired color format is supported
+  // Verify that the desired color format is supported, the depth format is only needed to submit depth
+  bool depthFormatFound = false;
   {
     uint32_t formatCount = 0u;
     result = xrEnumerateSwapchainFormats(session, 0u, &formatCount, nullptr);
@@ -209,7 +150,10 @@ Headset::Headset(const Context* context) : context(context)
       if (format == static_cast<int64_t>(colorFormat))
       {
         formatFound = true;
-        break;
+      }
+      else if (format == static_cast<int64_t>(depthFormat))
+      {
+        depthFormatFound = true;
       }
     }
 
@@ -235,7 +179,10 @@ Headset::Headset(const Context* context) : context(context)
   // Create a depth buffer
   // [tdbe] Note: the depth buffer is not necessary. I guess it's used for passthrough or other xr depth effects,
   // [tdbe] but it's not required for rendering geometry to the headset color buffer. (It's not "the" depth buffer.)
-  depthBuffer = new ImageBuffer(context, eyeResolution, depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+  // It is also sampled by the occlusion culler to build the depth pyramid, and resolved into the depth swapchain when
+  // depth is submitted.
+  depthBuffer = new ImageBuffer(context, eyeResolution, depthFormat,
+                                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
                                 context->getMultisampleCount(), VK_IMAGE_ASPECT_DEPTH_BIT, 2u);
   if (!depthBuffer->isValid())
   {
@@ -303,6 +250,7 @@ Headset::Headset(const Context* context) : context(context)
     swapchainRenderTargets.resize(swapchainImages.size());
     // [tdbe] Again, the renderTarget / xr image pairs correspond to the vulkan swapchain layers we created earlier.
     // [tdbe] Multiple redertargets set up this way will use the same render pass.
+    // [tdbe] With dynamic rendering there is no render pass, and the render targets only hold an image view each.
     for (size_t renderTargetIndex = 0u; renderTargetIndex < swapchainRenderTargets.size(); ++renderTargetIndex)
     {
       RenderTarget*& renderTarget = swapchainRenderTargets.at(renderTargetIndex);
@@ -318,6 +266,19 @@ Headset::Headset(const Context* context) : context(context)
     }
   }
 
+  // Create a depth swapchain to submit the depth of the eyes with, for positional reprojection by the runtime. It is
+  // resolved from the multisampled depth buffer at the end of a rendering, which needs dynamic rendering.
+  if (context->isCompositionLayerDepthSupported() && depthFormatFound && dynamicRendering &&
+      context->getMultisampleCount() != VK_SAMPLE_COUNT_1_BIT)
+  {
+    if (!createDepthSwapchain())
+    {
+      valid = false;
+      return;
+    }
+  }
+  printf("\n[Headset][log] Depth submission %s", depthSwapchain ? "supported" : "not supported");
+
   // Create the eye render infos
   eyeRenderInfos.resize(eyeCount);
   for (size_t eyeIndex = 0u; eyeIndex < eyeRenderInfos.size(); ++eyeIndex)
@@ -335,14 +296,44 @@ Headset::Headset(const Context* context) : context(context)
                                                 static_cast<int32_t>(eyeImageInfo.recommendedImageRectHeight) };
   }
 
+  // Create the eye depth infos, they are only chained to the eye render infos in frames that submit depth
+  eyeDepthInfos.resize(eyeCount);
+  for (size_t eyeIndex = 0u; eyeIndex < eyeDepthInfos.size(); ++eyeIndex)
+  {
+    XrCompositionLayerDepthInfoKHR& eyeDepthInfo = eyeDepthInfos.at(eyeIndex);
+    eyeDepthInfo.type = XR_TYPE_COMPOSITION_LAYER_DEPTH_INFO_KHR;
+    eyeDepthInfo.next = nullptr;
+    eyeDepthInfo.subImage = eyeRenderInfos.at(eyeIndex).subImage;
+    eyeDepthInfo.subImage.swapchain = depthSwapchain;
+    eyeDepthInfo.minDepth = 0.0f;
+    eyeDepthInfo.maxDepth = 1.0f;
+
+    // The eye projections map the near clip plane to a depth of -1, so a depth of 0 lies further away at this distance
+    eyeDepthInfo.nearZ = 2.0f * farClip * nearClip / (farClip + nearClip);
+    eyeDepthInfo.farZ = farClip;
+  }
+
   // Allocate view and projection matrices
   eyeViewMatrices.resize(eyeCount);
   eyeProjectionMatrices.resize(eyeCount);
+
+  // Fetch the visibility masks, they are projected once the eye poses are known
+  visibilityMasks.resize(eyeCount);
+  if (!fetchVisibilityMasks())
+  {
+    valid = false;
+    return;
+  }
 }
 
 Headset::~Headset()
 {
   // Clean up OpenXR
+  for (const QuadLayer* quadLayer : quadLayers)
+  {
+    delete quadLayer;
+  }
+
   if (session)
   {
     xrEndSession(session);
@@ -358,6 +349,16 @@ Headset::~Headset()
     delete renderTarget;
   }
 
+  if (depthSwapchain)
+  {
+    xrDestroySwapchain(depthSwapchain);
+  }
+
+  for (const RenderTarget* renderTarget : depthSwapchainRenderTargets)
+  {
+    delete renderTarget;
+  }
+
   if (space)
   {
     xrDestroySpace(space);
@@ -380,13 +381,18 @@ Headset::~Headset()
   }
 
   const VkDevice vkDevice = context->getVkDevice();
+  if (vkDevice && lateRenderPass)
+  {
+    vkDestroyRenderPass(vkDevice, lateRenderPass, nullptr);
+  }
+
   if (vkDevice && renderPass)
   {
     vkDestroyRenderPass(vkDevice, renderPass, nullptr);
   }
 }
 
-Headset::BeginFrameResult Headset::beginFrame(uint32_t& swapchainImageIndex) 
+Headset::BeginFrameResult Headset::beginFrame()
 {
   const XrInstance instance = context->getXrInstance();
 
@@ -426,6 +432,15 @@ Headset::BeginFrameResult Headset::beginFrame(uint32_t& swapchainImageIndex)
 
       break;
     }
+    case XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR:
+    {
+      if (!fetchVisibilityMasks())
+      {
+        return BeginFrameResult::Error;
+      }
+
+      break;
+    }
     }
 
     buffer.type = XR_TYPE_EVENT_DATA_BUFFER;
@@ -466,50 +481,33 @@ Headset::BeginFrameResult Headset::beginFrame(uint32_t& swapchainImageIndex)
   }
 
   // Update the eye poses
-  viewState.type = XR_TYPE_VIEW_STATE;
-  uint32_t viewCount;
-  XrViewLocateInfo viewLocateInfo{ XR_TYPE_VIEW_LOCATE_INFO };
-  viewLocateInfo.viewConfigurationType = context->getXrViewType();
-  viewLocateInfo.displayTime = frameState.predictedDisplayTime;
-  viewLocateInfo.space = space;
-  result = xrLocateViews(session, &viewLocateInfo, &viewState, static_cast<uint32_t>(eyePoses.size()), &viewCount,
-                         eyePoses.data());
-  if (XR_FAILED(result))
-  {
-    util::error(Error::GenericOpenXR);
-    return BeginFrameResult::Error;
-  }
-
-  if (viewCount != eyeCount)
+  if (!locateEyes())
   {
-    util::error(Error::GenericOpenXR);
     return BeginFrameResult::Error;
   }
 
-  // Update the eye render infos, view and projection matrices
-  for (size_t eyeIndex = 0u; eyeIndex < eyeCount; ++eyeIndex)
-  {
-    // Copy the eye poses into the eye render infos
-    XrCompositionLayerProjectionView& eyeRenderInfo = eyeRenderInfos.at(eyeIndex);
-    const XrView& eyePose = eyePoses.at(eyeIndex);
-    eyeRenderInfo.pose = eyePose.pose;
-    eyeRenderInfo.fov = eyePose.fov;
+  return BeginFrameResult::RenderFully; // Request full rendering of the frame
+}
 
-    // Update the view and projection matrices
-    const XrPosef& pose = eyeRenderInfo.pose;
-    eyeViewMatrices.at(eyeIndex) = glm::inverse(util::poseToMatrix(pose));
-    eyeProjectionMatrices.at(eyeIndex) = util::createProjectionMatrix(eyeRenderInfo.fov, 0.01f, 250.0f);
-  }
+bool Headset::relocateEyes()
+{
+  // Locating the views again for the same display time returns a prediction from fresher tracking data
+  return locateEyes();
+}
 
+bool Headset::acquireSwapchainImage(uint32_t& swapchainImageIndex)
+{
   // Acquire the swapchain image
   XrSwapchainImageAcquireInfo swapchainImageAcquireInfo{ XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO };
-  result = xrAcquireSwapchainImage(swapchain, &swapchainImageAcquireInfo, &swapchainImageIndex);
+  XrResult result = xrAcquireSwapchainImage(swapchain, &swapchainImageAcquireInfo, &swapchainImageIndex);
   if (XR_FAILED(result))
   {
     util::error(Error::GenericOpenXR);
-    return BeginFrameResult::Error;
+    return false;
   }
 
+  swapchainImageAcquired = true;
+
   // Wait for the swapchain image
   XrSwapchainImageWaitInfo swapchainImageWaitInfo{ XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO };
   swapchainImageWaitInfo.timeout = XR_INFINITE_DURATION;
@@ -517,20 +515,83 @@ Headset::BeginFrameResult Headset::beginFrame(uint32_t& swapchainImageIndex)
   if (XR_FAILED(result))
   {
     util::error(Error::GenericOpenXR);
-    return BeginFrameResult::Error;
+    return false;
   }
 
-  return BeginFrameResult::RenderFully; // Request full rendering of the frame
+  if (depthSubmission)
+  {
+    // Acquire and wait for the depth swapchain image as well
+    result = xrAcquireSwapchainImage(depthSwapchain, &swapchainImageAcquireInfo, &depthSwapchainImageIndex);
+    if (XR_FAILED(result))
+    {
+      util::error(Error::GenericOpenXR);
+      return false;
+    }
+
+    depthSwapchainImageAcquired = true;
+
+    result = xrWaitSwapchainImage(depthSwapchain, &swapchainImageWaitInfo);
+    if (XR_FAILED(result))
+    {
+      util::error(Error::GenericOpenXR);
+      return false;
+    }
+  }
+
+  // Quad layers only acquire an image if their content has to be uploaded with this frame
+  for (QuadLayer* quadLayer : quadLayers)
+  {
+    if (!quadLayer->acquireImage())
+    {
+      return false;
+    }
+  }
+
+  return true;
 }
 
-void Headset::endFrame() const
+void Headset::endFrame()
 {
-  // Release the swapchain image
-  XrSwapchainImageReleaseInfo swapchainImageReleaseInfo{ XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
-  XrResult result = xrReleaseSwapchainImage(swapchain, &swapchainImageReleaseInfo);
-  if (XR_FAILED(result))
+  // Release the swapchain image, frames that skip rendering never acquired one
+  if (swapchainImageAcquired)
   {
-    return;
+    swapchainImageAcquired = false;
+
+    XrSwapchainImageReleaseInfo swapchainImageReleaseInfo{ XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
+    if (XR_FAILED(xrReleaseSwapchainImage(swapchain, &swapchainImageReleaseInfo)))
+    {
+      return;
+    }
+  }
+
+  // Release the depth swapchain image, and chain the depth of each eye to its color in frames that resolved it
+  const bool depthSubmitted = depthSwapchainImageAcquired;
+  if (depthSwapchainImageAcquired)
+  {
+    depthSwapchainImageAcquired = false;
+
+    XrSwapchainImageReleaseInfo swapchainImageReleaseInfo{ XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
+    if (XR_FAILED(xrReleaseSwapchainImage(depthSwapchain, &swapchainImageReleaseInfo)))
+    {
+      return;
+    }
+  }
+
+  // Release the images of the quad layers that uploaded new content, the others keep showing their last image
+  for (QuadLayer* quadLayer : quadLayers)
+  {
+    if (!quadLayer->releaseImage())
+    {
+      return;
+    }
+  }
+
+  for (size_t eyeIndex = 0u; eyeIndex < eyeRenderInfos.size(); ++eyeIndex)
+  {
+    XrCompositionLayerProjectionView& eyeRenderInfo = eyeRenderInfos.at(eyeIndex);
+    XrCompositionLayerDepthInfoKHR& eyeDepthInfo = eyeDepthInfos.at(eyeIndex);
+    eyeDepthInfo.subImage.imageRect = eyeRenderInfo.subImage.imageRect;
+    eyeRenderInfo.next = (depthSubmitted ? &eyeDepthInfo : nullptr);
   }
 
   // End the frame
@@ -539,7 +600,7 @@ void Headset::endFrame() const
   compositionLayerProjection.viewCount = static_cast<uint32_t>(eyeRenderInfos.size());
   compositionLayerProjection.views = eyeRenderInfos.data();
 
-  std::vector<XrCompositionLayerBaseHeader*> layers;
+  std::vector<const XrCompositionLayerBaseHeader*> layers;
 
   const bool positionValid = viewState.viewStateFlags & XR_VIEW_STATE_POSITION_VALID_BIT;
   const bool orientationValid = viewState.viewStateFlags & XR_VIEW_STATE_ORIENTATION_VALID_BIT;
@@ -548,12 +609,24 @@ void Headset::endFrame() const
     layers.push_back(reinterpret_cast<XrCompositionLayerBaseHeader*>(&compositionLayerProjection));
   }
 
+  if (frameState.shouldRender)
+  {
+    for (const QuadLayer* quadLayer : quadLayers)
+    {
+      const XrCompositionLayerBaseHeader* compositionLayer = quadLayer->getCompositionLayer();
+      if (compositionLayer)
+      {
+        layers.push_back(compositionLayer);
+      }
+    }
+  }
+
   XrFrameEndInfo frameEndInfo{ XR_TYPE_FRAME_END_INFO };
   frameEndInfo.displayTime = frameState.predictedDisplayTime;
   frameEndInfo.layerCount = static_cast<uint32_t>(layers.size());
   frameEndInfo.layers = layers.data();
   frameEndInfo.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE;
-  result = xrEndFrame(session, &frameEndInfo);
+  const XrResult result = xrEndFrame(session, &frameEndInfo);
   if (XR_FAILED(result))
   {
     return;
@@ -590,6 +663,36 @@ VkRenderPass Headset::getVkRenderPass() const
   return renderPass;
 }
 
+VkRenderPass Headset::getVkLateRenderPass() const
+{
+  return lateRenderPass;
+}
+
+bool Headset::isDynamicRendering() const
+{
+  return dynamicRendering;
+}
+
+VkFormat Headset::getColorFormat() const
+{
+  return colorFormat;
+}
+
+VkFormat Headset::getDepthFormat() const
+{
+  return depthFormat;
+}
+
+const ImageBuffer* Headset::getColorBuffer() const
+{
+  return colorBuffer;
+}
+
+const ImageBuffer* Headset::getDepthBuffer() const
+{
+  return depthBuffer;
+}
+
 size_t Headset::getEyeCount() const
 {
   return eyeCount;
@@ -601,6 +704,13 @@ VkExtent2D Headset::getEyeResolution(size_t eyeIndex) const
   return { eyeInfo.recommendedImageRectWidth, eyeInfo.recommendedImageRectHeight };
 }
 
+VkExtent2D Headset::getRenderResolution(size_t eyeIndex) const
+{
+  const VkExtent2D eyeResolution = getEyeResolution(eyeIndex);
+  return { std::max(static_cast<uint32_t>(static_cast<float>(eyeResolution.width) * renderScale), 1u),
+           std::max(static_cast<uint32_t>(static_cast<float>(eyeResolution.height) * renderScale), 1u) };
+}
+
 glm::mat4 Headset::getEyeViewMatrix(size_t eyeIndex) const
 {
   return eyeViewMatrices.at(eyeIndex);
@@ -626,6 +736,386 @@ RenderTarget* Headset::getRenderTarget(size_t swapchainImageIndex) const
   return swapchainRenderTargets.at(swapchainImageIndex);
 }
 
+const std::vector<glm::vec2>& Headset::getVisibilityMask(size_t eyeIndex) const
+{
+  return visibilityMasks.at(eyeIndex);
+}
+
+size_t Headset::getVisibilityMaskVersion() const
+{
+  return visibilityMaskVersion;
+}
+
+bool Headset::isDepthSubmissionSupported() const
+{
+  return depthSwapchain != nullptr;
+}
+
+void Headset::setDepthSubmission(bool enabled)
+{
+  depthSubmission = enabled && isDepthSubmissionSupported();
+}
+
+bool Headset::isDepthSubmissionEnabled() const
+{
+  return depthSubmission;
+}
+
+RenderTarget* Headset::getDepthRenderTarget() const
+{
+  return depthSwapchainImageAcquired ? depthSwapchainRenderTargets.at(depthSwapchainImageIndex) : nullptr;
+}
+
+QuadLayer* Headset::addQuadLayer(VkExtent2D resolution, const XrPosef& pose, const XrExtent2Df& size)
+{
+  QuadLayer* quadLayer = new QuadLayer(context, session, space, resolution, colorFormat, pose, size);
+  if (!quadLayer->isValid())
+  {
+    delete quadLayer;
+    return nullptr;
+  }
+
+  quadLayers.push_back(quadLayer);
+  return quadLayer;
+}
+
+size_t Headset::getQuadLayerCount() const
+{
+  return quadLayers.size();
+}
+
+QuadLayer* Headset::getQuadLayer(size_t quadLayerIndex) const
+{
+  return quadLayers.at(quadLayerIndex);
+}
+
+void Headset::setRenderScale(float scale)
+{
+  renderScale = std::clamp(scale, 0.0f, 1.0f);
+
+  // The runtime only samples the rendered sub-rectangle of each eye
+  for (size_t eyeIndex = 0u; eyeIndex < eyeRenderInfos.size(); ++eyeIndex)
+  {
+    const VkExtent2D renderResolution = getRenderResolution(eyeIndex);
+    eyeRenderInfos.at(eyeIndex).subImage.imageRect.extent = { static_cast<int32_t>(renderResolution.width),
+                                                              static_cast<int32_t>(renderResolution.height) };
+  }
+}
+
+float Headset::getRenderScale() const
+{
+  return renderScale;
+}
+
+bool Headset::createDepthSwapchain()
+{
+  const XrViewConfigurationView& eyeImageInfo = eyeImageInfos.at(0u);
+
+  // Create a depth swapchain with a layer per eye, like the color swapchain
+  XrSwapchainCreateInfo swapchainCreateInfo{ XR_TYPE_SWAPCHAIN_CREATE_INFO };
+  swapchainCreateInfo.usageFlags = XR_SWAPCHAIN_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  swapchainCreateInfo.format = depthFormat;
+  swapchainCreateInfo.sampleCount = 1u;
+  swapchainCreateInfo.width = eyeImageInfo.recommendedImageRectWidth;
+  swapchainCreateInfo.height = eyeImageInfo.recommendedImageRectHeight;
+  swapchainCreateInfo.arraySize = static_cast<uint32_t>(eyeCount);
+  swapchainCreateInfo.faceCount = 1u;
+  swapchainCreateInfo.mipCount = 1u;
+  XrResult result = xrCreateSwapchain(session, &swapchainCreateInfo, &depthSwapchain);
+  if (XR_FAILED(result))
+  {
+    util::error(Error::GenericOpenXR);
+    return false;
+  }
+
+  // Retrieve the depth swapchain images
+  uint32_t swapchainImageCount;
+  result = xrEnumerateSwapchainImages(depthSwapchain, 0u, &swapchainImageCount, nullptr);
+  if (XR_FAILED(result))
+  {
+    util::error(Error::GenericOpenXR);
+    return false;
+  }
+
+  std::vector<XrSwapchainImageVulkanKHR> swapchainImages(swapchainImageCount);
+  for (XrSwapchainImageVulkanKHR& swapchainImage : swapchainImages)
+  {
+    swapchainImage.type = XR_TYPE_SWAPCHAIN_IMAGE_VULKAN_KHR;
+    swapchainImage.next = nullptr;
+  }
+
+  XrSwapchainImageBaseHeader* data = reinterpret_cast<XrSwapchainImageBaseHeader*>(swapchainImages.data());
+  result = xrEnumerateSwapchainImages(depthSwapchain, static_cast<uint32_t>(swapchainImages.size()),
+                                      &swapchainImageCount, data);
+  if (XR_FAILED(result))
+  {
+    util::error(Error::GenericOpenXR);
+    return false;
+  }
+
+  // Create the render targets, which are only resolved into and need no framebuffer
+  depthSwapchainRenderTargets.resize(swapchainImages.size());
+  for (size_t renderTargetIndex = 0u; renderTargetIndex < depthSwapchainRenderTargets.size(); ++renderTargetIndex)
+  {
+    RenderTarget*& renderTarget = depthSwapchainRenderTargets.at(renderTargetIndex);
+    renderTarget = new RenderTarget(context->getVkDevice(), swapchainImages.at(renderTargetIndex).image, nullptr,
+                                    nullptr, getEyeResolution(0u), depthFormat, nullptr, 2u);
+    if (!renderTarget->isValid())
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Headset::createRenderPasses()
+{
+  const VkDevice device = context->getVkDevice();
+  const VkSampleCountFlagBits multisampleCount = context->getMultisampleCount();
+
+  // The frame is drawn in two passes for two-phase occlusion culling. The early pass clears the attachments and draws
+  // what was visible last frame, and keeps the depth for building the depth pyramid. The late pass continues on top of
+  // that with the newly revealed objects and resolves into the swapchain image. Both passes are compatible, so they
+  // share framebuffers and pipelines.
+  // Each pass consists of a depth-only subpass for the optional depth prepass of the renderer, which is left empty when
+  // the prepass is disabled, followed by the color subpass.
+  for (const bool late : { false, true })
+  {
+    constexpr std::array<uint32_t, 2u> viewMasks = { 0b00000011, 0b00000011 }; // One per subpass
+    constexpr uint32_t correlationMask = 0b00000011;
+
+    // [tdbe] Single pass / multiview explanation:
+    // [tdbe] We feed this multiview create info into the regular vk render pass creation.
+    // [tdbe] Vulklan will execute the render pipeline twice (or whatever number is in pViewMasks)
+    // [tdbe] To use multiview, in the shader you enable the GL_EXT_multiview extension, and then
+    // [tdbe] get a glViewIndex depending on what multiview view you are about to output to. So you
+    // [tdbe] can use e.g. an array of transformation matrixes indexed by this.
+    VkRenderPassMultiviewCreateInfo renderPassMultiviewCreateInfo{
+      VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO
+    };
+    renderPassMultiviewCreateInfo.subpassCount = static_cast<uint32_t>(viewMasks.size());
+    renderPassMultiviewCreateInfo.pViewMasks = viewMasks.data();
+    renderPassMultiviewCreateInfo.correlationMaskCount = 1u;
+    renderPassMultiviewCreateInfo.pCorrelationMasks = &correlationMask;
+
+    VkAttachmentDescription colorAttachmentDescription{};
+    colorAttachmentDescription.format = colorFormat;
+    colorAttachmentDescription.samples = multisampleCount;
+    colorAttachmentDescription.loadOp = late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachmentDescription.storeOp = late ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachmentDescription.initialLayout =
+      late ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorAttachmentReference;
+    colorAttachmentReference.attachment = 0u;
+    colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription depthAttachmentDescription{};
+    depthAttachmentDescription.format = depthFormat;
+    depthAttachmentDescription.samples = multisampleCount;
+    depthAttachmentDescription.loadOp = late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachmentDescription.storeOp = late ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachmentDescription.initialLayout =
+      late ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentReference;
+    depthAttachmentReference.attachment = 1u;
+    depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    // The early pass resolve gets overwritten by the late pass, so it does not need to be stored
+    VkAttachmentDescription resolveAttachmentDescription{};
+    resolveAttachmentDescription.format = colorFormat;
+    resolveAttachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
+    resolveAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    resolveAttachmentDescription.storeOp = late ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    resolveAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    resolveAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    resolveAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resolveAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference resolveAttachmentReference;
+    resolveAttachmentReference.attachment = 2u;
+    resolveAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription depthSubpassDescription{};
+    depthSubpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    depthSubpassDescription.pDepthStencilAttachment = &depthAttachmentReference;
+
+    VkSubpassDescription colorSubpassDescription{};
+    colorSubpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    colorSubpassDescription.colorAttachmentCount = 1u;
+    colorSubpassDescription.pColorAttachments = &colorAttachmentReference;
+    colorSubpassDescription.pDepthStencilAttachment = &depthAttachmentReference;
+    colorSubpassDescription.pResolveAttachments = &resolveAttachmentReference;
+
+    const std::array subpassDescriptions = { depthSubpassDescription, colorSubpassDescription };
+
+    // The color subpass tests against the depth of the prepass. No external subpass dependencies are needed, the frame
+    // graph of the renderer places the barriers in between the passes and everything else that uses the attachments.
+    VkSubpassDependency subpassDependency{};
+    subpassDependency.srcSubpass = 0u;
+    subpassDependency.dstSubpass = 1u;
+    subpassDependency.srcStageMask =
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpassDependency.dstStageMask =
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpassDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    subpassDependency.dstAccessMask =
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    subpassDependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT | VK_DEPENDENCY_VIEW_LOCAL_BIT;
+
+    const std::array attachments = { colorAttachmentDescription, depthAttachmentDescription,
+                                     resolveAttachmentDescription };
+
+    VkRenderPassCreateInfo renderPassCreateInfo{ VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+    renderPassCreateInfo.pNext = &renderPassMultiviewCreateInfo;
+    renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    renderPassCreateInfo.pAttachments = attachments.data();
+    renderPassCreateInfo.subpassCount = static_cast<uint32_t>(subpassDescriptions.size());
+    renderPassCreateInfo.pSubpasses = subpassDescriptions.data();
+    renderPassCreateInfo.dependencyCount = 1u;
+    renderPassCreateInfo.pDependencies = &subpassDependency;
+
+    if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, late ? &lateRenderPass : &renderPass) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Headset::locateEyes()
+{
+  viewState.type = XR_TYPE_VIEW_STATE;
+  uint32_t viewCount;
+  XrViewLocateInfo viewLocateInfo{ XR_TYPE_VIEW_LOCATE_INFO };
+  viewLocateInfo.viewConfigurationType = context->getXrViewType();
+  viewLocateInfo.displayTime = frameState.predictedDisplayTime;
+  viewLocateInfo.space = space;
+  const XrResult result = xrLocateViews(session, &viewLocateInfo, &viewState, static_cast<uint32_t>(eyePoses.size()),
+                                        &viewCount, eyePoses.data());
+  if (XR_FAILED(result))
+  {
+    util::error(Error::GenericOpenXR);
+    return false;
+  }
+
+  if (viewCount != eyeCount)
+  {
+    util::error(Error::GenericOpenXR);
+    return false;
+  }
+
+  // Update the eye render infos, view and projection matrices
+  for (size_t eyeIndex = 0u; eyeIndex < eyeCount; ++eyeIndex)
+  {
+    // Copy the eye poses into the eye render infos
+    XrCompositionLayerProjectionView& eyeRenderInfo = eyeRenderInfos.at(eyeIndex);
+    const XrView& eyePose = eyePoses.at(eyeIndex);
+    eyeRenderInfo.pose = eyePose.pose;
+    eyeRenderInfo.fov = eyePose.fov;
+
+    // Update the view and projection matrices
+    const XrPosef& pose = eyeRenderInfo.pose;
+    eyeViewMatrices.at(eyeIndex) = glm::inverse(util::poseToMatrix(pose));
+    eyeProjectionMatrices.at(eyeIndex) = util::createProjectionMatrix(eyeRenderInfo.fov, nearClip, farClip);
+  }
+
+  if (visibilityMasksOutdated)
+  {
+    projectVisibilityMasks();
+  }
+
+  return true;
+}
+
+bool Headset::fetchVisibilityMasks()
+{
+  visibilityMaskVertices.assign(eyeCount, {});
+  visibilityMasksOutdated = true;
+
+  const PFN_xrGetVisibilityMaskKHR xrGetVisibilityMaskKHR = context->getXrGetVisibilityMaskKHR();
+  if (!xrGetVisibilityMaskKHR)
+  {
+    return true;
+  }
+
+  for (size_t eyeIndex = 0u; eyeIndex < eyeCount; ++eyeIndex)
+  {
+    // Get the number of vertices and indices of the hidden area
+    XrVisibilityMaskKHR visibilityMask{ XR_TYPE_VISIBILITY_MASK_KHR };
+    XrResult result = xrGetVisibilityMaskKHR(session, context->getXrViewType(), static_cast<uint32_t>(eyeIndex),
+                                             XR_VISIBILITY_MASK_TYPE_HIDDEN_TRIANGLE_MESH_KHR, &visibilityMask);
+    if (XR_FAILED(result))
+    {
+      util::error(Error::GenericOpenXR);
+      return false;
+    }
+
+    // Retrieve the vertices and indices
+    std::vector<XrVector2f> vertices(visibilityMask.vertexCountOutput);
+    std::vector<uint32_t> indices(visibilityMask.indexCountOutput);
+    visibilityMask.vertexCapacityInput = static_cast<uint32_t>(vertices.size());
+    visibilityMask.vertices = vertices.data();
+    visibilityMask.indexCapacityInput = static_cast<uint32_t>(indices.size());
+    visibilityMask.indices = indices.data();
+    result = xrGetVisibilityMaskKHR(session, context->getXrViewType(), static_cast<uint32_t>(eyeIndex),
+                                    XR_VISIBILITY_MASK_TYPE_HIDDEN_TRIANGLE_MESH_KHR, &visibilityMask);
+    if (XR_FAILED(result))
+    {
+      util::error(Error::GenericOpenXR);
+      return false;
+    }
+
+    // Unroll the indexed triangles into a triangle list, the masks are small and drawn once per frame
+    std::vector<XrVector2f>& eyeVertices = visibilityMaskVertices.at(eyeIndex);
+    for (const uint32_t index : indices)
+    {
+      if (index < vertices.size())
+      {
+        eyeVertices.push_back(vertices.at(index));
+      }
+    }
+  }
+
+  printf("\n[Headset][log] Fetched a visibility mask with %zu vertices for the first eye",
+         visibilityMaskVertices.empty() ? 0u : visibilityMaskVertices.at(0u).size());
+  return true;
+}
+
+void Headset::projectVisibilityMasks()
+{
+  for (size_t eyeIndex = 0u; eyeIndex < eyeCount; ++eyeIndex)
+  {
+    std::vector<glm::vec2>& visibilityMask = visibilityMasks.at(eyeIndex);
+    if (!context->getXrGetVisibilityMaskKHR())
+    {
+      visibilityMask.assign(fallbackVisibilityMask.begin(), fallbackVisibilityMask.end());
+      continue;
+    }
+
+    // The vertices of the runtime lie on the plane at a distance of 1 in front of the eye in view space
+    visibilityMask.clear();
+    for (const XrVector2f& vertex : visibilityMaskVertices.at(eyeIndex))
+    {
+      const glm::vec4 clipPosition = eyeProjectionMatrices.at(eyeIndex) * glm::vec4(vertex.x, vertex.y, -1.0f, 1.0f);
+      visibilityMask.push_back(glm::vec2(clipPosition) / clipPosition.w);
+    }
+  }
+
+  visibilityMasksOutdated = false;
+  ++visibilityMaskVersion;
+}
+
 bool Headset::beginSession() const
 {
   // Start the session
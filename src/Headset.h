@@ -1,6 +1,7 @@
 #pragma once
 
 #include <glm/fwd.hpp>
+#include <glm/vec2.hpp>
 
 #include <openxr/openxr.h>
 
@@ -10,13 +11,24 @@
 
 class Context;
 class ImageBuffer;
+class QuadLayer;
 class RenderTarget;
 
 /*
  * The headset class facilitates rendering into the device. It holds functionality to begin and end rendering a frame,
  * to find out when the user has quit the application through the headset's operating system, as opposed to the mirror
  * view window, and to retrieve the current orientation of the device. It relies on both OpenXR and Vulkan to provide
- * these features.
+ * these features. The headset renders either with Vulkan 1.3 dynamic rendering, or with render passes and a framebuffer
+ * per swapchain image on devices without it. The eyes can be rendered at a scaled down resolution, in which case only
+ * the rendered sub-rectangle of the swapchain images is submitted, and none of the images have to be recreated.
+ * Beginning a frame doesn't acquire a swapchain image yet, so that the frame can be simulated and recorded while the
+ * compositor still reads from the previous image. The image is only acquired and waited for right before submission.
+ * The hidden area of each eye, which can't be seen through the lenses, is fetched from the runtime as a visibility mask
+ * and fetched again whenever the runtime reports that it has changed. Runtimes without visibility masks get a small
+ * conservative mask in the corners of the eyes instead. Where the runtime supports depth layers, the depth of the eyes
+ * can be submitted alongside their color through a separate depth swapchain, for positional reprojection. Flat
+ * content like user interface panels can be added as quad layers, which are submitted on top of the eyes and only
+ * acquire a swapchain image of their own in frames in which their content has changed.
  */
 class Headset final
 {
@@ -31,8 +43,10 @@ public:
     SkipRender,  // Skip rendering the frame but end it
     SkipFully    // Skip processing this frame entirely without ending it
   };
-  BeginFrameResult beginFrame(uint32_t& swapchainImageIndex);
-  void endFrame() const;
+  BeginFrameResult beginFrame();
+  bool relocateEyes(); // Updates the eye poses for late latching, they are submitted with the frame, false on error
+  bool acquireSwapchainImage(uint32_t& swapchainImageIndex); // Blocks until the image is writable, false on error
+  void endFrame();
 
   bool isValid() const;
   bool isExitRequested() const;
@@ -41,10 +55,17 @@ public:
   XrSpace getXrSpace() const;
   XrFrameState getXrFrameState() const;
 
-  VkRenderPass getVkRenderPass() const;
+  VkRenderPass getVkRenderPass() const;     // nullptr with dynamic rendering
+  VkRenderPass getVkLateRenderPass() const; // nullptr with dynamic rendering
+  bool isDynamicRendering() const;
+  VkFormat getColorFormat() const;
+  VkFormat getDepthFormat() const;
+  const ImageBuffer* getColorBuffer() const;
+  const ImageBuffer* getDepthBuffer() const;
 
   size_t getEyeCount() const;
   VkExtent2D getEyeResolution(size_t eyeIndex) const;
+  VkExtent2D getRenderResolution(size_t eyeIndex) const; // The scaled sub-rectangle of the eye that is rendered into
   glm::mat4 getEyeViewMatrix(size_t eyeIndex) const;
   glm::mat4 getEyeProjectionMatrix(size_t eyeIndex) const;
   std::vector<XrView> getEyePoses() const;
@@ -53,6 +74,25 @@ public:
 
   RenderTarget* getRenderTarget(size_t swapchainImageIndex) const;
 
+  // The hidden area of an eye as a triangle list in normalized device coordinates, the version changes with the masks
+  const std::vector<glm::vec2>& getVisibilityMask(size_t eyeIndex) const;
+  size_t getVisibilityMaskVersion() const;
+
+  // Submitting depth takes effect with the next acquired swapchain image
+  bool isDepthSubmissionSupported() const;
+  void setDepthSubmission(bool enabled);
+  bool isDepthSubmissionEnabled() const;
+  RenderTarget* getDepthRenderTarget() const; // Of the acquired depth swapchain image, nullptr if the frame has none
+
+  // Adds a quad layer with its own swapchain of the given resolution, owned by the headset, nullptr on error
+  QuadLayer* addQuadLayer(VkExtent2D resolution, const XrPosef& pose, const XrExtent2Df& size);
+  size_t getQuadLayerCount() const;
+  QuadLayer* getQuadLayer(size_t quadLayerIndex) const;
+
+  // Scales the eye resolution down to render into the top left sub-rectangle of the attachments and swapchain images
+  void setRenderScale(float scale);
+  float getRenderScale() const;
+
 private:
   bool valid = true;
   bool exitRequested = false;
@@ -72,14 +112,36 @@ private:
   std::vector<XrViewConfigurationView> eyeImageInfos;
   std::vector<XrView> eyePoses;
   std::vector<XrCompositionLayerProjectionView> eyeRenderInfos;
+  float renderScale = 1.0f;
+
+  std::vector<std::vector<XrVector2f>> visibilityMaskVertices; // From the runtime, on the plane 1m in front of the eye
+  std::vector<std::vector<glm::vec2>> visibilityMasks;         // Projected into normalized device coordinates
+  bool visibilityMasksOutdated = true; // Whether the masks need to be projected with the next eye poses
+  size_t visibilityMaskVersion = 0u;
 
   XrSwapchain swapchain = nullptr;
   std::vector<RenderTarget*> swapchainRenderTargets;
+  bool swapchainImageAcquired = false; // Whether the current frame has an image to release
+
+  XrSwapchain depthSwapchain = nullptr; // Only created if depth can be submitted
+  std::vector<RenderTarget*> depthSwapchainRenderTargets;
+  std::vector<XrCompositionLayerDepthInfoKHR> eyeDepthInfos;
+  uint32_t depthSwapchainImageIndex = 0u;
+  bool depthSwapchainImageAcquired = false;
+  bool depthSubmission = false;
+
+  std::vector<QuadLayer*> quadLayers; // Submitted on top of the eyes in the order they were added
 
-  VkRenderPass renderPass = nullptr;
+  bool dynamicRendering = false;
+  VkRenderPass renderPass = nullptr, lateRenderPass = nullptr;
 
   ImageBuffer *colorBuffer = nullptr, *depthBuffer = nullptr;
 
+  bool createDepthSwapchain();
+  bool createRenderPasses();
+  bool locateEyes();
+  bool fetchVisibilityMasks();
+  void projectVisibilityMasks();
   bool beginSession() const;
   bool endSession() const;
 };
\ No newline at end of file
@@ -4,7 +4,8 @@
 
 /*
  * The image buffer class represents a convienent combination of an image, its associated memory, and a corresponding
- * image view in Vulkan. The class is used to bundle all required resources for the color and depth buffer respectively.
+ * image view in Vulkan. The class is used to bundle all required resources for the color and depth buffer respectively,
+ * as well as for the hierarchical depth pyramid used for occlusion culling.
  */
 class ImageBuffer final
 {
@@ -12,14 +13,16 @@ public:
   ImageBuffer(const Context* context,
               VkExtent2D size,
               VkFormat format,
-              VkImageUsageFlagBits usage,
+              VkImageUsageFlags usage,
               VkSampleCountFlagBits samples,
               VkImageAspectFlags aspect,
-              size_t layerCount);
+              size_t layerCount,
+              uint32_t mipLevelCount = 1u);
   ~ImageBuffer();
 
   bool isValid() const;
 
+  VkImage getImage() const;
   VkImageView getImageView() const;
 
 private:
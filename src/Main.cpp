@@ -5,14 +5,18 @@
 #include "Headset.h"
 #include "MeshData.h"
 #include "MirrorView.h"
+#include "QuadLayer.h"
+#include "QualityGovernor.h"
 #include "GameData.h"
 #include "Renderer.h"
+#include "ResolutionScaler.h"
 #include "gameMechanics/GameBehaviour.h"
 #include "gameMechanics/HandsBehaviour.h"
 #include "gameMechanics/InputTesterBehaviour.h"
 #include "gameMechanics/WorldObjectsMiscBehaviour.h"
 #include "gameMechanics/LocomotionBehaviour.h"
 
+#include <algorithm>
 #include <chrono>
 
 #include <stdio.h>
@@ -20,10 +24,62 @@
 namespace
 {
 constexpr float flySpeedMultiplier = 2.5f;
+
+// Bounds of the render scale that the resolution scaler picks from the GPU frame time, the quality governor lowers the
+// minimum further when the GPU frame time stays over budget anyway
+constexpr float maximumRenderScale = 1.0f;
+const std::vector<float> minimumRenderScales = { 0.8f, 0.7f, 0.6f, 0.5f };
+
+// Screen sizes in pixels below which objects are culled, per quality level
+const std::vector<float> minimumScreenSizes = { 0.0f, 2.0f, 4.0f, 8.0f };
+
+// Update intervals in frames of the behaviours that only drive cosmetic animation, per quality level
+const std::vector<size_t> behaviourUpdateIntervals = { 1u, 2u, 4u };
+
+// Locate the eyes again right before the frame is submitted and render with those poses instead, which shortens the
+// latency from the head motion to the displayed image by the time it takes to update and record the frame
+constexpr bool lateLatchEyePoses = true;
+
+// Submit the depth of the eyes with their color where the runtime supports it, so that it can reproject positionally
+// when a frame is missed. The quality governor turns it off again when the GPU frame time stays over budget, based on
+// the measured cost of resolving the depth.
+constexpr bool submitDepth = true;
+
+// Show the level of each quality knob on a panel in front of the user, which is submitted as a quad layer and only
+// redrawn when a level changes
+constexpr bool showQualityPanel = true;
+constexpr VkExtent2D qualityPanelResolution = { 256u, 64u };
+constexpr XrExtent2Df qualityPanelSize = { 0.4f, 0.1f };                                    // In meters
+constexpr XrPosef qualityPanelPose = { { 0.0f, 0.0f, 0.0f, 1.0f }, { 0.0f, 1.2f, -1.0f } }; // In stage space
+
+// Draws a bar per knob, which gets shorter with every level that the knob is lowered by
+std::vector<uint32_t> drawQualityPanel(const std::vector<size_t>& knobLevels)
+{
+  constexpr uint32_t backgroundColor = 0x80202020u, barColor = 0xFF40C040u; // RGBA with red in the lowest byte
+
+  std::vector<uint32_t> pixels(qualityPanelResolution.width * qualityPanelResolution.height, backgroundColor);
+  const uint32_t rowHeight = qualityPanelResolution.height / static_cast<uint32_t>(knobLevels.size());
+  for (size_t knobIndex = 0u; knobIndex < knobLevels.size(); ++knobIndex)
+  {
+    const uint32_t barWidth = qualityPanelResolution.width / static_cast<uint32_t>(knobLevels.at(knobIndex) + 1u);
+    const uint32_t firstRow = static_cast<uint32_t>(knobIndex) * rowHeight;
+    for (uint32_t y = firstRow + 2u; y + 2u < firstRow + rowHeight; ++y)
+    {
+      std::fill_n(pixels.begin() + y * qualityPanelResolution.width, barWidth, barColor);
+    }
+  }
+
+  return pixels;
+}
+
+// Keeps every quality knob at its highest level, so that frame timings can be compared between runs
+constexpr bool pinQualityForBenchmarking = false;
 }
 
 int main()
 {
+  const std::chrono::high_resolution_clock::time_point startupTime = std::chrono::high_resolution_clock::now();
+
   glm::mat4 cameraMatrix = glm::mat4(1.0f); // Transform from world to stage space
 
   Context context;
@@ -49,6 +105,17 @@ int main()
     return EXIT_FAILURE;
   }
 
+  // The quad layers have to exist before the renderer, which adds an upload pass for each of them
+  QuadLayer* qualityPanel = nullptr;
+  if (showQualityPanel)
+  {
+    qualityPanel = headset.addQuadLayer(qualityPanelResolution, qualityPanelPose, qualityPanelSize);
+    if (!qualityPanel)
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
   
   Inputspace::Input inputSystem(context.getXrInstance(), headset.getXrSession());
   if (!inputSystem.isValid())
@@ -68,8 +135,9 @@ int main()
   diffuseMaterial.vertShaderName = "shaders/Diffuse.vert.spv";
   diffuseMaterial.fragShaderName = "shaders/Diffuse.frag.spv";
   diffuseMaterial.dynamicUniformData.colorMultiplier = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
-  bikeMaterial.vertShaderName = "shaders/DiffuseTransparent.vert.spv";
-  bikeMaterial.fragShaderName = "shaders/DiffuseTransparent.frag.spv";
+  bikeMaterial.vertShaderName = "shaders/Diffuse.vert.spv";
+  bikeMaterial.fragShaderName = "shaders/Diffuse.frag.spv";
+  bikeMaterial.pipelineData.alphaOutput = true;
   bikeMaterial.pipelineData.cullMode = VkCullModeFlagBits::VK_CULL_MODE_NONE;
   bikeMaterial.dynamicUniformData.colorMultiplier = glm::vec4(1.0f, 0.0f, 0.1f, 0.66f);
   logoMaterial.vertShaderName = "shaders/Diffuse.vert.spv";
@@ -92,6 +160,14 @@ int main()
   std::vector<GameObject*> gameObjects = { &grid, &ruins, &carLeft, &carRight, &beetle, &bike, &handLeft, &handRight, &logo };
   PlayerObject playerObject = PlayerObject("XR Player 1", &head, &handLeft, &handRight);
 
+  // Objects that never move get their draws recorded once instead of every frame
+  grid.isStatic = true;
+  ruins.isStatic = true;
+  carLeft.isStatic = true;
+  carRight.isStatic = true;
+  beetle.isStatic = true;
+  logo.isStatic = true;
+
   carLeft.worldMatrix =
     glm::rotate(glm::translate(glm::mat4(1.0f), { -3.5f, 0.0f, -7.0f }), glm::radians(75.0f), { 0.0f, 1.0f, 0.0f });
   carRight.worldMatrix =
@@ -143,12 +219,62 @@ int main()
     return EXIT_FAILURE;
   }
 
+  // Log the startup time, which is dominated by pipeline creation when the pipeline cache is cold
+  {
+    const long long startupMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                            std::chrono::high_resolution_clock::now() - startupTime)
+                                            .count();
+    printf("\n[Main][log] Startup took %lld ms with a %s pipeline cache", startupMilliseconds,
+           context.isPipelineCacheWarm() ? "warm" : "cold");
+  }
+
   std::vector<GameBehaviour*> gameBehaviours = {
     new LocomotionBehaviour(playerObject, 1, 3, 1),
-    new HandsBehaviour(playerObject),
+    new HandsBehaviour(playerObject)
+  };
+
+  // Cosmetic behaviours that can be updated less often than every frame, they get the time since their last update
+  std::vector<GameBehaviour*> throttledGameBehaviours = {
     new WorldObjectsMiscBehaviour(bike, logoMaterial)
   };
+  size_t behaviourUpdateInterval = 1u, framesSinceBehaviourUpdate = 0u;
+  float throttledDeltaTime = 0.0f;
     
+  ResolutionScaler resolutionScaler(minimumRenderScales.front(), maximumRenderScale);
+
+  // The knobs are lowered in the order they are registered in. Level of detail and the multisample count are not knobs,
+  // as there are no levels of detail and the sample count is fixed when the attachments and pipelines are created.
+  QualityGovernor qualityGovernor;
+  const size_t depthSubmissionKnob =
+    qualityGovernor.addKnob("Depth submission", QualityGovernor::Budget::Gpu, { 0.05f, 0.0f },
+                            [&headset](size_t level) { headset.setDepthSubmission(level == 0u); });
+  const size_t cullingKnob =
+    qualityGovernor.addKnob("Culling", QualityGovernor::Budget::Gpu, { 0.06f, 0.04f, 0.02f, 0.0f },
+                            [&renderer](size_t level) { renderer.setMinimumScreenSize(minimumScreenSizes.at(level)); });
+  const size_t behaviourKnob =
+    qualityGovernor.addKnob("Behaviour update rate", QualityGovernor::Budget::Cpu, { 0.04f, 0.02f, 0.0f },
+                            [&behaviourUpdateInterval](size_t level)
+                            { behaviourUpdateInterval = behaviourUpdateIntervals.at(level); });
+  const size_t renderScaleKnob = qualityGovernor.addKnob(
+    "Render scale", QualityGovernor::Budget::Gpu, { 0.3f, 0.2f, 0.1f, 0.0f },
+    [&resolutionScaler](size_t level) { resolutionScaler.setMinimumScale(minimumRenderScales.at(level)); });
+  if (pinQualityForBenchmarking)
+  {
+    for (const size_t knobIndex : { depthSubmissionKnob, cullingKnob, behaviourKnob, renderScaleKnob })
+    {
+      qualityGovernor.pinKnob(knobIndex, 0u);
+    }
+  }
+
+  if (!submitDepth || !headset.isDepthSubmissionSupported())
+  {
+    qualityGovernor.pinKnob(depthSubmissionKnob, 1u);
+  }
+
+  std::vector<size_t> qualityPanelKnobLevels; // As last drawn onto the quality panel
+
+  float cpuFrameTime = 0.0f; // In milliseconds, of the last frame from its beginning to its submission
+
   static float gameTime = 0.0f;
   
   // Main loop
@@ -163,16 +289,24 @@ int main()
     previousTime = nowTime;
 
     mirrorView.processWindowEvents();
+
+    // Toggle the depth prepass at runtime to compare the frame timings with and without it
+    if (mirrorView.consumeDepthPrepassToggle())
+    {
+      renderer.setDepthPrepass(!renderer.isDepthPrepassEnabled());
+    }
     
-    uint32_t swapchainImageIndex;
-    const Headset::BeginFrameResult frameResult = headset.beginFrame(swapchainImageIndex);
+    // The frame is processed in stages: simulate, record, then acquire the swapchain image and submit. Only the last
+    // stage waits for the compositor, so the CPU work of this frame overlaps the GPU rendering the previous frame
+    const Headset::BeginFrameResult frameResult = headset.beginFrame();
     if (frameResult == Headset::BeginFrameResult::Error)
     {
       return EXIT_FAILURE;
     }
     else if (frameResult == Headset::BeginFrameResult::RenderFully)
     {
-      
+      const std::chrono::high_resolution_clock::time_point frameStartTime = std::chrono::high_resolution_clock::now();
+
       if (!inputSystem.Sync(headset.getXrSpace(), headset.getXrFrameState().predictedDisplayTime, 
                             headset.getEyePoses(), headset.getSessionState()))
       {
@@ -186,19 +320,87 @@ int main()
       for(size_t i = 0; i < gameBehaviours.size(); i++){
         gameBehaviours[i]->Update(deltaTime, gameTime, inputData, inputHaptics);
       }
+
+      throttledDeltaTime += deltaTime;
+      if (++framesSinceBehaviourUpdate >= behaviourUpdateInterval)
+      {
+        for (GameBehaviour* gameBehaviour : throttledGameBehaviours)
+        {
+          gameBehaviour->Update(throttledDeltaTime, gameTime, inputData, inputHaptics);
+        }
+
+        framesSinceBehaviourUpdate = 0u;
+        throttledDeltaTime = 0.0f;
+      }
       inputSystem.ApplyHapticFeedbackRequests(inputHaptics);
 
-      // Render
-      renderer.render(glm::inverse(head.worldMatrix), swapchainImageIndex, gameTime);
+      // Scale the render resolution to keep the GPU frame time within the display period, and move the quality knobs
+      // when that is not enough or the CPU is over budget
+      const float frameBudget = static_cast<float>(headset.getXrFrameState().predictedDisplayPeriod) / 1000000.0f;
+      if (renderer.getDepthResolveTime() > 0.0f && frameBudget > 0.0f)
+      {
+        qualityGovernor.setKnobLevelCost(depthSubmissionKnob, 0u, renderer.getDepthResolveTime() / frameBudget);
+      }
+      qualityGovernor.update(cpuFrameTime, renderer.getGpuFrameTime(), frameBudget);
+      headset.setRenderScale(resolutionScaler.update(renderer.getGpuFrameTime(), frameBudget));
+
+      // Only redraw the quality panel when a knob has moved, otherwise the runtime keeps showing the last content
+      if (qualityPanel)
+      {
+        std::vector<size_t> knobLevels;
+        for (const size_t knobIndex : { depthSubmissionKnob, cullingKnob, behaviourKnob, renderScaleKnob })
+        {
+          knobLevels.push_back(qualityGovernor.getKnobLevel(knobIndex));
+        }
+
+        if (knobLevels != qualityPanelKnobLevels)
+        {
+          if (!qualityPanel->setContent(drawQualityPanel(knobLevels)))
+          {
+            return EXIT_FAILURE;
+          }
+
+          qualityPanelKnobLevels = knobLevels;
+        }
+      }
+
+      // Record
+      renderer.render(glm::inverse(head.worldMatrix), gameTime);
 
-      const MirrorView::RenderResult mirrorResult = mirrorView.render(swapchainImageIndex);
+      const MirrorView::RenderResult mirrorResult = mirrorView.render();
       if (mirrorResult == MirrorView::RenderResult::Error)
       {
         return EXIT_FAILURE;
       }
 
+      // Acquire and submit, the time spent waiting for the swapchain image is not part of the CPU frame time
+      const std::chrono::high_resolution_clock::time_point acquireStartTime = std::chrono::high_resolution_clock::now();
+      uint32_t swapchainImageIndex;
+      if (!headset.acquireSwapchainImage(swapchainImageIndex))
+      {
+        return EXIT_FAILURE;
+      }
+      const std::chrono::high_resolution_clock::duration acquireDuration =
+        std::chrono::high_resolution_clock::now() - acquireStartTime;
+
+      // Latch the eye poses after waiting for the swapchain image, so that they are as fresh as possible
+      if (lateLatchEyePoses)
+      {
+        if (!headset.relocateEyes())
+        {
+          return EXIT_FAILURE;
+        }
+
+        renderer.latchEyePoses();
+      }
+
       const bool mirrorViewVisible = (mirrorResult == MirrorView::RenderResult::Visible);
-      renderer.submit(mirrorViewVisible);
+      renderer.submit(swapchainImageIndex, mirrorViewVisible);
+
+      cpuFrameTime = static_cast<float>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                          std::chrono::high_resolution_clock::now() - frameStartTime - acquireDuration)
+                                          .count()) /
+                     1000.0f;
 
       if (mirrorViewVisible)
       {
@@ -215,6 +417,11 @@ int main()
   for(size_t i=0; i<gameBehaviours.size(); i++){
     delete(gameBehaviours[i]);
   }
+
+  for (const GameBehaviour* gameBehaviour : throttledGameBehaviours)
+  {
+    delete gameBehaviour;
+  }
   
   // Sync before destroying so that resources are free
   context.sync(); 
@@ -5,7 +5,18 @@
 
 #include <tinyobjloader/tiny_obj_loader.h>
 
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
 #include <cstring>
+#include <limits>
+
+namespace
+{
+// The largest storage buffer offset alignment that Vulkan allows, so that each stream can also be bound on its own as a
+// storage buffer for vertex pulling
+constexpr size_t streamAlignment = 256u;
+} // namespace
 
 bool MeshData::loadModel(const std::string& filename,
                          Color color,
@@ -22,6 +33,7 @@ bool MeshData::loadModel(const std::string& filename,
   }
 
   const size_t oldIndexCount = indices.size();
+  const size_t oldVertexCount = vertices.size();
 
   for (const tinyobj::shape_t& shape : shapes)
   {
@@ -57,11 +69,29 @@ bool MeshData::loadModel(const std::string& filename,
     }
   }
 
+  // Compute a bounding sphere around the center of the bounding box of the new vertices
+  glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+  for (size_t vertexIndex = oldVertexCount; vertexIndex < vertices.size(); ++vertexIndex)
+  {
+    boundsMin = glm::min(boundsMin, vertices.at(vertexIndex).position);
+    boundsMax = glm::max(boundsMax, vertices.at(vertexIndex).position);
+  }
+
+  const glm::vec3 boundsCenter = (boundsMin + boundsMax) * 0.5f;
+  float boundsRadius = 0.0f;
+  for (size_t vertexIndex = oldVertexCount; vertexIndex < vertices.size(); ++vertexIndex)
+  {
+    boundsRadius = glm::max(boundsRadius, glm::distance(boundsCenter, vertices.at(vertexIndex).position));
+  }
+
   for (size_t modelIndex = offset; modelIndex < offset + count; ++modelIndex)
   {
     Model* model = models.at(modelIndex);
     model->firstIndex = oldIndexCount;
     model->indexCount = indices.size() - oldIndexCount;
+    model->boundsCenter = boundsCenter;
+    model->boundsRadius = boundsRadius;
   }
 
   return true;
@@ -69,18 +99,64 @@ bool MeshData::loadModel(const std::string& filename,
 
 size_t MeshData::getSize() const
 {
-  return sizeof(vertices.at(0u)) * vertices.size() + sizeof(indices.at(0u)) * indices.size();
+  return getIndexStreamOffset(vertices.size()) + sizeof(indices.at(0u)) * indices.size();
+}
+
+size_t MeshData::getAttributeOffset() const
+{
+  return getAttributeStreamOffset(vertices.size());
 }
 
 size_t MeshData::getIndexOffset() const
 {
-  return sizeof(vertices.at(0u)) * vertices.size();
+  return getIndexStreamOffset(vertices.size());
+}
+
+const std::vector<Vertex>& MeshData::getVertices() const
+{
+  return vertices;
+}
+
+const std::vector<uint32_t>& MeshData::getIndices() const
+{
+  return indices;
 }
 
 void MeshData::writeTo(char* destination) const
 {
-  const size_t verticesSize = sizeof(vertices.at(0u)) * vertices.size();
-  const size_t indicesSize = sizeof(indices.at(0u)) * indices.size();
-  memcpy(destination, vertices.data(), verticesSize);              // Vertex section first
-  memcpy(destination + verticesSize, indices.data(), indicesSize); // Index section next
+  writeStreams(vertices, indices, destination);
+}
+
+size_t MeshData::getAttributeStreamOffset(size_t vertexCount)
+{
+  return static_cast<size_t>(util::align(sizeof(glm::vec3) * vertexCount, streamAlignment));
+}
+
+size_t MeshData::getIndexStreamOffset(size_t vertexCount)
+{
+  return getAttributeStreamOffset(vertexCount) +
+         static_cast<size_t>(util::align(sizeof(VertexAttributes) * vertexCount, streamAlignment));
+}
+
+void MeshData::writeStreams(const std::vector<Vertex>& vertices,
+                            const std::vector<uint32_t>& indices,
+                            char* destination)
+{
+  // Position stream first
+  glm::vec3* positions = reinterpret_cast<glm::vec3*>(destination);
+  for (const Vertex& vertex : vertices)
+  {
+    *positions++ = vertex.position;
+  }
+
+  // Attribute stream next
+  VertexAttributes* attributes =
+    reinterpret_cast<VertexAttributes*>(destination + getAttributeStreamOffset(vertices.size()));
+  for (const Vertex& vertex : vertices)
+  {
+    *attributes++ = { vertex.normal, vertex.color };
+  }
+
+  // Index section last
+  memcpy(destination + getIndexStreamOffset(vertices.size()), indices.data(), sizeof(uint32_t) * indices.size());
 }
\ No newline at end of file
@@ -17,12 +17,23 @@ struct Vertex final
   glm::vec3 color;
 };
 
+/*
+ * The vertex attributes struct holds everything of a vertex but its position. On the GPU, the positions and the
+ * attributes are stored as two separate streams, so that depth-only passes only need to fetch the positions.
+ */
+struct VertexAttributes final
+{
+  glm::vec3 normal;
+  glm::vec3 color;
+};
+
 /*
  * The mesh data class consists of a vertex and index collection for geometric data. It is not intended to stay alive in
  * memory after loading is done. It's purpose is rather to serve as a container for geometry data read in from OBJ model
  * files until that gets uploaded to a Vulkan vertex/index buffer on the GPU. Note that the models in the mesh data
  * class should be unique, a model that is rendered several times only needs to be loaded once. As many model structs as
  * required can then be derived from the same data.
+ * The data is written as a position stream, followed by an attribute stream and the indices, each of them aligned.
  */
 class MeshData final
 {
@@ -36,10 +47,20 @@ public:
   bool loadModel(const std::string& filename, Color color, std::vector<Model*>& models, size_t offset, size_t count);
 
   size_t getSize() const;
+  size_t getAttributeOffset() const;
   size_t getIndexOffset() const;
+  const std::vector<Vertex>& getVertices() const;
+  const std::vector<uint32_t>& getIndices() const;
 
   void writeTo(char* destination) const;
 
+  // Writes any geometry in the layout of the mesh data, the offsets are in bytes from the start
+  static size_t getAttributeStreamOffset(size_t vertexCount);
+  static size_t getIndexStreamOffset(size_t vertexCount);
+  static void writeStreams(const std::vector<Vertex>& vertices,
+                           const std::vector<uint32_t>& indices,
+                           char* destination);
+
 private:
   std::vector<Vertex> vertices;
   std::vector<uint32_t> indices;
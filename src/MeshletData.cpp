@@ -0,0 +1,252 @@
+#include "MeshletData.h"
+
+#include "Context.h"
+#include "DataBuffer.h"
+#include "GameData.h"
+#include "MeshData.h"
+#include "Util.h"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <cstring>
+#include <limits>
+#include <stdio.h>
+
+namespace
+{
+// The largest storage buffer offset alignment that Vulkan allows, so that each section can be bound on its own
+constexpr VkDeviceSize sectionAlignment = 256u;
+
+// Below this cosine between the cone axis and any triangle normal the cone is too wide to ever cull anything
+constexpr float minimumConeCosine = 0.1f;
+
+// Computes the bounding sphere and normal cone of a meshlet from the positions of its triangles
+void computeBounds(MeshletData::Meshlet& meshlet, const std::vector<glm::vec3>& trianglePositions)
+{
+  glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+  for (const glm::vec3& position : trianglePositions)
+  {
+    boundsMin = glm::min(boundsMin, position);
+    boundsMax = glm::max(boundsMax, position);
+  }
+
+  const glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+  float radius = 0.0f;
+  for (const glm::vec3& position : trianglePositions)
+  {
+    radius = glm::max(radius, glm::distance(center, position));
+  }
+
+  meshlet.sphere = glm::vec4(center, radius);
+
+  // The cone axis is the average of the triangle normals, its cutoff is the sine of the largest angle to any of them
+  std::vector<glm::vec3> normals;
+  glm::vec3 axis = glm::vec3(0.0f);
+  for (size_t index = 0u; index + 2u < trianglePositions.size(); index += 3u)
+  {
+    const glm::vec3 normal = glm::cross(trianglePositions.at(index + 1u) - trianglePositions.at(index),
+                                        trianglePositions.at(index + 2u) - trianglePositions.at(index));
+    const float length = glm::length(normal);
+    if (length > 0.0f)
+    {
+      normals.push_back(normal / length);
+      axis += normal / length;
+    }
+  }
+
+  meshlet.cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+  if (glm::length(axis) == 0.0f)
+  {
+    return;
+  }
+
+  axis = glm::normalize(axis);
+  float minimumCosine = 1.0f;
+  for (const glm::vec3& normal : normals)
+  {
+    minimumCosine = glm::min(minimumCosine, glm::dot(axis, normal));
+  }
+
+  if (minimumCosine > minimumConeCosine)
+  {
+    meshlet.cone = glm::vec4(axis, glm::sqrt(1.0f - minimumCosine * minimumCosine));
+  }
+}
+} // namespace
+
+MeshletData::MeshletData(const Context* context,
+                         const MeshData* meshData,
+                         const std::vector<const Model*>& models,
+                         VkCommandBuffer commandBuffer,
+                         VkQueue queue)
+{
+  const std::vector<Vertex>& vertices = meshData->getVertices();
+  const std::vector<uint32_t>& indices = meshData->getIndices();
+
+  std::vector<Meshlet> meshlets;
+  std::vector<uint32_t> meshletVertices;
+  std::vector<uint32_t> meshletTriangles;
+
+  // Fill the meshlets of each model greedily, a new meshlet is started whenever the next triangle doesn't fit
+  for (const Model* model : models)
+  {
+    if (modelMeshlets.find(model) != modelMeshlets.end() || model->indexCount == 0u)
+    {
+      continue;
+    }
+
+    const size_t firstMeshlet = meshlets.size();
+    std::unordered_map<uint32_t, uint32_t> localIndices;
+    std::vector<glm::vec3> trianglePositions;
+    Meshlet meshlet = {};
+
+    const auto finishMeshlet = [&]()
+    {
+      computeBounds(meshlet, trianglePositions);
+      meshlets.push_back(meshlet);
+
+      meshlet = {};
+      meshlet.vertexOffset = static_cast<uint32_t>(meshletVertices.size());
+      meshlet.triangleOffset = static_cast<uint32_t>(meshletTriangles.size());
+      localIndices.clear();
+      trianglePositions.clear();
+    };
+
+    meshlet.vertexOffset = static_cast<uint32_t>(meshletVertices.size());
+    meshlet.triangleOffset = static_cast<uint32_t>(meshletTriangles.size());
+    for (size_t index = model->firstIndex; index + 2u < model->firstIndex + model->indexCount; index += 3u)
+    {
+      size_t newVertexCount = 0u;
+      for (size_t corner = 0u; corner < 3u; ++corner)
+      {
+        if (localIndices.find(indices.at(index + corner)) == localIndices.end())
+        {
+          ++newVertexCount;
+        }
+      }
+
+      if (meshlet.vertexCount + newVertexCount > maxVertexCount || meshlet.triangleCount + 1u > maxTriangleCount)
+      {
+        finishMeshlet();
+      }
+
+      uint32_t packedTriangle = 0u;
+      for (size_t corner = 0u; corner < 3u; ++corner)
+      {
+        const uint32_t vertexIndex = indices.at(index + corner);
+        auto localIndex = localIndices.find(vertexIndex);
+        if (localIndex == localIndices.end())
+        {
+          localIndex = localIndices.emplace(vertexIndex, meshlet.vertexCount++).first;
+          meshletVertices.push_back(vertexIndex);
+        }
+
+        packedTriangle |= localIndex->second << (corner * 8u);
+        trianglePositions.push_back(vertices.at(vertexIndex).position);
+      }
+
+      meshletTriangles.push_back(packedTriangle);
+      ++meshlet.triangleCount;
+    }
+
+    if (meshlet.triangleCount > 0u)
+    {
+      finishMeshlet();
+    }
+
+    modelMeshlets.emplace(model, Range{ firstMeshlet, meshlets.size() - firstMeshlet });
+  }
+
+  printf("\n[MeshletData][log] Built %zu meshlets for %zu models", meshlets.size(), modelMeshlets.size());
+
+  if (meshlets.empty())
+  {
+    return;
+  }
+
+  vertexOffset = util::align(static_cast<VkDeviceSize>(sizeof(Meshlet) * meshlets.size()), sectionAlignment);
+  triangleOffset = vertexOffset +
+                   util::align(static_cast<VkDeviceSize>(sizeof(uint32_t) * meshletVertices.size()), sectionAlignment);
+  size = triangleOffset + static_cast<VkDeviceSize>(sizeof(uint32_t) * meshletTriangles.size());
+
+  // Create a staging buffer and fill it with the meshlet data
+  DataBuffer* stagingBuffer =
+    new DataBuffer(context, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, size);
+  if (!stagingBuffer->isValid())
+  {
+    delete stagingBuffer;
+    valid = false;
+    return;
+  }
+
+  char* bufferData = static_cast<char*>(stagingBuffer->map());
+  if (!bufferData)
+  {
+    delete stagingBuffer;
+    valid = false;
+    return;
+  }
+
+  memcpy(bufferData, meshlets.data(), sizeof(Meshlet) * meshlets.size());
+  memcpy(bufferData + vertexOffset, meshletVertices.data(), sizeof(uint32_t) * meshletVertices.size());
+  memcpy(bufferData + triangleOffset, meshletTriangles.data(), sizeof(uint32_t) * meshletTriangles.size());
+  stagingBuffer->unmap();
+
+  // Create the storage buffer and copy from the staging buffer
+  buffer = new DataBuffer(context, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, size);
+  if (!buffer->isValid() || !stagingBuffer->copyTo(*buffer, commandBuffer, queue))
+  {
+    delete stagingBuffer;
+    valid = false;
+    return;
+  }
+
+  delete stagingBuffer;
+}
+
+MeshletData::~MeshletData()
+{
+  delete buffer;
+}
+
+bool MeshletData::isValid() const
+{
+  return valid;
+}
+
+VkBuffer MeshletData::getBuffer() const
+{
+  return buffer ? buffer->getBuffer() : nullptr;
+}
+
+VkDeviceSize MeshletData::getVertexOffset() const
+{
+  return vertexOffset;
+}
+
+VkDeviceSize MeshletData::getTriangleOffset() const
+{
+  return triangleOffset;
+}
+
+VkDeviceSize MeshletData::getSize() const
+{
+  return size;
+}
+
+bool MeshletData::getMeshlets(const Model* model, size_t& firstMeshlet, size_t& meshletCount) const
+{
+  const auto range = modelMeshlets.find(model);
+  if (range == modelMeshlets.end() || !buffer)
+  {
+    return false;
+  }
+
+  firstMeshlet = range->second.firstMeshlet;
+  meshletCount = range->second.meshletCount;
+  return true;
+}
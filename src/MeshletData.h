@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glm/vec4.hpp>
+
+#include <vulkan/vulkan.h>
+
+#include <unordered_map>
+#include <vector>
+
+class Context;
+class DataBuffer;
+class MeshData;
+struct Model;
+
+/*
+ * The meshlet data class splits the geometry of models into meshlets, small clusters of up to 64 vertices and 124
+ * triangles, for rendering with task and mesh shaders. Each meshlet refers to its vertices in the shared vertex streams
+ * of the mesh data and stores its triangles as local indices, together with a bounding sphere and a normal cone in
+ * model space for culling whole meshlets. The meshlets, their vertex indices and their triangles are uploaded into a
+ * single storage buffer. Note that the meshlets are built greedily in index order, which keeps them spatially coherent
+ * for the scanned and exported models in this project but doesn't optimize their bounds.
+ */
+class MeshletData final
+{
+public:
+  MeshletData(const Context* context,
+              const MeshData* meshData,
+              const std::vector<const Model*>& models,
+              VkCommandBuffer commandBuffer,
+              VkQueue queue);
+  ~MeshletData();
+
+  static constexpr size_t maxVertexCount = 64u;
+  static constexpr size_t maxTriangleCount = 124u;
+
+  // Matches the meshlet struct of the task and mesh shaders
+  struct Meshlet
+  {
+    glm::vec4 sphere; // Center and radius
+    glm::vec4 cone;   // Axis and cutoff, never culls with a cutoff of 1
+    uint32_t vertexOffset, vertexCount;
+    uint32_t triangleOffset, triangleCount; // Each triangle is packed into a single uint
+  };
+
+  bool isValid() const;
+  VkBuffer getBuffer() const;
+  VkDeviceSize getVertexOffset() const;
+  VkDeviceSize getTriangleOffset() const;
+  VkDeviceSize getSize() const;
+
+  // Returns false if no meshlets were built for the model
+  bool getMeshlets(const Model* model, size_t& firstMeshlet, size_t& meshletCount) const;
+
+private:
+  bool valid = true;
+
+  DataBuffer* buffer = nullptr;
+  VkDeviceSize vertexOffset = 0u, triangleOffset = 0u, size = 0u;
+
+  struct Range
+  {
+    size_t firstMeshlet, meshletCount;
+  };
+  std::unordered_map<const Model*, Range> modelMeshlets;
+};
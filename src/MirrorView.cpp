@@ -1,8 +1,8 @@
 #include "MirrorView.h"
 
 #include "Context.h"
+#include "FrameGraph.h"
 #include "Headset.h"
-#include "RenderTarget.h"
 #include "Renderer.h"
 #include "Util.h"
 
@@ -31,6 +31,11 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
   {
     glfwSetWindowShouldClose(window, 1);
   }
+  else if (action == GLFW_RELEASE && key == GLFW_KEY_P)
+  {
+    MirrorView* mirrorView = reinterpret_cast<MirrorView*>(glfwGetWindowUserPointer(window));
+    mirrorView->onDepthPrepassKey();
+  }
 }
 } // namespace
 
@@ -104,6 +109,18 @@ void MirrorView::onWindowResize()
   resizeDetected = true;
 }
 
+void MirrorView::onDepthPrepassKey()
+{
+  depthPrepassToggleRequested = true;
+}
+
+bool MirrorView::consumeDepthPrepassToggle()
+{
+  const bool toggleRequested = depthPrepassToggleRequested;
+  depthPrepassToggleRequested = false;
+  return toggleRequested;
+}
+
 bool MirrorView::connect(const Headset* headset, const Renderer* renderer)
 {
   this->headset = headset;
@@ -114,6 +131,21 @@ bool MirrorView::connect(const Headset* headset, const Renderer* renderer)
     return false;
   }
 
+  // Add the blit into the window as the last pass of the frame, the window image is acquired with a semaphore that is
+  // waited on in the color attachment output stage
+  frameGraph = renderer->getFrameGraph();
+  windowImageResource = frameGraph->importImage(
+    nullptr, VK_IMAGE_ASPECT_COLOR_BIT, { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT },
+    { VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR });
+
+  const size_t pass = frameGraph->addPass([this](VkCommandBuffer commandBuffer) { blit(commandBuffer); });
+  frameGraph->read(pass, renderer->getSwapchainImageResource(),
+                   { VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL });
+  frameGraph->write(pass, windowImageResource,
+                    { VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL });
+
   return true;
 }
 
@@ -122,8 +154,11 @@ void MirrorView::processWindowEvents() const
   glfwPollEvents();
 }
 
-MirrorView::RenderResult MirrorView::render(uint32_t swapchainImageIndex)
+MirrorView::RenderResult MirrorView::render()
 {
+  // The blit pass is culled unless a window image is acquired below
+  frameGraph->setOutput(windowImageResource, false);
+
   if (swapchainResolution.width == 0u || swapchainResolution.height == 0u)
   {
     // Just check for maximizing as long as the window is minimized
@@ -161,39 +196,17 @@ MirrorView::RenderResult MirrorView::render(uint32_t swapchainImageIndex)
     return RenderResult::Invisible;
   }
 
-  const VkCommandBuffer commandBuffer = renderer->getCurrentCommandBuffer();
-  const VkImage sourceImage = headset->getRenderTarget(swapchainImageIndex)->getImage();
+  frameGraph->setImage(windowImageResource, swapchainImages.at(destinationImageIndex));
+  frameGraph->setOutput(windowImageResource, true);
+
+  return RenderResult::Visible;
+}
+
+void MirrorView::blit(VkCommandBuffer commandBuffer) const
+{
+  const VkImage sourceImage = frameGraph->getImage(renderer->getSwapchainImageResource());
   const VkImage destinationImage = swapchainImages.at(destinationImageIndex);
-  const VkExtent2D eyeResolution = headset->getEyeResolution(mirrorEyeIndex);
-
-  // Convert the source image layout from undefined to transfer source
-  VkImageMemoryBarrier imageMemoryBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-  imageMemoryBarrier.image = sourceImage;
-  imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-  imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-  imageMemoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-  imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  imageMemoryBarrier.subresourceRange.layerCount = 1u;
-  imageMemoryBarrier.subresourceRange.baseArrayLayer = mirrorEyeIndex;
-  imageMemoryBarrier.subresourceRange.levelCount = 1u;
-  imageMemoryBarrier.subresourceRange.baseMipLevel = 0u;
-  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                       VK_DEPENDENCY_BY_REGION_BIT, 0u, nullptr, 0u, nullptr, 1u, &imageMemoryBarrier);
-
-  // Convert the destination image layout from undefined to transfer destination
-  imageMemoryBarrier.image = destinationImage;
-  imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-  imageMemoryBarrier.srcAccessMask = 0u;
-  imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  imageMemoryBarrier.subresourceRange.layerCount = 1u;
-  imageMemoryBarrier.subresourceRange.baseArrayLayer = 0u;
-  imageMemoryBarrier.subresourceRange.levelCount = 1u;
-  imageMemoryBarrier.subresourceRange.baseMipLevel = 0u;
-  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                       VK_DEPENDENCY_BY_REGION_BIT, 0u, nullptr, 0u, nullptr, 1u, &imageMemoryBarrier);
+  const VkExtent2D eyeResolution = headset->getRenderResolution(mirrorEyeIndex);
 
   // We need to crop the source image region to preserve the aspect ratio of the mirror view window
   const glm::vec2 sourceResolution = { static_cast<float>(eyeResolution.width),
@@ -235,36 +248,6 @@ MirrorView::RenderResult MirrorView::render(uint32_t swapchainImageIndex)
 
   vkCmdBlitImage(commandBuffer, sourceImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, destinationImage,
                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1u, &imageBlit, VK_FILTER_NEAREST);
-
-  // Convert the source image layout from transfer source to color attachment
-  imageMemoryBarrier.image = sourceImage;
-  imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-  imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-  imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-  imageMemoryBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  imageMemoryBarrier.subresourceRange.layerCount = 1u;
-  imageMemoryBarrier.subresourceRange.baseArrayLayer = mirrorEyeIndex;
-  imageMemoryBarrier.subresourceRange.levelCount = 1u;
-  imageMemoryBarrier.subresourceRange.baseMipLevel = 0u;
-  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                       VK_DEPENDENCY_BY_REGION_BIT, 0u, nullptr, 0u, nullptr, 1u, &imageMemoryBarrier);
-
-  // Convert the destination image layout from transfer destination to present
-  imageMemoryBarrier.image = destinationImage;
-  imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-  imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-  imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  imageMemoryBarrier.dstAccessMask = 0u;
-  imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  imageMemoryBarrier.subresourceRange.layerCount = 1u;
-  imageMemoryBarrier.subresourceRange.baseArrayLayer = 0u;
-  imageMemoryBarrier.subresourceRange.levelCount = 1u;
-  imageMemoryBarrier.subresourceRange.baseMipLevel = 0u;
-  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                       VK_DEPENDENCY_BY_REGION_BIT, 0u, nullptr, 0u, nullptr, 1u, &imageMemoryBarrier);
-
-  return RenderResult::Visible;
 }
 
 void MirrorView::present()
@@ -5,6 +5,7 @@
 #include <vector>
 
 class Context;
+class FrameGraph;
 struct GLFWwindow;
 class Headset;
 class Renderer;
@@ -12,7 +13,8 @@ class Renderer;
 /*
  * The mirror view class handles the creation, updating, resizing, and eventual closing of the desktop window that shows
  * a copy of what is rendered into the headset. It depends on GLFW for handling the operating system, and Vulkan for the
- * blitting into the window surface.
+ * blitting into the window surface. The blit is a pass of the frame graph of the renderer, which is culled whenever
+ * the window is minimized or its image could not be acquired.
  */
 class MirrorView final
 {
@@ -21,6 +23,10 @@ public:
   ~MirrorView();
 
   void onWindowResize();
+  void onDepthPrepassKey();
+
+  // Returns true once after the depth prepass key has been pressed in the window
+  bool consumeDepthPrepassToggle();
 
   bool connect(const Headset* headset, const Renderer* renderer);
   void processWindowEvents() const;
@@ -31,7 +37,7 @@ public:
     Visible,  // Visible mirror view for normal rendering
     Invisible // Minimized window for example without rendering
   };
-  RenderResult render(uint32_t swapchainImageIndex);
+  RenderResult render();
   void present();
 
   bool isValid() const;
@@ -44,6 +50,8 @@ private:
   const Context* context = nullptr;
   const Headset* headset = nullptr;
   const Renderer* renderer = nullptr;
+  FrameGraph* frameGraph = nullptr;
+  size_t windowImageResource = 0u;
 
   GLFWwindow* window = nullptr;
 
@@ -54,6 +62,8 @@ private:
 
   uint32_t destinationImageIndex = 0u;
   bool resizeDetected = false;
+  bool depthPrepassToggleRequested = false;
 
+  void blit(VkCommandBuffer commandBuffer) const;
   bool recreateSwapchain();
 };
\ No newline at end of file
@@ -0,0 +1,688 @@
+#include "OcclusionCuller.h"
+
+#include "Context.h"
+#include "DataBuffer.h"
+#include "FrameGraph.h"
+#include "GameData.h"
+#include "Headset.h"
+#include "ImageBuffer.h"
+#include "ShaderCache.h"
+#include "StaticBatcher.h"
+#include "Util.h"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+constexpr VkFormat depthPyramidFormat = VK_FORMAT_R32_SFLOAT;
+constexpr uint32_t depthPyramidGroupSize = 8u; // Matches the local size of the depth pyramid shaders
+constexpr uint32_t cullGroupSize = 64u;        // Matches the local size of the culling shader
+constexpr uint32_t noDrawIndex = ~0u;          // Matches the culling shader
+
+bool createComputePipeline(const Context* context,
+                           ShaderCache* shaderCache,
+                           const std::string& filename,
+                           VkPipelineLayout pipelineLayout,
+                           VkPipeline& pipeline)
+{
+  // The shader cache owns the module
+  VkShaderModule shaderModule;
+  if (!shaderCache->getShaderModule(filename, shaderModule))
+  {
+    std::stringstream s;
+    s << "Compute shader \"" << filename << "\"";
+    util::error(Error::FileMissing, s.str());
+    return false;
+  }
+
+  VkComputePipelineCreateInfo computePipelineCreateInfo{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+  computePipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  computePipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  computePipelineCreateInfo.stage.module = shaderModule;
+  computePipelineCreateInfo.stage.pName = "main";
+  computePipelineCreateInfo.layout = pipelineLayout;
+  const VkResult result = vkCreateComputePipelines(context->getVkDevice(), context->getVkPipelineCache(), 1u,
+                                                  &computePipelineCreateInfo, nullptr, &pipeline);
+  if (result != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    return false;
+  }
+
+  return true;
+}
+
+VkDescriptorSetLayoutBinding makeBinding(uint32_t binding, VkDescriptorType descriptorType)
+{
+  VkDescriptorSetLayoutBinding descriptorSetLayoutBinding{};
+  descriptorSetLayoutBinding.binding = binding;
+  descriptorSetLayoutBinding.descriptorType = descriptorType;
+  descriptorSetLayoutBinding.descriptorCount = 1u;
+  descriptorSetLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  return descriptorSetLayoutBinding;
+}
+} // namespace
+
+OcclusionCuller::OcclusionCuller(const Context* context,
+                                 const Headset* headset,
+                                 FrameGraph* frameGraph,
+                                 ShaderCache* shaderCache,
+                                 size_t objectCount,
+                                 size_t framesInFlightCount)
+: context(context), headset(headset), frameGraph(frameGraph), objectCount(objectCount)
+{
+  const VkDevice device = context->getVkDevice();
+
+  // Create a host visible frame data buffer for each frame in flight
+  const VkDeviceSize frameDataSize =
+    sizeof(FrameDataHeader) + sizeof(CullObject) * static_cast<VkDeviceSize>(glm::max(objectCount, size_t(1u)));
+  frameDataBuffers.resize(framesInFlightCount);
+  frameDataBufferMemories.resize(framesInFlightCount);
+  for (size_t frameIndex = 0u; frameIndex < framesInFlightCount; ++frameIndex)
+  {
+    DataBuffer*& frameDataBuffer = frameDataBuffers.at(frameIndex);
+    frameDataBuffer =
+      new DataBuffer(context, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frameDataSize);
+    if (!frameDataBuffer->isValid())
+    {
+      valid = false;
+      return;
+    }
+
+    frameDataBufferMemories.at(frameIndex) = frameDataBuffer->map();
+    if (!frameDataBufferMemories.at(frameIndex))
+    {
+      valid = false;
+      return;
+    }
+  }
+
+  // Create the visibility and draw command buffers that persist on the GPU between frames
+  const VkDeviceSize visibilitySize =
+    sizeof(uint32_t) * static_cast<VkDeviceSize>(glm::max(objectCount, size_t(1u)));
+  visibilityBuffer = new DataBuffer(context, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, visibilitySize);
+  if (!visibilityBuffer->isValid())
+  {
+    valid = false;
+    return;
+  }
+
+  const VkDeviceSize drawCommandSize = sizeof(VkDrawIndexedIndirectCommand) * 2u *
+                                       static_cast<VkDeviceSize>(glm::max(objectCount, size_t(1u)));
+  drawCommandBuffer = new DataBuffer(context, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, drawCommandSize);
+  if (!drawCommandBuffer->isValid())
+  {
+    valid = false;
+    return;
+  }
+
+  // Import the buffers into the frame graph, the visibility is read again by the next frame
+  visibilityResource = frameGraph->importBuffer(visibilityBuffer->getBuffer());
+  frameGraph->setOutput(visibilityResource, true);
+  drawCommandResource = frameGraph->importBuffer(drawCommandBuffer->getBuffer());
+
+  // Create the depth pyramid as a transient image of the frame graph, its first level is half the eye resolution
+  {
+    const VkExtent2D eyeResolution = headset->getEyeResolution(0u);
+    depthPyramidResolution = { (eyeResolution.width + 1u) / 2u, (eyeResolution.height + 1u) / 2u };
+
+    levelCount = 1u;
+    uint32_t largestSide = glm::max(depthPyramidResolution.width, depthPyramidResolution.height);
+    while (largestSide > 1u)
+    {
+      largestSide = (largestSide + 1u) / 2u;
+      ++levelCount;
+    }
+
+    depthPyramidResource = frameGraph->createTransientImage(depthPyramidResolution, depthPyramidFormat,
+                                                            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                                            VK_IMAGE_ASPECT_COLOR_BIT, levelCount);
+    if (!frameGraph->isValid())
+    {
+      valid = false;
+      return;
+    }
+  }
+
+  // Create a sampler, all reads are texel fetches so it only needs to be valid
+  VkSamplerCreateInfo samplerCreateInfo{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+  samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+  samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+  samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+  if (vkCreateSampler(device, &samplerCreateInfo, nullptr, &sampler) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  // Create a descriptor pool
+  const uint32_t downsampleSetCount = levelCount - 1u;
+  const uint32_t cullSetCount = static_cast<uint32_t>(framesInFlightCount);
+  std::array<VkDescriptorPoolSize, 3u> descriptorPoolSizes;
+
+  descriptorPoolSizes.at(0u).type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorPoolSizes.at(0u).descriptorCount = 1u + cullSetCount;
+
+  descriptorPoolSizes.at(1u).type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  descriptorPoolSizes.at(1u).descriptorCount = 1u + downsampleSetCount * 2u;
+
+  descriptorPoolSizes.at(2u).type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorPoolSizes.at(2u).descriptorCount = cullSetCount * 3u;
+
+  VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+  descriptorPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(descriptorPoolSizes.size());
+  descriptorPoolCreateInfo.pPoolSizes = descriptorPoolSizes.data();
+  descriptorPoolCreateInfo.maxSets = 1u + downsampleSetCount + cullSetCount;
+  if (vkCreateDescriptorPool(device, &descriptorPoolCreateInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  // Create the descriptor set layouts
+  {
+    const std::array depthBindings = { makeBinding(0u, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+                                       makeBinding(1u, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE) };
+    const std::array downsampleBindings = { makeBinding(0u, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE),
+                                            makeBinding(1u, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE) };
+    const std::array cullBindings = { makeBinding(0u, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+                                      makeBinding(1u, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+                                      makeBinding(2u, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+                                      makeBinding(3u, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) };
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO
+    };
+
+    descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(depthBindings.size());
+    descriptorSetLayoutCreateInfo.pBindings = depthBindings.data();
+    if (vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &depthDescriptorSetLayout) !=
+        VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
+
+    descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(downsampleBindings.size());
+    descriptorSetLayoutCreateInfo.pBindings = downsampleBindings.data();
+    if (vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr,
+                                    &downsampleDescriptorSetLayout) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
+
+    descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(cullBindings.size());
+    descriptorSetLayoutCreateInfo.pBindings = cullBindings.data();
+    if (vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &cullDescriptorSetLayout) !=
+        VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
+  }
+
+  // Create the pipeline layouts
+  {
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    pipelineLayoutCreateInfo.setLayoutCount = 1u;
+
+    pipelineLayoutCreateInfo.pSetLayouts = &depthDescriptorSetLayout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &depthPipelineLayout) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
+
+    pipelineLayoutCreateInfo.pSetLayouts = &downsampleDescriptorSetLayout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &downsamplePipelineLayout) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
+
+    VkPushConstantRange pushConstantRange;
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0u;
+    pushConstantRange.size = sizeof(uint32_t);
+
+    pipelineLayoutCreateInfo.pSetLayouts = &cullDescriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1u;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
+  }
+
+  // Create the compute pipelines
+  if (!createComputePipeline(context, shaderCache, "shaders/HiZDepth.comp.spv", depthPipelineLayout, depthPipeline) ||
+      !createComputePipeline(context, shaderCache, "shaders/HiZDownsample.comp.spv", downsamplePipelineLayout,
+                             downsamplePipeline) ||
+      !createComputePipeline(context, shaderCache, "shaders/OcclusionCull.comp.spv", cullPipelineLayout, cullPipeline))
+  {
+    valid = false;
+    return;
+  }
+}
+
+bool OcclusionCuller::createDescriptorSets()
+{
+  const VkDevice device = context->getVkDevice();
+  const uint32_t downsampleSetCount = levelCount - 1u;
+  const uint32_t cullSetCount = static_cast<uint32_t>(frameDataBuffers.size());
+
+  // Create an image view per level of the depth pyramid to write into
+  levelImageViews.resize(levelCount);
+  for (uint32_t level = 0u; level < levelCount; ++level)
+  {
+    VkImageViewCreateInfo imageViewCreateInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    imageViewCreateInfo.image = frameGraph->getImage(depthPyramidResource);
+    imageViewCreateInfo.format = depthPyramidFormat;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewCreateInfo.components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+                                       VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
+    imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewCreateInfo.subresourceRange.baseArrayLayer = 0u;
+    imageViewCreateInfo.subresourceRange.layerCount = 1u;
+    imageViewCreateInfo.subresourceRange.baseMipLevel = level;
+    imageViewCreateInfo.subresourceRange.levelCount = 1u;
+    if (vkCreateImageView(device, &imageViewCreateInfo, nullptr, &levelImageViews.at(level)) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+  }
+
+  // Allocate the descriptor sets
+  {
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
+    descriptorSetLayouts.push_back(depthDescriptorSetLayout);
+    descriptorSetLayouts.insert(descriptorSetLayouts.end(), downsampleSetCount, downsampleDescriptorSetLayout);
+    descriptorSetLayouts.insert(descriptorSetLayouts.end(), cullSetCount, cullDescriptorSetLayout);
+
+    std::vector<VkDescriptorSet> descriptorSets(descriptorSetLayouts.size());
+
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    descriptorSetAllocateInfo.descriptorPool = descriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+    descriptorSetAllocateInfo.pSetLayouts = descriptorSetLayouts.data();
+    if (vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, descriptorSets.data()) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+
+    depthDescriptorSet = descriptorSets.at(0u);
+    downsampleDescriptorSets.assign(descriptorSets.begin() + 1u, descriptorSets.begin() + 1u + downsampleSetCount);
+    cullDescriptorSets.assign(descriptorSets.begin() + 1u + downsampleSetCount, descriptorSets.end());
+  }
+
+  // Update the descriptor sets
+  {
+    // The image and buffer infos need to stay alive until the update, so they are reserved up front
+    std::vector<VkDescriptorImageInfo> descriptorImageInfos;
+    descriptorImageInfos.reserve(2u + downsampleSetCount * 2u + cullSetCount);
+    std::vector<VkDescriptorBufferInfo> descriptorBufferInfos;
+    descriptorBufferInfos.reserve(cullSetCount * 3u);
+    std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+
+    const auto writeImage = [&](VkDescriptorSet descriptorSet, uint32_t binding, VkDescriptorType descriptorType,
+                                VkImageView imageView, VkImageLayout imageLayout)
+    {
+      descriptorImageInfos.push_back({ sampler, imageView, imageLayout });
+
+      VkWriteDescriptorSet writeDescriptorSet{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+      writeDescriptorSet.dstSet = descriptorSet;
+      writeDescriptorSet.dstBinding = binding;
+      writeDescriptorSet.descriptorCount = 1u;
+      writeDescriptorSet.descriptorType = descriptorType;
+      writeDescriptorSet.pImageInfo = &descriptorImageInfos.back();
+      writeDescriptorSets.push_back(writeDescriptorSet);
+    };
+
+    const auto writeBuffer = [&](VkDescriptorSet descriptorSet, uint32_t binding, VkBuffer buffer)
+    {
+      descriptorBufferInfos.push_back({ buffer, 0u, VK_WHOLE_SIZE });
+
+      VkWriteDescriptorSet writeDescriptorSet{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+      writeDescriptorSet.dstSet = descriptorSet;
+      writeDescriptorSet.dstBinding = binding;
+      writeDescriptorSet.descriptorCount = 1u;
+      writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writeDescriptorSet.pBufferInfo = &descriptorBufferInfos.back();
+      writeDescriptorSets.push_back(writeDescriptorSet);
+    };
+
+    // The first level reads the multisampled depth buffer of both eyes
+    writeImage(depthDescriptorSet, 0u, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+               headset->getDepthBuffer()->getImageView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+    writeImage(depthDescriptorSet, 1u, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, levelImageViews.at(0u),
+               VK_IMAGE_LAYOUT_GENERAL);
+
+    // Every following level reads the level before it
+    for (uint32_t level = 1u; level < levelCount; ++level)
+    {
+      const VkDescriptorSet descriptorSet = downsampleDescriptorSets.at(level - 1u);
+      writeImage(descriptorSet, 0u, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, levelImageViews.at(level - 1u),
+                 VK_IMAGE_LAYOUT_GENERAL);
+      writeImage(descriptorSet, 1u, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, levelImageViews.at(level),
+                 VK_IMAGE_LAYOUT_GENERAL);
+    }
+
+    // The culling reads the whole pyramid
+    for (size_t frameIndex = 0u; frameIndex < cullDescriptorSets.size(); ++frameIndex)
+    {
+      const VkDescriptorSet descriptorSet = cullDescriptorSets.at(frameIndex);
+      writeBuffer(descriptorSet, 0u, frameDataBuffers.at(frameIndex)->getBuffer());
+      writeBuffer(descriptorSet, 1u, visibilityBuffer->getBuffer());
+      writeBuffer(descriptorSet, 2u, drawCommandBuffer->getBuffer());
+      writeImage(descriptorSet, 3u, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                 frameGraph->getImageView(depthPyramidResource), VK_IMAGE_LAYOUT_GENERAL);
+    }
+
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0u,
+                           nullptr);
+  }
+
+  return true;
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+  const VkDevice device = context->getVkDevice();
+  if (device)
+  {
+    for (const VkPipeline pipeline : { cullPipeline, downsamplePipeline, depthPipeline })
+    {
+      if (pipeline)
+      {
+        vkDestroyPipeline(device, pipeline, nullptr);
+      }
+    }
+
+    for (const VkPipelineLayout pipelineLayout : { cullPipelineLayout, downsamplePipelineLayout, depthPipelineLayout })
+    {
+      if (pipelineLayout)
+      {
+        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+      }
+    }
+
+    for (const VkDescriptorSetLayout descriptorSetLayout :
+         { cullDescriptorSetLayout, downsampleDescriptorSetLayout, depthDescriptorSetLayout })
+    {
+      if (descriptorSetLayout)
+      {
+        vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+      }
+    }
+
+    if (descriptorPool)
+    {
+      vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    }
+
+    if (sampler)
+    {
+      vkDestroySampler(device, sampler, nullptr);
+    }
+
+    for (const VkImageView imageView : levelImageViews)
+    {
+      if (imageView)
+      {
+        vkDestroyImageView(device, imageView, nullptr);
+      }
+    }
+  }
+
+  delete drawCommandBuffer;
+  delete visibilityBuffer;
+
+  for (size_t frameIndex = 0u; frameIndex < frameDataBuffers.size(); ++frameIndex)
+  {
+    DataBuffer* frameDataBuffer = frameDataBuffers.at(frameIndex);
+    if (frameDataBuffer && frameDataBufferMemories.at(frameIndex))
+    {
+      frameDataBuffer->unmap();
+    }
+    delete frameDataBuffer;
+  }
+}
+
+void OcclusionCuller::updateFrameData(size_t frameIndex,
+                                      const std::array<glm::mat4, 2u>& viewProjectionMatrices,
+                                      const std::vector<GameObject*>& gameObjects,
+                                      const StaticBatcher* staticBatcher,
+                                      const std::vector<size_t>& drawnObjectIndices)
+{
+  currentFrameIndex = frameIndex;
+
+  char* memory = static_cast<char*>(frameDataBufferMemories.at(frameIndex));
+  if (!memory)
+  {
+    return;
+  }
+
+  // Only the top left sub-rectangle of the depth buffer is rendered into at a reduced render scale. The depth pyramid
+  // still covers the whole depth buffer, which keeps it conservative at the edge of that sub-rectangle.
+  const VkExtent2D renderResolution = headset->getRenderResolution(0u);
+
+  FrameDataHeader header;
+  header.viewProjectionMatrices = viewProjectionMatrices;
+  header.resolution[0] = renderResolution.width;
+  header.resolution[1] = renderResolution.height;
+  header.objectCount = static_cast<uint32_t>(objectCount);
+  header.levelCount = levelCount;
+  header.minimumScreenSize = minimumScreenSize;
+  memcpy(memory, &header, sizeof(header));
+
+  CullObject* cullObjects = reinterpret_cast<CullObject*>(memory + sizeof(FrameDataHeader));
+  for (size_t goIndex = 0u; goIndex < gameObjects.size(); ++goIndex)
+  {
+    const GameObject* gameObject = gameObjects.at(goIndex);
+    const glm::mat4& worldMatrix = gameObject->worldMatrix;
+
+    // Transform the bounding sphere into world space, scaling the radius by the largest axis scale
+    const float scale =
+      glm::max(glm::length(glm::vec3(worldMatrix[0])),
+               glm::max(glm::length(glm::vec3(worldMatrix[1])), glm::length(glm::vec3(worldMatrix[2]))));
+
+    CullObject& cullObject = cullObjects[goIndex];
+    cullObject.sphere = glm::vec4(glm::vec3(worldMatrix * glm::vec4(gameObject->model->boundsCenter, 1.0f)),
+                                  gameObject->model->boundsRadius * scale);
+    cullObject.firstIndex = static_cast<uint32_t>(gameObject->model->firstIndex);
+    cullObject.indexCount = static_cast<uint32_t>(gameObject->model->indexCount);
+    cullObject.visible = (gameObject->isVisible && !staticBatcher->isBatched(goIndex)) ? 1u : 0u;
+    cullObject.drawIndex = noDrawIndex;
+  }
+
+  // The static batches are already in world space and have their own geometry buffer
+  for (size_t batchIndex = 0u; batchIndex < staticBatcher->getBatchCount(); ++batchIndex)
+  {
+    const StaticBatcher::Batch& batch = staticBatcher->getBatch(batchIndex);
+
+    CullObject& cullObject = cullObjects[gameObjects.size() + batchIndex];
+    cullObject.sphere = glm::vec4(batch.boundsCenter, batch.boundsRadius);
+    cullObject.firstIndex = 0u;
+    cullObject.indexCount = static_cast<uint32_t>(batch.indexCount);
+    cullObject.visible = batch.indexCount > 0u ? 1u : 0u;
+    cullObject.drawIndex = noDrawIndex;
+  }
+
+  for (size_t drawIndex = 0u; drawIndex < drawnObjectIndices.size(); ++drawIndex)
+  {
+    cullObjects[drawnObjectIndices.at(drawIndex)].drawIndex = static_cast<uint32_t>(drawIndex);
+  }
+}
+
+void OcclusionCuller::updateViewProjectionMatrices(const std::array<glm::mat4, 2u>& viewProjectionMatrices)
+{
+  char* memory = static_cast<char*>(frameDataBufferMemories.at(currentFrameIndex));
+  if (!memory)
+  {
+    return;
+  }
+
+  // The frame data is host coherent and only read once the frame has been submitted
+  memcpy(memory + offsetof(FrameDataHeader, viewProjectionMatrices), viewProjectionMatrices.data(),
+         sizeof(FrameDataHeader::viewProjectionMatrices));
+}
+
+void OcclusionCuller::addCullPass(uint32_t phase)
+{
+  const size_t pass = frameGraph->addPass([this, phase](VkCommandBuffer commandBuffer) { cull(commandBuffer, phase); });
+
+  if (phase == 0u)
+  {
+    // The early phase only reads the visibility, apart from clearing it in the first frame
+    frameGraph->write(pass, visibilityResource,
+                      { VK_PIPELINE_STAGE_2_CLEAR_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT });
+  }
+  else
+  {
+    frameGraph->read(pass, depthPyramidResource,
+                     { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                       VK_IMAGE_LAYOUT_GENERAL });
+    frameGraph->write(pass, visibilityResource,
+                      { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT });
+  }
+
+  frameGraph->write(pass, drawCommandResource,
+                    { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT });
+}
+
+void OcclusionCuller::addDepthPyramidPass(size_t depthBufferResource)
+{
+  const size_t pass = frameGraph->addPass([this](VkCommandBuffer commandBuffer) { buildDepthPyramid(commandBuffer); });
+  frameGraph->read(pass, depthBufferResource,
+                   { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                     VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL });
+  frameGraph->write(pass, depthPyramidResource,
+                    { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                      VK_IMAGE_LAYOUT_GENERAL });
+}
+
+void OcclusionCuller::setMinimumScreenSize(float pixels)
+{
+  minimumScreenSize = pixels;
+}
+
+bool OcclusionCuller::isValid() const
+{
+  return valid;
+}
+
+size_t OcclusionCuller::getDrawCommandResource() const
+{
+  return drawCommandResource;
+}
+
+VkBuffer OcclusionCuller::getDrawCommandBuffer() const
+{
+  return drawCommandBuffer->getBuffer();
+}
+
+VkDeviceSize OcclusionCuller::getDrawCommandOffset(size_t passIndex, size_t drawIndex) const
+{
+  return sizeof(VkDrawIndexedIndirectCommand) *
+         static_cast<VkDeviceSize>(passIndex * objectCount + drawIndex);
+}
+
+void OcclusionCuller::cull(VkCommandBuffer commandBuffer, uint32_t phase)
+{
+  // The visibility buffer starts out undefined, clear it once so that every object is tested in the first late pass
+  if (!visibilityCleared)
+  {
+    vkCmdFillBuffer(commandBuffer, visibilityBuffer->getBuffer(), 0u, VK_WHOLE_SIZE, 0u);
+
+    // The fill happens within the cull pass, so the frame graph doesn't know about it
+    VkMemoryBarrier2 memoryBarrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+    memoryBarrier.srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT;
+    memoryBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+    VkDependencyInfo dependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    dependencyInfo.memoryBarrierCount = 1u;
+    dependencyInfo.pMemoryBarriers = &memoryBarrier;
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+    visibilityCleared = true;
+  }
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0u, 1u,
+                          &cullDescriptorSets.at(currentFrameIndex), 0u, nullptr);
+  vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0u, sizeof(phase), &phase);
+  vkCmdDispatch(commandBuffer, (static_cast<uint32_t>(objectCount) + cullGroupSize - 1u) / cullGroupSize, 1u, 1u);
+}
+
+void OcclusionCuller::buildDepthPyramid(VkCommandBuffer commandBuffer) const
+{
+  // Reduce the depth buffer into the first level
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthPipelineLayout, 0u, 1u,
+                          &depthDescriptorSet, 0u, nullptr);
+  vkCmdDispatch(commandBuffer, (depthPyramidResolution.width + depthPyramidGroupSize - 1u) / depthPyramidGroupSize,
+                (depthPyramidResolution.height + depthPyramidGroupSize - 1u) / depthPyramidGroupSize, 1u);
+
+  // Reduce each level into the next one, the frame graph only tracks the pyramid as a whole so the barriers between
+  // its levels are issued here
+  VkImageMemoryBarrier2 levelBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+  levelBarrier.image = frameGraph->getImage(depthPyramidResource);
+  levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  levelBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  levelBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+  levelBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  levelBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+  levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  levelBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0u, 1u, 0u, 1u };
+
+  VkDependencyInfo dependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+  dependencyInfo.imageMemoryBarrierCount = 1u;
+  dependencyInfo.pImageMemoryBarriers = &levelBarrier;
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downsamplePipeline);
+
+  VkExtent2D levelResolution = depthPyramidResolution;
+  for (uint32_t level = 1u; level < levelCount; ++level)
+  {
+    levelBarrier.subresourceRange.baseMipLevel = level - 1u;
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+    levelResolution = { (levelResolution.width + 1u) / 2u, (levelResolution.height + 1u) / 2u };
+
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downsamplePipelineLayout, 0u, 1u,
+                            &downsampleDescriptorSets.at(level - 1u), 0u, nullptr);
+    vkCmdDispatch(commandBuffer, (levelResolution.width + depthPyramidGroupSize - 1u) / depthPyramidGroupSize,
+                  (levelResolution.height + depthPyramidGroupSize - 1u) / depthPyramidGroupSize, 1u);
+  }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <vector>
+
+class Context;
+class DataBuffer;
+class FrameGraph;
+class Headset;
+class ShaderCache;
+class StaticBatcher;
+struct GameObject;
+
+/*
+ * The occlusion culler class implements two-phase occlusion culling against a hierarchical depth pyramid. Each frame,
+ * the objects that were visible in the previous frame are drawn in an early pass. A depth pyramid is then built from
+ * the early pass depth, keeping the farthest depth of both eyes, and all objects are tested against it. Objects that
+ * were newly revealed are drawn in a late pass. The results are written as indirect draw commands, one per drawn object
+ * and pass, so that the recorded draws never change with visibility. The commands are stored in the order of the draws
+ * rather than the objects, so that consecutive draws with the same state can be submitted as a single multi-draw, and
+ * their first instance is the index of the object to locate its uniform data. The objects are the game objects
+ * followed by one slot per static batch, batched game objects are never drawn on their own. The culling and the depth
+ * pyramid are passes of the frame graph, which also owns the depth pyramid as a transient image. Note that the
+ * descriptor sets can only be created once the frame graph has been compiled. Optionally, objects that cover only a
+ * few pixels on screen are culled as well, regardless of their occlusion.
+ */
+class OcclusionCuller final
+{
+public:
+  OcclusionCuller(const Context* context,
+                  const Headset* headset,
+                  FrameGraph* frameGraph,
+                  ShaderCache* shaderCache, // Only used during construction
+                  size_t objectCount,
+                  size_t framesInFlightCount);
+  ~OcclusionCuller();
+
+  bool createDescriptorSets();
+
+  // The drawn objects are listed in the order of their draw commands, other objects only have their visibility updated
+  void updateFrameData(size_t frameIndex,
+                       const std::array<glm::mat4, 2u>& viewProjectionMatrices,
+                       const std::vector<GameObject*>& gameObjects,
+                       const StaticBatcher* staticBatcher,
+                       const std::vector<size_t>& drawnObjectIndices);
+
+  // Rewrites only the matrices of the current frame for late latching, so that both cull passes test the objects with
+  // the same poses that the depth pyramid is rendered with
+  void updateViewProjectionMatrices(const std::array<glm::mat4, 2u>& viewProjectionMatrices);
+
+  void addCullPass(uint32_t phase); // 0 = early, 1 = late
+  void addDepthPyramidPass(size_t depthBufferResource);
+
+  // Objects whose screen rectangle is smaller than this many pixels in both dimensions are culled, 0 culls none
+  void setMinimumScreenSize(float pixels);
+
+  bool isValid() const;
+  size_t getDrawCommandResource() const;
+  VkBuffer getDrawCommandBuffer() const;
+  VkDeviceSize getDrawCommandOffset(size_t passIndex, size_t drawIndex) const;
+
+private:
+  bool valid = true;
+
+  const Context* context = nullptr;
+  const Headset* headset = nullptr;
+  FrameGraph* frameGraph = nullptr;
+  size_t objectCount = 0u;
+  size_t currentFrameIndex = 0u;
+  float minimumScreenSize = 0.0f;
+
+  // Mirrors the frame data layout in the culling shader
+  struct CullObject
+  {
+    glm::vec4 sphere; // World space center and radius
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t visible;
+    uint32_t drawIndex; // Of the draw command in each pass, noDrawIndex if the object is not drawn
+  };
+
+  struct FrameDataHeader
+  {
+    std::array<glm::mat4, 2u> viewProjectionMatrices;
+    uint32_t resolution[2];
+    uint32_t objectCount;
+    uint32_t levelCount;
+    float minimumScreenSize;
+    uint32_t padding[3]; // Aligns the objects that follow to 16 bytes, as in the shader
+  };
+
+  std::vector<DataBuffer*> frameDataBuffers; // One per frame in flight
+  std::vector<void*> frameDataBufferMemories;
+  DataBuffer* visibilityBuffer = nullptr;
+  DataBuffer* drawCommandBuffer = nullptr;
+  bool visibilityCleared = false;
+  size_t visibilityResource = 0u, drawCommandResource = 0u, depthPyramidResource = 0u;
+
+  VkExtent2D depthPyramidResolution = { 0u, 0u };
+  uint32_t levelCount = 0u;
+  std::vector<VkImageView> levelImageViews;
+  VkSampler sampler = nullptr;
+
+  VkDescriptorPool descriptorPool = nullptr;
+  VkDescriptorSetLayout depthDescriptorSetLayout = nullptr, downsampleDescriptorSetLayout = nullptr,
+                        cullDescriptorSetLayout = nullptr;
+  VkPipelineLayout depthPipelineLayout = nullptr, downsamplePipelineLayout = nullptr, cullPipelineLayout = nullptr;
+  VkPipeline depthPipeline = nullptr, downsamplePipeline = nullptr, cullPipeline = nullptr;
+  VkDescriptorSet depthDescriptorSet = nullptr;
+  std::vector<VkDescriptorSet> downsampleDescriptorSets; // One per level after the first
+  std::vector<VkDescriptorSet> cullDescriptorSets;       // One per frame in flight
+
+  void cull(VkCommandBuffer commandBuffer, uint32_t phase);
+  void buildDepthPyramid(VkCommandBuffer commandBuffer) const;
+};
@@ -3,16 +3,28 @@
 
 
 #include "Context.h"
+#include "ShaderCache.h"
 #include "Util.h"
 
 #include <array>
 #include <sstream>
 
+namespace
+{
+// Vertex shaders with this extension are mesh shaders, which are preceded by the task shader of the same name
+const std::string meshShaderExtension = ".mesh.spv";
+const std::string taskShaderExtension = ".task.spv";
+} // namespace
 
 
 Pipeline::Pipeline(const Context* context,
                    VkPipelineLayout pipelineLayout,
+                   VkPipelineCache pipelineCache,
+                   ShaderCache* shaderCache,
                    VkRenderPass renderPass,
+                   uint32_t subpass,
+                   VkFormat colorFormat,
+                   VkFormat depthFormat,
                    const std::string& vertexFilename,
                    const std::string& fragmentFilename,
                    const std::vector<VkVertexInputBindingDescription>& vertexInputBindingDescriptions,
@@ -27,9 +39,9 @@ Pipeline::Pipeline(const Context* context,
   vertShaderName = vertexFilename;
   fragShaderName = fragmentFilename;
 
-  // Load the vertex shader
+  // Get the vertex shader, the shader cache owns the module
   VkShaderModule vertexShaderModule;
-  if (!util::loadShaderFromFile(device, vertexFilename, vertexShaderModule))
+  if (!shaderCache->getShaderModule(vertexFilename, vertexShaderModule))
   {
     std::stringstream s;
     s << "Vertex shader \"" << vertexFilename << "\"";
@@ -38,9 +50,30 @@ Pipeline::Pipeline(const Context* context,
     return;
   }
 
-  // Load the fragment shader
-  VkShaderModule fragmentShaderModule;
-  if (!util::loadShaderFromFile(device, fragmentFilename, fragmentShaderModule))
+  // Get the task shader in front of a mesh shader
+  const bool meshShading =
+    vertexFilename.size() > meshShaderExtension.size() &&
+    vertexFilename.compare(vertexFilename.size() - meshShaderExtension.size(), meshShaderExtension.size(),
+                           meshShaderExtension) == 0;
+  VkShaderModule taskShaderModule = nullptr;
+  if (meshShading)
+  {
+    const std::string taskFilename =
+      vertexFilename.substr(0u, vertexFilename.size() - meshShaderExtension.size()) + taskShaderExtension;
+    if (!shaderCache->getShaderModule(taskFilename, taskShaderModule))
+    {
+      std::stringstream s;
+      s << "Task shader \"" << taskFilename << "\"";
+      util::error(Error::FileMissing, s.str());
+      valid = false;
+      return;
+    }
+  }
+
+  // Get the fragment shader, depth-only pipelines have none
+  const bool depthOnly = fragmentFilename.empty();
+  VkShaderModule fragmentShaderModule = nullptr;
+  if (!depthOnly && !shaderCache->getShaderModule(fragmentFilename, fragmentShaderModule))
   {
     std::stringstream s;
     s << "Fragment shader \"" << fragmentFilename << "\"";
@@ -49,12 +82,33 @@ Pipeline::Pipeline(const Context* context,
     return;
   }
 
+  // Set the shader features as specialization constants, in the order of their constant IDs
+  const std::array<uint32_t, 4u> specializationData = { pipelineData.alphaOutput, pipelineData.vertexColor,
+                                                        pipelineData.colorMultiplier,
+                                                        static_cast<uint32_t>(pipelineData.lightingModel) };
+
+  std::array<VkSpecializationMapEntry, specializationData.size()> specializationMapEntries;
+  for (size_t constantIndex = 0u; constantIndex < specializationMapEntries.size(); ++constantIndex)
+  {
+    VkSpecializationMapEntry& specializationMapEntry = specializationMapEntries.at(constantIndex);
+    specializationMapEntry.constantID = static_cast<uint32_t>(constantIndex);
+    specializationMapEntry.offset = static_cast<uint32_t>(constantIndex * sizeof(uint32_t));
+    specializationMapEntry.size = sizeof(uint32_t);
+  }
+
+  VkSpecializationInfo specializationInfo;
+  specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationMapEntries.size());
+  specializationInfo.pMapEntries = specializationMapEntries.data();
+  specializationInfo.dataSize = specializationData.size() * sizeof(uint32_t);
+  specializationInfo.pData = specializationData.data();
+
   VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfoVertex{
     VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
   };
   pipelineShaderStageCreateInfoVertex.module = vertexShaderModule;
-  pipelineShaderStageCreateInfoVertex.stage = VK_SHADER_STAGE_VERTEX_BIT;
+  pipelineShaderStageCreateInfoVertex.stage = meshShading ? VK_SHADER_STAGE_MESH_BIT_EXT : VK_SHADER_STAGE_VERTEX_BIT;
   pipelineShaderStageCreateInfoVertex.pName = "main";
+  pipelineShaderStageCreateInfoVertex.pSpecializationInfo = &specializationInfo;
 
   VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfoFragment{
     VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
@@ -62,8 +116,27 @@ Pipeline::Pipeline(const Context* context,
   pipelineShaderStageCreateInfoFragment.module = fragmentShaderModule;
   pipelineShaderStageCreateInfoFragment.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
   pipelineShaderStageCreateInfoFragment.pName = "main";
+  pipelineShaderStageCreateInfoFragment.pSpecializationInfo = &specializationInfo;
 
-  const std::array shaderStages = { pipelineShaderStageCreateInfoVertex, pipelineShaderStageCreateInfoFragment };
+  VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfoTask{
+    VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO
+  };
+  pipelineShaderStageCreateInfoTask.module = taskShaderModule;
+  pipelineShaderStageCreateInfoTask.stage = VK_SHADER_STAGE_TASK_BIT_EXT;
+  pipelineShaderStageCreateInfoTask.pName = "main";
+  pipelineShaderStageCreateInfoTask.pSpecializationInfo = &specializationInfo;
+
+  std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+  if (meshShading)
+  {
+    shaderStages.push_back(pipelineShaderStageCreateInfoTask);
+  }
+
+  shaderStages.push_back(pipelineShaderStageCreateInfoVertex);
+  if (!depthOnly)
+  {
+    shaderStages.push_back(pipelineShaderStageCreateInfoFragment);
+  }
 
   VkPipelineVertexInputStateCreateInfo pipelineVertexInputStateCreateInfo{
     VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
@@ -112,14 +185,29 @@ Pipeline::Pipeline(const Context* context,
   pipelineColorBlendAttachmentState.srcAlphaBlendFactor = pipelineData.srcAlphaBlendFactor;
   pipelineColorBlendAttachmentState.dstAlphaBlendFactor = pipelineData.dstAlphaBlendFactor;
   pipelineColorBlendAttachmentState.alphaBlendOp = pipelineData.alphaBlendOp;
+  // [tdbe] the blend factors and ops above are ignored if the blend equation is dynamic
 
-  pipelineColorBlendStateCreateInfo.attachmentCount = 1;
+  // Dynamic rendering needs a blend state for every color attachment of the rendering, even without a fragment shader
+  const bool dynamicRendering = (renderPass == nullptr);
+  if (depthOnly && dynamicRendering)
+  {
+    pipelineColorBlendAttachmentState.colorWriteMask = 0u;
+    pipelineColorBlendAttachmentState.blendEnable = VK_FALSE;
+  }
+
+  pipelineColorBlendStateCreateInfo.attachmentCount = (depthOnly && !dynamicRendering) ? 0u : 1u;
   pipelineColorBlendStateCreateInfo.pAttachments = &pipelineColorBlendAttachmentState;
 
   VkPipelineDynamicStateCreateInfo pipelineDynamicStateCreateInfo{
     VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO
   };
-  constexpr std::array dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+  std::vector<VkDynamicState> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR,
+                                                VK_DYNAMIC_STATE_CULL_MODE, VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE,
+                                                VK_DYNAMIC_STATE_DEPTH_COMPARE_OP };
+  if (!depthOnly && context->getVkCmdSetColorBlendEquationEXT())
+  {
+    dynamicStates.push_back(VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT);
+  }
   pipelineDynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
   pipelineDynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
 
@@ -130,12 +218,20 @@ Pipeline::Pipeline(const Context* context,
   pipelineDepthStencilStateCreateInfo.depthWriteEnable = VK_TRUE;
   pipelineDepthStencilStateCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
 
+  // Both eyes are rendered at once with multiview, just like in the subpasses of the render passes
+  VkPipelineRenderingCreateInfo pipelineRenderingCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
+  pipelineRenderingCreateInfo.viewMask = 0b00000011;
+  pipelineRenderingCreateInfo.colorAttachmentCount = 1u;
+  pipelineRenderingCreateInfo.pColorAttachmentFormats = &colorFormat;
+  pipelineRenderingCreateInfo.depthAttachmentFormat = depthFormat;
+
   VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo{ VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+  graphicsPipelineCreateInfo.pNext = dynamicRendering ? &pipelineRenderingCreateInfo : nullptr;
   graphicsPipelineCreateInfo.layout = pipelineLayout;
   graphicsPipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
   graphicsPipelineCreateInfo.pStages = shaderStages.data();
-  graphicsPipelineCreateInfo.pVertexInputState = &pipelineVertexInputStateCreateInfo;
-  graphicsPipelineCreateInfo.pInputAssemblyState = &pipelineInputAssemblyStateCreateInfo;
+  graphicsPipelineCreateInfo.pVertexInputState = meshShading ? nullptr : &pipelineVertexInputStateCreateInfo;
+  graphicsPipelineCreateInfo.pInputAssemblyState = meshShading ? nullptr : &pipelineInputAssemblyStateCreateInfo;
   graphicsPipelineCreateInfo.pViewportState = &pipelineViewportStateCreateInfo;
   graphicsPipelineCreateInfo.pRasterizationState = &pipelineRasterizationStateCreateInfo;
   graphicsPipelineCreateInfo.pMultisampleState = &pipelineMultisampleStateCreateInfo;
@@ -143,16 +239,15 @@ Pipeline::Pipeline(const Context* context,
   graphicsPipelineCreateInfo.pDynamicState = &pipelineDynamicStateCreateInfo;
   graphicsPipelineCreateInfo.pDepthStencilState = &pipelineDepthStencilStateCreateInfo;
   graphicsPipelineCreateInfo.renderPass = renderPass;
-  if (vkCreateGraphicsPipelines(device, nullptr, 1u, &graphicsPipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
+  graphicsPipelineCreateInfo.subpass = dynamicRendering ? 0u : subpass;
+  if (vkCreateGraphicsPipelines(device, pipelineCache, 1u, &graphicsPipelineCreateInfo, nullptr, &pipeline) !=
+      VK_SUCCESS)
   {
     util::error(Error::GenericVulkan);
     valid = false;
     return;
   }
 
-  // These shader modules can now be destroyed
-  vkDestroyShaderModule(device, vertexShaderModule, nullptr);
-  vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
   valid = true;
 }
 
@@ -170,6 +265,29 @@ void Pipeline::bindPipeline(VkCommandBuffer commandBuffer) const
   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 }
 
+void Pipeline::setDynamicState(VkCommandBuffer commandBuffer,
+                               const PipelineMaterialPayload& materialData,
+                               VkCompareOp depthCompareOp) const
+{
+  vkCmdSetCullMode(commandBuffer, materialData.cullMode);
+  vkCmdSetDepthWriteEnable(commandBuffer, materialData.depthWrite ? VK_TRUE : VK_FALSE);
+  vkCmdSetDepthCompareOp(commandBuffer, depthCompareOp);
+
+  // Depth-only pipelines have no color attachment to blend into
+  const PFN_vkCmdSetColorBlendEquationEXT vkCmdSetColorBlendEquationEXT = context->getVkCmdSetColorBlendEquationEXT();
+  if (vkCmdSetColorBlendEquationEXT && !fragShaderName.empty())
+  {
+    VkColorBlendEquationEXT colorBlendEquation;
+    colorBlendEquation.srcColorBlendFactor = materialData.srcColorBlendFactor;
+    colorBlendEquation.dstColorBlendFactor = materialData.dstColorBlendFactor;
+    colorBlendEquation.colorBlendOp = materialData.colorBlendOp;
+    colorBlendEquation.srcAlphaBlendFactor = materialData.srcAlphaBlendFactor;
+    colorBlendEquation.dstAlphaBlendFactor = materialData.dstAlphaBlendFactor;
+    colorBlendEquation.alphaBlendOp = materialData.alphaBlendOp;
+    vkCmdSetColorBlendEquationEXT(commandBuffer, 0u, 1u, &colorBlendEquation);
+  }
+}
+
 bool Pipeline::isValid() const
 {
   return valid;
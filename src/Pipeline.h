@@ -8,13 +8,21 @@
 #include <glm/vec4.hpp>
 
 class Context;
+class ShaderCache;
 
 // [tdbe] uniform properties to bind to a material's shader.
-// properties need to be copied to DynamicVertexUniformData
+// properties are uploaded once per material into the material table of the renderer, mirrored in the shaders
 struct DynamicMaterialUniformData{
 	glm::vec4 colorMultiplier = glm::vec4(1.0f);
 };
 
+// [tdbe] lighting models of the Diffuse shader family
+enum class LightingModel : uint32_t
+{
+  Diffuse = 0u,
+  Unlit = 1u
+};
+
 // [tdbe] pipeline configurations for this pipeline / "material"
 struct PipelineMaterialPayload{
   VkBlendFactor srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
@@ -24,6 +32,13 @@ struct PipelineMaterialPayload{
 	VkBlendFactor dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
 	VkBlendOp alphaBlendOp = VK_BLEND_OP_ADD;
 	VkCullModeFlagBits cullMode = VkCullModeFlagBits::VK_CULL_MODE_BACK_BIT;
+	bool depthWrite = true;
+	// [tdbe] shader features, passed as specialization constants so each variant is compiled without the unused code.
+	// Shaders that don't declare a feature ignore it.
+	bool alphaOutput = false;
+	bool vertexColor = true;
+	bool colorMultiplier = true;
+	LightingModel lightingModel = LightingModel::Diffuse;
   bool operator==(const PipelineMaterialPayload& other) const
   {
       return
@@ -39,7 +54,17 @@ struct PipelineMaterialPayload{
       &&
       (alphaBlendOp == other.alphaBlendOp)
       &&
-      (cullMode == other.cullMode);
+      (cullMode == other.cullMode)
+      &&
+      (depthWrite == other.depthWrite)
+      &&
+      (alphaOutput == other.alphaOutput)
+      &&
+      (vertexColor == other.vertexColor)
+      &&
+      (colorMultiplier == other.colorMultiplier)
+      &&
+      (lightingModel == other.lightingModel);
   }
 };
 
@@ -47,13 +72,26 @@ struct PipelineMaterialPayload{
  * The pipeline class wraps a Vulkan pipeline for convenience. It describes the rendering technique to use, including
  * shaders, culling, scissoring (renderable area, similar to viewport (but changing the scissor rect won't affect coordinates), 
  * and other aspects.
+ * The cull mode, depth write and depth compare op are always dynamic state, and so is the blend equation if the device
+ * supports it. They are set per draw from the material payload and the renderer instead, so materials that only differ
+ * in them can share a pipeline. A pipeline without a fragment shader is depth-only and has no color output.
+ * The shader features of the payload are specialization constants, so one shader pair covers all of its variants.
+ * A vertex shader named "<Name>.mesh.spv" is a mesh shader instead, which runs after the task shader "<Name>.task.spv"
+ * and replaces the vertex input and input assembly stages.
+ * Without a render pass, the pipeline is created for multiview dynamic rendering into attachments of the given formats
+ * instead, and the subpass is ignored. Depth-only pipelines then still declare the color attachment, but don't write it.
  */
 class Pipeline final
 {
 public:
   Pipeline(const Context* context,
            VkPipelineLayout pipelineLayout,
+           VkPipelineCache pipelineCache,
+           ShaderCache* shaderCache,
            VkRenderPass renderPass,
+           uint32_t subpass,
+           VkFormat colorFormat,
+           VkFormat depthFormat,
            const std::string& vertexFilename,
            const std::string& fragmentFilename,
            const std::vector<VkVertexInputBindingDescription>& vertexInputBindingDescriptions,
@@ -63,11 +101,16 @@ public:
   ~Pipeline();
 
   void bindPipeline(VkCommandBuffer commandBuffer) const;
+  void setDynamicState(VkCommandBuffer commandBuffer,
+                       const PipelineMaterialPayload& materialData,
+                       VkCompareOp depthCompareOp) const;
 
   bool isValid() const;
 
   const std::string getVertShaderName() const;
   const std::string getFragShaderName() const;
+  // Pipelines from the registry hold the defaults in place of the dynamic state, like the cull mode and depth writes,
+  // so the dynamic state has to come from the material that the pipeline is drawn for instead
   const PipelineMaterialPayload& getPipelineMaterialData() const;
 
 private:
@@ -0,0 +1,329 @@
+#include "PipelineRegistry.h"
+
+#include "Context.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+namespace
+{
+void hashCombine(size_t& seed, size_t value)
+{
+  seed ^= value + 0x9e3779b9u + (seed << 6u) + (seed >> 2u);
+}
+} // namespace
+
+PipelineRegistry::PipelineRegistry(const Context* context,
+                                   VkPipelineLayout pipelineLayout,
+                                   ShaderCache* shaderCache,
+                                   VkFormat colorFormat,
+                                   VkFormat depthFormat)
+: context(context), pipelineLayout(pipelineLayout), shaderCache(shaderCache), colorFormat(colorFormat),
+  depthFormat(depthFormat)
+{
+}
+
+PipelineRegistry::~PipelineRegistry()
+{
+  // Let the background thread finish the pipeline it is working on, the rest of the queue is dropped
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+
+  condition.notify_one();
+  if (backgroundThread.joinable())
+  {
+    backgroundThread.join();
+  }
+
+  for (const Pipeline* pipeline : pipelines)
+  {
+    delete pipeline;
+  }
+}
+
+size_t PipelineRegistry::request(VkRenderPass renderPass,
+                                 uint32_t subpass,
+                                 const std::string& vertexFilename,
+                                 const std::string& fragmentFilename,
+                                 const std::vector<VkVertexInputBindingDescription>& vertexInputBindingDescriptions,
+                                 const std::vector<VkVertexInputAttributeDescription>& vertexInputAttributeDescriptions,
+                                 const PipelineMaterialPayload& pipelineData)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Description description;
+  description.renderPass = renderPass;
+  description.subpass = subpass;
+  description.vertexFilename = vertexFilename;
+  description.fragmentFilename = fragmentFilename;
+  description.vertexInputBindingDescriptions = vertexInputBindingDescriptions;
+  description.vertexInputAttributeDescriptions = vertexInputAttributeDescriptions;
+  description.pipelineData = pipelineData;
+
+  // Dynamic state is set per draw, so it must not tell pipelines apart. The blend equation stays part of the pipeline
+  // on devices that can't set it dynamically.
+  const PipelineMaterialPayload defaultPipelineData;
+  description.pipelineData.cullMode = defaultPipelineData.cullMode;
+  description.pipelineData.depthWrite = defaultPipelineData.depthWrite;
+  if (context->getVkCmdSetColorBlendEquationEXT())
+  {
+    description.pipelineData.srcColorBlendFactor = defaultPipelineData.srcColorBlendFactor;
+    description.pipelineData.dstColorBlendFactor = defaultPipelineData.dstColorBlendFactor;
+    description.pipelineData.colorBlendOp = defaultPipelineData.colorBlendOp;
+    description.pipelineData.srcAlphaBlendFactor = defaultPipelineData.srcAlphaBlendFactor;
+    description.pipelineData.dstAlphaBlendFactor = defaultPipelineData.dstAlphaBlendFactor;
+    description.pipelineData.alphaBlendOp = defaultPipelineData.alphaBlendOp;
+  }
+
+  const auto it = handles.find(description);
+  if (it != handles.end())
+  {
+    return it->second;
+  }
+
+  const size_t handle = descriptions.size();
+  handles.emplace(description, handle);
+  descriptions.push_back(description);
+  return handle;
+}
+
+bool PipelineRegistry::createPipelines()
+{
+  const VkDevice device = context->getVkDevice();
+  const VkPipelineCache pipelineCache = context->getVkPipelineCache();
+
+  const size_t firstIndex = pipelines.size();
+  const size_t pipelineCount = descriptions.size() - firstIndex;
+  if (pipelineCount == 0u)
+  {
+    return true;
+  }
+
+  pipelines.resize(descriptions.size(), nullptr);
+
+  // Seed the worker caches with what the context cache already holds, so that a warm cache still avoids compilation
+  std::vector<char> pipelineCacheData;
+  size_t pipelineCacheDataSize = 0u;
+  if (vkGetPipelineCacheData(device, pipelineCache, &pipelineCacheDataSize, nullptr) == VK_SUCCESS)
+  {
+    pipelineCacheData.resize(pipelineCacheDataSize);
+    if (vkGetPipelineCacheData(device, pipelineCache, &pipelineCacheDataSize, pipelineCacheData.data()) != VK_SUCCESS)
+    {
+      pipelineCacheData.clear();
+    }
+  }
+
+  const size_t hardwareThreadCount = static_cast<size_t>(std::max(std::thread::hardware_concurrency(), 1u));
+  const size_t threadCount = std::min(pipelineCount, hardwareThreadCount);
+
+  // One cache per worker thread, so that the workers never contend on a cache lock
+  std::vector<VkPipelineCache> threadPipelineCaches(threadCount, nullptr);
+  for (VkPipelineCache& threadPipelineCache : threadPipelineCaches)
+  {
+    VkPipelineCacheCreateInfo pipelineCacheCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+    pipelineCacheCreateInfo.initialDataSize = pipelineCacheData.size();
+    pipelineCacheCreateInfo.pInitialData = pipelineCacheData.empty() ? nullptr : pipelineCacheData.data();
+    if (vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &threadPipelineCache) != VK_SUCCESS)
+    {
+      for (const VkPipelineCache createdPipelineCache : threadPipelineCaches)
+      {
+        if (createdPipelineCache)
+        {
+          vkDestroyPipelineCache(device, createdPipelineCache, nullptr);
+        }
+      }
+
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+  }
+
+  // Every worker keeps taking the next pipeline that nobody has started on yet
+  std::atomic<size_t> nextIndex = firstIndex;
+  const std::function<void(VkPipelineCache)> work = [&](VkPipelineCache threadPipelineCache)
+  {
+    for (size_t index = nextIndex++; index < descriptions.size(); index = nextIndex++)
+    {
+      const Description& description = descriptions.at(index);
+      pipelines.at(index) =
+        new Pipeline(context, pipelineLayout, threadPipelineCache, shaderCache, description.renderPass,
+                     description.subpass, colorFormat, depthFormat, description.vertexFilename,
+                     description.fragmentFilename, description.vertexInputBindingDescriptions,
+                     description.vertexInputAttributeDescriptions, description.pipelineData);
+    }
+  };
+
+  // The calling thread works as well instead of waiting idle
+  std::vector<std::thread> threads;
+  for (size_t threadIndex = 1u; threadIndex < threadCount; ++threadIndex)
+  {
+    threads.emplace_back(work, threadPipelineCaches.at(threadIndex));
+  }
+
+  work(threadPipelineCaches.at(0u));
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  // Merge everything that was compiled back into the context cache, so that it gets saved to disk
+  const bool merged = (vkMergePipelineCaches(device, pipelineCache, static_cast<uint32_t>(threadPipelineCaches.size()),
+                                             threadPipelineCaches.data()) == VK_SUCCESS);
+
+  for (const VkPipelineCache threadPipelineCache : threadPipelineCaches)
+  {
+    vkDestroyPipelineCache(device, threadPipelineCache, nullptr);
+  }
+
+  if (!merged)
+  {
+    util::error(Error::GenericVulkan);
+    return false;
+  }
+
+  for (size_t index = firstIndex; index < pipelines.size(); ++index)
+  {
+    if (!pipelines.at(index)->isValid())
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void PipelineRegistry::createPipelinesAsync()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pipelines.size() == descriptions.size())
+    {
+      return;
+    }
+
+    for (size_t handle = pipelines.size(); handle < descriptions.size(); ++handle)
+    {
+      queue.push_back(handle);
+    }
+
+    pipelines.resize(descriptions.size(), nullptr);
+
+    if (!backgroundThread.joinable())
+    {
+      backgroundThread = std::thread(&PipelineRegistry::createPipelinesInBackground, this);
+    }
+  }
+
+  condition.notify_one();
+}
+
+Pipeline* PipelineRegistry::getPipeline(size_t handle) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return (handle < pipelines.size() ? pipelines.at(handle) : nullptr);
+}
+
+void PipelineRegistry::createPipelinesInBackground()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true)
+  {
+    condition.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (stopping)
+    {
+      return;
+    }
+
+    const size_t handle = queue.front();
+    queue.pop_front();
+    const Description description = descriptions.at(handle);
+
+    // Compile without holding the lock, the context pipeline cache is internally synchronized
+    lock.unlock();
+    Pipeline* pipeline =
+      new Pipeline(context, pipelineLayout, context->getVkPipelineCache(), shaderCache, description.renderPass,
+                   description.subpass, colorFormat, depthFormat, description.vertexFilename,
+                   description.fragmentFilename, description.vertexInputBindingDescriptions,
+                   description.vertexInputAttributeDescriptions, description.pipelineData);
+    lock.lock();
+
+    pipelines.at(handle) = pipeline;
+  }
+}
+
+bool PipelineRegistry::Description::operator==(const Description& other) const
+{
+  if (renderPass != other.renderPass || subpass != other.subpass || vertexFilename != other.vertexFilename ||
+      fragmentFilename != other.fragmentFilename || !(pipelineData == other.pipelineData) ||
+      vertexInputBindingDescriptions.size() != other.vertexInputBindingDescriptions.size() ||
+      vertexInputAttributeDescriptions.size() != other.vertexInputAttributeDescriptions.size())
+  {
+    return false;
+  }
+
+  for (size_t index = 0u; index < vertexInputBindingDescriptions.size(); ++index)
+  {
+    const VkVertexInputBindingDescription& a = vertexInputBindingDescriptions.at(index);
+    const VkVertexInputBindingDescription& b = other.vertexInputBindingDescriptions.at(index);
+    if (a.binding != b.binding || a.stride != b.stride || a.inputRate != b.inputRate)
+    {
+      return false;
+    }
+  }
+
+  for (size_t index = 0u; index < vertexInputAttributeDescriptions.size(); ++index)
+  {
+    const VkVertexInputAttributeDescription& a = vertexInputAttributeDescriptions.at(index);
+    const VkVertexInputAttributeDescription& b = other.vertexInputAttributeDescriptions.at(index);
+    if (a.location != b.location || a.binding != b.binding || a.format != b.format || a.offset != b.offset)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+size_t PipelineRegistry::DescriptionHash::operator()(const Description& description) const
+{
+  size_t seed = std::hash<VkRenderPass>()(description.renderPass);
+  hashCombine(seed, description.subpass);
+  hashCombine(seed, std::hash<std::string>()(description.vertexFilename));
+  hashCombine(seed, std::hash<std::string>()(description.fragmentFilename));
+
+  for (const VkVertexInputBindingDescription& binding : description.vertexInputBindingDescriptions)
+  {
+    hashCombine(seed, binding.binding);
+    hashCombine(seed, binding.stride);
+    hashCombine(seed, binding.inputRate);
+  }
+
+  for (const VkVertexInputAttributeDescription& attribute : description.vertexInputAttributeDescriptions)
+  {
+    hashCombine(seed, attribute.location);
+    hashCombine(seed, attribute.binding);
+    hashCombine(seed, attribute.format);
+    hashCombine(seed, attribute.offset);
+  }
+
+  const PipelineMaterialPayload& pipelineData = description.pipelineData;
+  hashCombine(seed, pipelineData.srcColorBlendFactor);
+  hashCombine(seed, pipelineData.dstColorBlendFactor);
+  hashCombine(seed, pipelineData.colorBlendOp);
+  hashCombine(seed, pipelineData.srcAlphaBlendFactor);
+  hashCombine(seed, pipelineData.dstAlphaBlendFactor);
+  hashCombine(seed, pipelineData.alphaBlendOp);
+  hashCombine(seed, pipelineData.cullMode);
+  hashCombine(seed, pipelineData.depthWrite);
+  hashCombine(seed, pipelineData.alphaOutput);
+  hashCombine(seed, pipelineData.vertexColor);
+  hashCombine(seed, pipelineData.colorMultiplier);
+  hashCombine(seed, static_cast<size_t>(pipelineData.lightingModel));
+  return seed;
+}
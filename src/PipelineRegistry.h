@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Pipeline.h"
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Context;
+class ShaderCache;
+
+/*
+ * The pipeline registry class deduplicates and creates the pipelines of the renderer. Pipelines are requested with
+ * their full description, the shader pair, material payload, vertex layout, and subpass, which is hashed so that
+ * identical requests share a single pipeline. Once everything is requested, all unique pipelines are created at once
+ * on a pool of worker threads. Each worker uses its own pipeline cache seeded from the cache of the context, and the
+ * worker caches are merged back into it afterwards. Pipelines requested at runtime are instead created one after the
+ * other on a background thread, so that the frame loop never waits for a compilation. Note that the pipelines only
+ * exist after they have been created, and that the parallel creation is meant for startup before any background work.
+ */
+class PipelineRegistry final
+{
+public:
+  // The attachment formats are only used for pipelines requested without a render pass, for dynamic rendering
+  PipelineRegistry(const Context* context,
+                   VkPipelineLayout pipelineLayout,
+                   ShaderCache* shaderCache,
+                   VkFormat colorFormat,
+                   VkFormat depthFormat);
+  ~PipelineRegistry();
+
+  // Returns the handle of the pipeline for a given description, which is the same for identical descriptions
+  size_t request(VkRenderPass renderPass,
+                 uint32_t subpass,
+                 const std::string& vertexFilename,
+                 const std::string& fragmentFilename,
+                 const std::vector<VkVertexInputBindingDescription>& vertexInputBindingDescriptions,
+                 const std::vector<VkVertexInputAttributeDescription>& vertexInputAttributeDescriptions,
+                 const PipelineMaterialPayload& pipelineData);
+
+  // Creates all requested pipelines in parallel, returns false on error
+  bool createPipelines();
+
+  // Queues all requested pipelines that don't exist yet for creation on the background thread and returns immediately
+  void createPipelinesAsync();
+
+  // Returns nullptr as long as the pipeline has not been created yet
+  Pipeline* getPipeline(size_t handle) const;
+
+private:
+  const Context* context = nullptr;
+  VkPipelineLayout pipelineLayout = nullptr;
+  ShaderCache* shaderCache = nullptr;
+  VkFormat colorFormat = VK_FORMAT_UNDEFINED, depthFormat = VK_FORMAT_UNDEFINED;
+
+  struct Description
+  {
+    VkRenderPass renderPass = nullptr;
+    uint32_t subpass = 0u;
+    std::string vertexFilename, fragmentFilename;
+    std::vector<VkVertexInputBindingDescription> vertexInputBindingDescriptions;
+    std::vector<VkVertexInputAttributeDescription> vertexInputAttributeDescriptions;
+    PipelineMaterialPayload pipelineData;
+
+    bool operator==(const Description& other) const;
+  };
+
+  struct DescriptionHash
+  {
+    size_t operator()(const Description& description) const;
+  };
+
+  std::vector<Description> descriptions;
+  std::unordered_map<Description, size_t, DescriptionHash> handles;
+  std::vector<Pipeline*> pipelines; // One per description, in order of the handles
+
+  // Background creation, the mutex guards all of the above as soon as the background thread runs
+  mutable std::mutex mutex;
+  std::condition_variable condition;
+  std::thread backgroundThread;
+  std::deque<size_t> queue;
+  bool stopping = false;
+
+  void createPipelinesInBackground();
+};
@@ -0,0 +1,222 @@
+#include "QuadLayer.h"
+
+#include "Context.h"
+#include "DataBuffer.h"
+#include "Util.h"
+
+#include <cstring>
+
+QuadLayer::QuadLayer(const Context* context,
+                     XrSession session,
+                     XrSpace space,
+                     VkExtent2D resolution,
+                     VkFormat format,
+                     const XrPosef& pose,
+                     const XrExtent2Df& size)
+: context(context), resolution(resolution)
+{
+  // Create a swapchain with a single layer, the content is copied into its images
+  XrSwapchainCreateInfo swapchainCreateInfo{ XR_TYPE_SWAPCHAIN_CREATE_INFO };
+  swapchainCreateInfo.usageFlags = XR_SWAPCHAIN_USAGE_TRANSFER_DST_BIT | XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT;
+  swapchainCreateInfo.format = format;
+  swapchainCreateInfo.sampleCount = 1u;
+  swapchainCreateInfo.width = resolution.width;
+  swapchainCreateInfo.height = resolution.height;
+  swapchainCreateInfo.arraySize = 1u;
+  swapchainCreateInfo.faceCount = 1u;
+  swapchainCreateInfo.mipCount = 1u;
+  XrResult result = xrCreateSwapchain(session, &swapchainCreateInfo, &swapchain);
+  if (XR_FAILED(result))
+  {
+    util::error(Error::GenericOpenXR);
+    valid = false;
+    return;
+  }
+
+  // Retrieve the swapchain images
+  uint32_t swapchainImageCount;
+  result = xrEnumerateSwapchainImages(swapchain, 0u, &swapchainImageCount, nullptr);
+  if (XR_FAILED(result))
+  {
+    util::error(Error::GenericOpenXR);
+    valid = false;
+    return;
+  }
+
+  std::vector<XrSwapchainImageVulkanKHR> images(swapchainImageCount);
+  for (XrSwapchainImageVulkanKHR& image : images)
+  {
+    image.type = XR_TYPE_SWAPCHAIN_IMAGE_VULKAN_KHR;
+    image.next = nullptr;
+  }
+
+  XrSwapchainImageBaseHeader* data = reinterpret_cast<XrSwapchainImageBaseHeader*>(images.data());
+  result = xrEnumerateSwapchainImages(swapchain, static_cast<uint32_t>(images.size()), &swapchainImageCount, data);
+  if (XR_FAILED(result))
+  {
+    util::error(Error::GenericOpenXR);
+    valid = false;
+    return;
+  }
+
+  for (const XrSwapchainImageVulkanKHR& image : images)
+  {
+    swapchainImages.push_back(image.image);
+  }
+
+  // Create a staging buffer for the content
+  const VkDeviceSize bufferSize = static_cast<VkDeviceSize>(sizeof(uint32_t) * resolution.width * resolution.height);
+  stagingBuffer =
+    new DataBuffer(context, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, bufferSize);
+  if (!stagingBuffer->isValid())
+  {
+    valid = false;
+    return;
+  }
+
+  // The content is blended over the eyes with its alpha, and seen by both of them
+  compositionLayer.layerFlags = XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT;
+  compositionLayer.space = space;
+  compositionLayer.eyeVisibility = XR_EYE_VISIBILITY_BOTH;
+  compositionLayer.subImage.swapchain = swapchain;
+  compositionLayer.subImage.imageRect.offset = { 0, 0 };
+  compositionLayer.subImage.imageRect.extent = { static_cast<int32_t>(resolution.width),
+                                                 static_cast<int32_t>(resolution.height) };
+  compositionLayer.subImage.imageArrayIndex = 0u;
+  compositionLayer.pose = pose;
+  compositionLayer.size = size;
+}
+
+QuadLayer::~QuadLayer()
+{
+  delete stagingBuffer;
+
+  if (swapchain)
+  {
+    xrDestroySwapchain(swapchain);
+  }
+}
+
+bool QuadLayer::setContent(const std::vector<uint32_t>& pixels)
+{
+  if (pixels.size() != static_cast<size_t>(resolution.width) * resolution.height)
+  {
+    return false;
+  }
+
+  // The last upload may still be reading the staging buffer, this only blocks if the content changes every frame
+  if (!context->waitForDrawTimeline(uploadTimelineValue))
+  {
+    return false;
+  }
+
+  void* bufferData = stagingBuffer->map();
+  if (!bufferData)
+  {
+    return false;
+  }
+
+  memcpy(bufferData, pixels.data(), sizeof(uint32_t) * pixels.size());
+  stagingBuffer->unmap();
+
+  contentChanged = true;
+  return true;
+}
+
+void QuadLayer::setPose(const XrPosef& pose)
+{
+  compositionLayer.pose = pose;
+}
+
+void QuadLayer::setVisible(bool visible)
+{
+  this->visible = visible;
+}
+
+bool QuadLayer::acquireImage()
+{
+  if (!contentChanged)
+  {
+    return true;
+  }
+
+  XrSwapchainImageAcquireInfo swapchainImageAcquireInfo{ XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO };
+  XrResult result = xrAcquireSwapchainImage(swapchain, &swapchainImageAcquireInfo, &swapchainImageIndex);
+  if (XR_FAILED(result))
+  {
+    util::error(Error::GenericOpenXR);
+    return false;
+  }
+
+  swapchainImageAcquired = true;
+
+  XrSwapchainImageWaitInfo swapchainImageWaitInfo{ XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO };
+  swapchainImageWaitInfo.timeout = XR_INFINITE_DURATION;
+  result = xrWaitSwapchainImage(swapchain, &swapchainImageWaitInfo);
+  if (XR_FAILED(result))
+  {
+    util::error(Error::GenericOpenXR);
+    return false;
+  }
+
+  return true;
+}
+
+void QuadLayer::recordUpload(VkCommandBuffer commandBuffer) const
+{
+  VkBufferImageCopy region{};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1u;
+  region.imageExtent = { resolution.width, resolution.height, 1u };
+  vkCmdCopyBufferToImage(commandBuffer, stagingBuffer->getBuffer(), getImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         1u, &region);
+}
+
+bool QuadLayer::releaseImage()
+{
+  if (!swapchainImageAcquired)
+  {
+    return true;
+  }
+
+  swapchainImageAcquired = false;
+
+  XrSwapchainImageReleaseInfo swapchainImageReleaseInfo{ XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
+  if (XR_FAILED(xrReleaseSwapchainImage(swapchain, &swapchainImageReleaseInfo)))
+  {
+    util::error(Error::GenericOpenXR);
+    return false;
+  }
+
+  // The frame that was just submitted reads the staging buffer
+  uploadTimelineValue = context->getLastDrawTimelineValue();
+  contentChanged = false;
+  contentUploaded = true;
+  return true;
+}
+
+bool QuadLayer::isValid() const
+{
+  return valid;
+}
+
+bool QuadLayer::isUploading() const
+{
+  return swapchainImageAcquired;
+}
+
+VkImage QuadLayer::getImage() const
+{
+  return swapchainImageAcquired ? swapchainImages.at(swapchainImageIndex) : nullptr;
+}
+
+const XrCompositionLayerBaseHeader* QuadLayer::getCompositionLayer() const
+{
+  if (!visible || !contentUploaded)
+  {
+    return nullptr;
+  }
+
+  return reinterpret_cast<const XrCompositionLayerBaseHeader*>(&compositionLayer);
+}
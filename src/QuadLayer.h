@@ -0,0 +1,71 @@
+#pragma once
+
+#include <openxr/openxr.h>
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+class Context;
+class DataBuffer;
+
+/*
+ * The quad layer class holds flat content, like a user interface panel, that the runtime composites on top of the eyes
+ * as a quad in space. Instead of being drawn into the eyes with every frame at their multisampled stereo cost, the
+ * content has its own swapchain at its own resolution, which the runtime samples at the resolution of the displays.
+ * New content is written into a staging buffer and uploaded into a swapchain image with the next rendered frame. The
+ * runtime keeps showing the last released image until then, so a layer whose content doesn't change costs nothing but
+ * its composition.
+ */
+class QuadLayer final
+{
+public:
+  QuadLayer(const Context* context,
+            XrSession session,
+            XrSpace space,
+            VkExtent2D resolution,
+            VkFormat format,
+            const XrPosef& pose,
+            const XrExtent2Df& size);
+  ~QuadLayer();
+
+  // Replaces the content with one RGBA pixel per value, red in the lowest byte, row by row from the top left. Returns
+  // false if the pixel count doesn't match the resolution or on error.
+  bool setContent(const std::vector<uint32_t>& pixels);
+  void setPose(const XrPosef& pose);
+  void setVisible(bool visible);
+
+  // Acquires a swapchain image to upload into if the content has changed since the last upload, false on error
+  bool acquireImage();
+
+  // Records the upload of the content into the acquired image, which has to be in the transfer destination layout
+  void recordUpload(VkCommandBuffer commandBuffer) const;
+
+  // Releases the acquired image once the frame that uploads into it has been submitted, false on error
+  bool releaseImage();
+
+  bool isValid() const;
+  bool isUploading() const; // Whether an image was acquired for an upload in the current frame
+  VkImage getImage() const; // The acquired image, nullptr if the current frame doesn't upload
+
+  // Returns nullptr while the layer is hidden or has no uploaded content yet
+  const XrCompositionLayerBaseHeader* getCompositionLayer() const;
+
+private:
+  bool valid = true;
+
+  const Context* context = nullptr;
+  VkExtent2D resolution = { 0u, 0u };
+
+  XrSwapchain swapchain = nullptr;
+  std::vector<VkImage> swapchainImages;
+  uint32_t swapchainImageIndex = 0u;
+  bool swapchainImageAcquired = false;
+
+  DataBuffer* stagingBuffer = nullptr;
+  uint64_t uploadTimelineValue = 0u; // Of the last frame that read the staging buffer
+  bool contentChanged = false, contentUploaded = false;
+  bool visible = true;
+
+  XrCompositionLayerQuad compositionLayer{ XR_TYPE_COMPOSITION_LAYER_QUAD };
+};
@@ -0,0 +1,154 @@
+#include "QualityGovernor.h"
+
+#include <stdio.h>
+
+namespace
+{
+constexpr float smoothingFactor = 0.1f; // Weight of the newest frame time in the smoothed frame times
+constexpr float upperLoadThreshold = 0.95f;
+constexpr float lowerLoadThreshold = 0.75f;
+constexpr size_t lowerDelayFrameCount = 10u; // Frames the load has to stay above the upper threshold to lower a knob
+constexpr size_t raiseDelayFrameCount = 90u; // Frames the load has to stay below the lower threshold to raise a knob
+constexpr size_t settleFrameCount = 30u;     // Frames to wait after a change until its effect shows in the frame times
+
+float smooth(float smoothedFrameTime, float frameTime)
+{
+  if (frameTime <= 0.0f)
+  {
+    return smoothedFrameTime;
+  }
+
+  return smoothedFrameTime > 0.0f ? smoothedFrameTime + (frameTime - smoothedFrameTime) * smoothingFactor : frameTime;
+}
+
+const char* getBudgetName(QualityGovernor::Budget budget)
+{
+  return budget == QualityGovernor::Budget::Cpu ? "CPU" : "GPU";
+}
+} // namespace
+
+size_t QualityGovernor::addKnob(const std::string& name,
+                                Budget budget,
+                                const std::vector<float>& levelCosts,
+                                const std::function<void(size_t level)>& apply)
+{
+  Knob knob;
+  knob.name = name;
+  knob.budget = budget;
+  knob.levelCosts = levelCosts;
+  knob.apply = apply;
+  knob.apply(knob.level);
+
+  knobs.push_back(knob);
+  return knobs.size() - 1u;
+}
+
+void QualityGovernor::setKnobLevelCost(size_t knobIndex, size_t level, float cost)
+{
+  knobs.at(knobIndex).levelCosts.at(level) = cost;
+}
+
+void QualityGovernor::pinKnob(size_t knobIndex, size_t level)
+{
+  Knob& knob = knobs.at(knobIndex);
+  knob.pinned = true;
+  if (level != knob.level && level < knob.levelCosts.size())
+  {
+    setKnobLevel(knob, level, "Pinned", 0.0f, 0.0f);
+  }
+}
+
+void QualityGovernor::unpinKnob(size_t knobIndex)
+{
+  knobs.at(knobIndex).pinned = false;
+}
+
+void QualityGovernor::update(float cpuFrameTime, float gpuFrameTime, float frameBudget)
+{
+  smoothedCpuFrameTime = smooth(smoothedCpuFrameTime, cpuFrameTime);
+  smoothedGpuFrameTime = smooth(smoothedGpuFrameTime, gpuFrameTime);
+  if (frameBudget <= 0.0f)
+  {
+    return;
+  }
+
+  ++framesSinceChange;
+
+  const float cpuLoad = smoothedCpuFrameTime / frameBudget;
+  const float gpuLoad = smoothedGpuFrameTime / frameBudget;
+  if (cpuLoad > upperLoadThreshold || gpuLoad > upperLoadThreshold)
+  {
+    framesBelowBudget = 0u;
+    if (++framesAboveBudget < lowerDelayFrameCount || framesSinceChange < settleFrameCount)
+    {
+      return;
+    }
+
+    // Lower the first knob that affects the frame time that is further over the budget
+    const Budget budget = (cpuLoad > gpuLoad ? Budget::Cpu : Budget::Gpu);
+    for (Knob& knob : knobs)
+    {
+      if (knob.budget == budget && !knob.pinned && knob.level + 1u < knob.levelCosts.size())
+      {
+        setKnobLevel(knob, knob.level + 1u, "Lowered",
+                     budget == Budget::Cpu ? smoothedCpuFrameTime : smoothedGpuFrameTime, frameBudget);
+        break;
+      }
+    }
+
+    framesAboveBudget = 0u;
+  }
+  else if (cpuLoad < lowerLoadThreshold && gpuLoad < lowerLoadThreshold)
+  {
+    framesAboveBudget = 0u;
+    if (++framesBelowBudget < raiseDelayFrameCount || framesSinceChange < settleFrameCount)
+    {
+      return;
+    }
+
+    // Raise the last lowered knob again, if the estimated cost of its next level keeps its frame time within budget
+    for (auto knob = knobs.rbegin(); knob != knobs.rend(); ++knob)
+    {
+      if (knob->pinned || knob->level == 0u)
+      {
+        continue;
+      }
+
+      const float load = (knob->budget == Budget::Cpu ? cpuLoad : gpuLoad);
+      const float addedLoad = knob->levelCosts.at(knob->level - 1u) - knob->levelCosts.at(knob->level);
+      if (load + addedLoad < upperLoadThreshold)
+      {
+        setKnobLevel(*knob, knob->level - 1u, "Raised",
+                     knob->budget == Budget::Cpu ? smoothedCpuFrameTime : smoothedGpuFrameTime, frameBudget);
+      }
+
+      break;
+    }
+
+    framesBelowBudget = 0u;
+  }
+  else
+  {
+    framesAboveBudget = 0u;
+    framesBelowBudget = 0u;
+  }
+}
+
+size_t QualityGovernor::getKnobLevel(size_t knobIndex) const
+{
+  return knobs.at(knobIndex).level;
+}
+
+void QualityGovernor::setKnobLevel(Knob& knob, size_t level, const char* reason, float frameTime, float frameBudget)
+{
+  knob.level = level;
+  knob.apply(level);
+  framesSinceChange = 0u;
+
+  printf("\n[QualityGovernor][log] %s \"%s\" to level %zu of %zu", reason, knob.name.c_str(), level,
+         knob.levelCosts.size() - 1u);
+  if (frameBudget > 0.0f)
+  {
+    printf(" at %.2f ms of %.2f ms %s frame time", frameTime, frameBudget, getBudgetName(knob.budget));
+  }
+}
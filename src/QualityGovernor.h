@@ -0,0 +1,62 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ * The quality governor class keeps the frame times inside the frame budget of the runtime by moving a set of quality
+ * knobs. Each knob has a number of discrete levels, starting with the highest quality, and affects either the CPU or
+ * the GPU frame time. When the smoothed frame time of either stays above the budget, the first knob in the order of
+ * registration that affects it and can still be lowered is lowered by one level. When both stay well below the budget
+ * for a while, the last lowered knob in that order is raised again, as long as its estimated cost still fits into the
+ * budget. Every knob exposes such a cost estimate per level, in fractions of the frame budget. Knobs can be pinned to a
+ * level, for example to benchmark with a fixed quality, in which case the governor skips them. Every decision is
+ * logged.
+ */
+class QualityGovernor final
+{
+public:
+  enum class Budget
+  {
+    Cpu,
+    Gpu
+  };
+
+  // Registers a knob with the estimated cost of each of its levels in fractions of the frame budget, beginning with the
+  // highest quality level. The knob is applied at that level right away, and the returned index identifies it.
+  size_t addKnob(const std::string& name,
+                 Budget budget,
+                 const std::vector<float>& levelCosts,
+                 const std::function<void(size_t level)>& apply);
+
+  // Replaces the estimated cost of a level, for example with a measurement of it
+  void setKnobLevelCost(size_t knobIndex, size_t level, float cost);
+
+  // Pinned knobs stay at their level until they are unpinned
+  void pinKnob(size_t knobIndex, size_t level);
+  void unpinKnob(size_t knobIndex);
+
+  // Takes the CPU and GPU frame times and the frame budget in milliseconds, a frame time of 0 is treated as unmeasured
+  void update(float cpuFrameTime, float gpuFrameTime, float frameBudget);
+
+  size_t getKnobLevel(size_t knobIndex) const;
+
+private:
+  struct Knob
+  {
+    std::string name;
+    Budget budget = Budget::Cpu;
+    std::vector<float> levelCosts;
+    std::function<void(size_t level)> apply;
+    size_t level = 0u;
+    bool pinned = false;
+  };
+  std::vector<Knob> knobs; // In the order that they are lowered in
+
+  float smoothedCpuFrameTime = 0.0f, smoothedGpuFrameTime = 0.0f; // In milliseconds, 0 before the first measurement
+  size_t framesAboveBudget = 0u, framesBelowBudget = 0u;          // Consecutive frames outside the load thresholds
+  size_t framesSinceChange = 0u;
+
+  void setKnobLevel(Knob& knob, size_t level, const char* reason, float frameTime, float frameBudget);
+};
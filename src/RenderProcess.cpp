@@ -4,6 +4,7 @@
 #include "DataBuffer.h"
 #include "Util.h"
 
+#include <algorithm>
 #include <cstring>
 
 RenderProcess::RenderProcess(const Context* context,
@@ -15,14 +16,16 @@ RenderProcess::RenderProcess(const Context* context,
                              )
 : context(context)
 {
-  // Initialize the uniform buffer data
-  dynamicVertexUniformData.resize(gameObjectCount);
-  for (size_t modelIndex = 0u; modelIndex < gameObjectCount; ++modelIndex)
+  // Initialize the uniform buffer data, one per game object followed by one per static batch, which is per material
+  dynamicVertexUniformData.resize(gameObjectCount + materialsCount);
+  for (size_t modelIndex = 0u; modelIndex < dynamicVertexUniformData.size(); ++modelIndex)
   {
     dynamicVertexUniformData[modelIndex].worldMatrix = glm::mat4(1.0f);
-    dynamicVertexUniformData[modelIndex].colorMultiplier = glm::vec4(1.0f);
+    dynamicVertexUniformData[modelIndex].materialIndex = 0u;
   }
 
+  materialVersions.resize(materialsCount);
+
   // Initialize the uniform buffer data
    for (glm::mat4& viewProjectionMatrix : staticVertexUniformData.viewProjectionMatrices)
   {
@@ -45,6 +48,24 @@ RenderProcess::RenderProcess(const Context* context,
     return;
   }
 
+  // Allocate the secondary command buffers for static and dynamic draws of each pass and subpass
+  commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+  commandBufferAllocateInfo.commandBufferCount = static_cast<uint32_t>(staticCommandBuffers.size());
+  if (vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, staticCommandBuffers.data()) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  commandBufferAllocateInfo.commandBufferCount = static_cast<uint32_t>(dynamicCommandBuffers.size());
+  if (vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, dynamicCommandBuffers.data()) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
   // Create semaphores
   VkSemaphoreCreateInfo semaphoreCreateInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
   if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &drawableSemaphore) != VK_SUCCESS)
@@ -61,36 +82,50 @@ RenderProcess::RenderProcess(const Context* context,
     return;
   }
 
-  // Create a memory fence
-  VkFenceCreateInfo fenceCreateInfo{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
-  fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // Make sure the fence starts off signaled
-  if (vkCreateFence(device, &fenceCreateInfo, nullptr, &busyFence) != VK_SUCCESS)
+  // Create the timestamp queries around the eye passes and the depth resolve, where the draw queue supports timestamps
+  if (context->getTimestampPeriod() > 0.0f)
   {
-    util::error(Error::GenericVulkan);
-    valid = false;
-    return;
+    VkQueryPoolCreateInfo queryPoolCreateInfo{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolCreateInfo.queryCount = timestampCount;
+    if (vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &timestampQueryPool) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
   }
 
   const VkDeviceSize uniformBufferOffsetAlignment = context->getUniformBufferOffsetAlignment();
+  const VkDeviceSize storageBufferOffsetAlignment = context->getStorageBufferOffsetAlignment();
 
-  // Partition the uniform buffer data
-  std::array<VkDescriptorBufferInfo, 3u> descriptorBufferInfos;
+  // Partition the uniform buffer data, the dynamic data is a tightly packed storage buffer array that the shaders index
+  // by the first instance of each draw
+  std::array<VkDescriptorBufferInfo, 4u> descriptorBufferInfos;
 
   descriptorBufferInfos.at(0u).offset = 0u;
-  descriptorBufferInfos.at(0u).range = sizeof(DynamicVertexUniformData);
+  descriptorBufferInfos.at(0u).range =
+    sizeof(DynamicVertexUniformData) * static_cast<VkDeviceSize>(dynamicVertexUniformData.size());
 
-  descriptorBufferInfos.at(1u).offset = util::align(descriptorBufferInfos.at(0u).range, uniformBufferOffsetAlignment) *
-                                        static_cast<VkDeviceSize>(gameObjectCount);
+  descriptorBufferInfos.at(1u).offset = util::align(descriptorBufferInfos.at(0u).range, uniformBufferOffsetAlignment);
   descriptorBufferInfos.at(1u).range = sizeof(StaticVertexUniformData);
+  staticVertexUniformDataOffset = descriptorBufferInfos.at(1u).offset;
 
   descriptorBufferInfos.at(2u).offset = 
     descriptorBufferInfos.at(1u).offset + util::align(descriptorBufferInfos.at(1u).range, uniformBufferOffsetAlignment);
   descriptorBufferInfos.at(2u).range = sizeof(StaticFragmentUniformData);
 
+  // The material table is another storage buffer array, one entry per material
+  descriptorBufferInfos.at(3u).offset = util::align(
+    descriptorBufferInfos.at(2u).offset + descriptorBufferInfos.at(2u).range, storageBufferOffsetAlignment);
+  descriptorBufferInfos.at(3u).range =
+    sizeof(DynamicMaterialUniformData) * static_cast<VkDeviceSize>(std::max(materialsCount, size_t(1u)));
+  materialTableOffset = descriptorBufferInfos.at(3u).offset;
+
   // Create an empty uniform buffer
-  const VkDeviceSize uniformBufferSize = descriptorBufferInfos.at(2u).offset + descriptorBufferInfos.at(2u).range;
+  const VkDeviceSize uniformBufferSize = descriptorBufferInfos.at(3u).offset + descriptorBufferInfos.at(3u).range;
   uniformBuffer =
-    new DataBuffer(context, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+    new DataBuffer(context, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBufferSize);
   if (!uniformBuffer->isValid())
   {
@@ -126,7 +161,7 @@ RenderProcess::RenderProcess(const Context* context,
   }
 
   // Update the descriptor sets
-  std::array<VkWriteDescriptorSet, 3u> writeDescriptorSets;
+  std::array<VkWriteDescriptorSet, 4u> writeDescriptorSets;
 
   writeDescriptorSets.at(0u).sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
   writeDescriptorSets.at(0u).pNext = nullptr;
@@ -134,7 +169,7 @@ RenderProcess::RenderProcess(const Context* context,
   writeDescriptorSets.at(0u).dstBinding = 0u;
   writeDescriptorSets.at(0u).dstArrayElement = 0u;
   writeDescriptorSets.at(0u).descriptorCount = 1u;
-  writeDescriptorSets.at(0u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  writeDescriptorSets.at(0u).descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
   writeDescriptorSets.at(0u).pBufferInfo = &descriptorBufferInfos.at(0u);
   writeDescriptorSets.at(0u).pImageInfo = nullptr;
   writeDescriptorSets.at(0u).pTexelBufferView = nullptr;
@@ -161,6 +196,17 @@ RenderProcess::RenderProcess(const Context* context,
   writeDescriptorSets.at(2u).pImageInfo = nullptr;
   writeDescriptorSets.at(2u).pTexelBufferView = nullptr;
 
+  writeDescriptorSets.at(3u).sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  writeDescriptorSets.at(3u).pNext = nullptr;
+  writeDescriptorSets.at(3u).dstSet = descriptorSet;
+  writeDescriptorSets.at(3u).dstBinding = 3u;
+  writeDescriptorSets.at(3u).dstArrayElement = 0u;
+  writeDescriptorSets.at(3u).descriptorCount = 1u;
+  writeDescriptorSets.at(3u).descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  writeDescriptorSets.at(3u).pBufferInfo = &descriptorBufferInfos.at(3u);
+  writeDescriptorSets.at(3u).pImageInfo = nullptr;
+  writeDescriptorSets.at(3u).pTexelBufferView = nullptr;
+
   vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0u,
                          nullptr);
 }
@@ -176,9 +222,9 @@ RenderProcess::~RenderProcess()
   const VkDevice device = context->getVkDevice();
   if (device)
   {
-    if (busyFence)
+    if (timestampQueryPool)
     {
-      vkDestroyFence(device, busyFence, nullptr);
+      vkDestroyQueryPool(device, timestampQueryPool, nullptr);
     }
 
     if (presentableSemaphore)
@@ -203,6 +249,16 @@ VkCommandBuffer RenderProcess::getCommandBuffer() const
   return commandBuffer;
 }
 
+VkCommandBuffer RenderProcess::getStaticCommandBuffer(size_t passIndex, size_t subpassIndex) const
+{
+  return staticCommandBuffers.at(passIndex * 2u + subpassIndex);
+}
+
+VkCommandBuffer RenderProcess::getDynamicCommandBuffer(size_t passIndex, size_t subpassIndex) const
+{
+  return dynamicCommandBuffers.at(passIndex * 2u + subpassIndex);
+}
+
 VkSemaphore RenderProcess::getDrawableSemaphore() const
 {
   return drawableSemaphore;
@@ -213,9 +269,9 @@ VkSemaphore RenderProcess::getPresentableSemaphore() const
   return presentableSemaphore;
 }
 
-VkFence RenderProcess::getBusyFence() const
+VkQueryPool RenderProcess::getTimestampQueryPool() const
 {
-  return busyFence;
+  return timestampQueryPool;
 }
 
 VkDescriptorSet RenderProcess::getDescriptorSet() const
@@ -233,12 +289,9 @@ void RenderProcess::updateUniformBufferData() const
   const VkDeviceSize uniformBufferOffsetAlignment = context->getUniformBufferOffsetAlignment();
 
   char* offset = static_cast<char*>(uniformBufferMemory);
-  VkDeviceSize length = sizeof(DynamicVertexUniformData);
-  for (const DynamicVertexUniformData& dynamicData : dynamicVertexUniformData)
-  {
-    memcpy(offset, &dynamicData, length);
-    offset += util::align(length, uniformBufferOffsetAlignment);
-  }
+  VkDeviceSize length = sizeof(DynamicVertexUniformData) * static_cast<VkDeviceSize>(dynamicVertexUniformData.size());
+  memcpy(offset, dynamicVertexUniformData.data(), length);
+  offset += util::align(length, uniformBufferOffsetAlignment);
 
   length = sizeof(StaticVertexUniformData);
   memcpy(offset, &staticVertexUniformData, length);
@@ -248,4 +301,30 @@ void RenderProcess::updateUniformBufferData() const
   memcpy(offset, &staticFragmentUniformData, length);
   offset += util::align(length, uniformBufferOffsetAlignment);
 
+}
+
+void RenderProcess::updateStaticVertexUniformData() const
+{
+  if (!uniformBufferMemory)
+  {
+    return;
+  }
+
+  memcpy(static_cast<char*>(uniformBufferMemory) + staticVertexUniformDataOffset, &staticVertexUniformData,
+         sizeof(StaticVertexUniformData));
+}
+
+void RenderProcess::updateMaterialUniformData(size_t materialIndex,
+                                              const DynamicMaterialUniformData& data,
+                                              uint32_t version)
+{
+  if (!uniformBufferMemory || materialVersions.at(materialIndex) == version)
+  {
+    return;
+  }
+
+  char* offset = static_cast<char*>(uniformBufferMemory) + materialTableOffset +
+                 sizeof(DynamicMaterialUniformData) * materialIndex;
+  memcpy(offset, &data, sizeof(DynamicMaterialUniformData));
+  materialVersions.at(materialIndex) = version;
 }
\ No newline at end of file
@@ -5,19 +5,29 @@
 #include <vulkan/vulkan.h>
 
 #include <array>
+#include <optional>
 #include <vector>
 
 #include "GameData.h"
 
 class Context;
 class DataBuffer;
+class Pipeline;
 
 /*
  * The render process class consolidates all the resources that needs to be duplicated for each frame that can be
  * rendered to in parallel. The renderer owns a render process for each frame that can be processed at the same time,
- * and each render process holds their own uniform buffer, command buffer, semaphores and memory fence. With this
- * duplication, the application can be sure that one frame does not modify a resource that is still in use by another
- * simultaneous frame.
+ * and each render process holds their own uniform buffer, command buffer and semaphores. With this duplication, the
+ * application can be sure that one frame does not modify a resource that is still in use by another simultaneous frame.
+ * The binary semaphores order the frame with the mirror view swapchain, which can't use timeline semaphores. Whether
+ * the last frame of a render process has completed is tracked by the draw timeline value that its submission signals.
+ * Draws are recorded into two secondary command buffers per occlusion culling pass and subpass that are executed inside
+ * the primary command buffer's render passes. The static ones hold the draws of objects that never move and are only
+ * re-recorded when that set, the depth prepass setting or the render resolution changes, the dynamic ones are
+ * re-recorded every frame. Each submission writes a timestamp before and after the eye passes, so that the renderer
+ * can read back how long the GPU took for them once the render process is reused.
+ * The uniform buffer ends with a material table that holds the data of each material once, an entry is only written
+ * again when the version of its material has changed since this render process last wrote it.
  * 
  * [tdbe] TODO: We should create descriptor sets (the main way of connecting CPU data to the GPU), per-material, 
  * to also be able to push different (texture) data per gameobject/mat. (vkCmdPushConstants is a limited alternative.)
@@ -35,12 +45,12 @@ public:
   ~RenderProcess();
 
   // [tdbe] uniform properties to bind to per model.
-  // Also the per-material properties get sent here.
+  // The per-material properties live in the material table instead, located through the material index.
   struct DynamicVertexUniformData{
     // per model/mesh
     glm::mat4 worldMatrix = glm::mat4(1.0f);
-    // "per material" (ie it doesn't -need- to be unique per model/mesh)
-    glm::vec4 colorMultiplier = glm::vec4(1.0f);
+    uint32_t materialIndex = 0u;
+    uint32_t padding[3] = {}; // Matches the array stride in the shaders
   };
   std::vector<DynamicVertexUniformData> dynamicVertexUniformData;
 
@@ -48,6 +58,7 @@ public:
   struct StaticVertexUniformData
   {
     std::array<glm::mat4, 2u> viewProjectionMatrices; // 0 = left eye, 1 = right eye
+    std::array<glm::vec4, 2u> eyePositions;           // In world space, for culling meshlets by their normal cone
   } staticVertexUniformData;
   
   // [tdbe] uniform properties available globally
@@ -56,23 +67,65 @@ public:
     float time;
   } staticFragmentUniformData;
 
+  // A single recorded draw, the static draws last recorded into the static command buffer are kept to detect when it
+  // needs to be re-recorded. Static batches draw from their own geometry buffer. Draws with a mesh pipeline draw their
+  // meshlets with task and mesh shaders instead of their index range.
+  struct Draw
+  {
+    size_t gameObjectIndex; // Index of the uniform data and culled object, static batches come after the game objects
+    const Pipeline* pipeline;
+    PipelineMaterialPayload pipelineData; // Dynamic state of the draw
+    size_t firstIndex;
+    size_t indexCount;
+    VkBuffer geometryBuffer = nullptr; // The shared geometry buffer if null
+    VkDeviceSize attributeOffset = 0u, indexOffset = 0u;
+    const Pipeline* meshPipeline = nullptr;
+    size_t firstMeshlet = 0u, meshletCount = 0u;
+    bool operator==(const Draw& other) const = default;
+  };
+  std::vector<Draw> recordedStaticDraws;
+  bool staticDrawsRecorded = false;
+  bool recordedDepthPrepass = false;
+  VkExtent2D recordedRenderResolution = { 0u, 0u }; // Of the viewport and scissor in the secondary command buffers
+  size_t recordedVisibilityMaskVersion = 0u;         // Of the mask drawn at the start of the early pass
+  bool timestampsWritten = false; // Whether the last submission of this render process wrote its timestamps
+  bool depthResolveTimestampsWritten = false; // Whether it resolved depth and wrote the timestamps around that
+  uint64_t timelineValue = 0u; // Signaled by the draw queue once the last submission of this render process completed
+
   bool isValid() const;
   VkCommandBuffer getCommandBuffer() const;
+  VkCommandBuffer getStaticCommandBuffer(size_t passIndex, size_t subpassIndex) const;
+  VkCommandBuffer getDynamicCommandBuffer(size_t passIndex, size_t subpassIndex) const;
   VkSemaphore getDrawableSemaphore() const;
   VkSemaphore getPresentableSemaphore() const;
-  VkFence getBusyFence() const;
   VkDescriptorSet getDescriptorSet() const;
 
+  // Returns nullptr if the draw queue can't write timestamps, holds the start and end of the eye passes otherwise,
+  // followed by the start and end of the depth resolve
+  VkQueryPool getTimestampQueryPool() const;
+  static constexpr uint32_t timestampCount = 4u;
+
   void updateUniformBufferData() const;
 
+  // Only writes the static vertex uniform data again, to late latch the eye poses of a recorded frame before it is
+  // submitted
+  void updateStaticVertexUniformData() const;
+
+  // Writes the data of a material into the material table, unless this render process already holds that version
+  void updateMaterialUniformData(size_t materialIndex, const DynamicMaterialUniformData& data, uint32_t version);
+
 private:
   bool valid = true;
 
   const Context* context = nullptr;
   VkCommandBuffer commandBuffer = nullptr;
+  // Per pass and subpass: 0 = early depth, 1 = early color, 2 = late depth, 3 = late color
+  std::array<VkCommandBuffer, 4u> staticCommandBuffers = {}, dynamicCommandBuffers = {};
   VkSemaphore drawableSemaphore = nullptr, presentableSemaphore = nullptr;
-  VkFence busyFence = nullptr;
+  VkQueryPool timestampQueryPool = nullptr;
   DataBuffer* uniformBuffer = nullptr;
   void* uniformBufferMemory = nullptr;
+  VkDeviceSize staticVertexUniformDataOffset = 0u, materialTableOffset = 0u;
+  std::vector<std::optional<uint32_t>> materialVersions; // Last written version per material, none before the first
   VkDescriptorSet descriptorSet = nullptr;
 };
\ No newline at end of file
@@ -4,6 +4,14 @@
 
 #include <array>
 
+namespace
+{
+bool isDepthFormat(VkFormat format)
+{
+  return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_X8_D24_UNORM_PACK32 || format == VK_FORMAT_D32_SFLOAT;
+}
+} // namespace
+
 RenderTarget::RenderTarget(VkDevice device,
                            VkImage image,
                            VkImageView colorImageView,
@@ -22,7 +30,8 @@ RenderTarget::RenderTarget(VkDevice device,
   imageViewCreateInfo.components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
                                      VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
   imageViewCreateInfo.subresourceRange.layerCount = layerCount;
-  imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  imageViewCreateInfo.subresourceRange.aspectMask =
+    (isDepthFormat(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT);
   imageViewCreateInfo.subresourceRange.baseArrayLayer = 0u;
   imageViewCreateInfo.subresourceRange.baseMipLevel = 0u;
   imageViewCreateInfo.subresourceRange.levelCount = 1u;
@@ -33,6 +42,12 @@ RenderTarget::RenderTarget(VkDevice device,
     return;
   }
 
+  // Dynamic rendering begins rendering with the image views themselves
+  if (!renderPass)
+  {
+    return;
+  }
+
   const std::array attachments = { colorImageView, depthImageView, imageView };
 
   // Create a framebuffer
@@ -77,6 +92,11 @@ VkImage RenderTarget::getImage() const
   return image;
 }
 
+VkImageView RenderTarget::getImageView() const
+{
+  return imageView;
+}
+
 VkFramebuffer RenderTarget::getFramebuffer() const
 {
   return framebuffer;
@@ -4,7 +4,9 @@
 
 /*
  * The render target class represents a convenient combination of an image and a framebuffer in Vulkan. The class is
- * used for the Vulkan swapchain images retrieved by OpenXR for the headset displays.
+ * used for the Vulkan swapchain images retrieved by OpenXR for the headset displays. Without a render pass, as is the
+ * case with dynamic rendering, no framebuffer is created and only the image view of the image is used. Render targets
+ * with a depth format view the depth aspect of their image, for the depth swapchain images of the headset.
  */
 class RenderTarget final
 {
@@ -21,6 +23,7 @@ public:
 
   bool isValid() const;
   VkImage getImage() const;
+  VkImageView getImageView() const;
   VkFramebuffer getFramebuffer() const;
 
 private:
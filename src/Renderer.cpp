@@ -2,21 +2,67 @@
 
 #include "Context.h"
 #include "DataBuffer.h"
+#include "FrameGraph.h"
 #include "Headset.h"
+#include "ImageBuffer.h"
 #include "MeshData.h"
+#include "MeshletData.h"
+#include "OcclusionCuller.h"
 #include "GameData.h"
 #include "Pipeline.h"
+#include "PipelineRegistry.h"
+#include "QuadLayer.h"
 #include "RenderProcess.h"
 #include "RenderTarget.h"
+#include "ShaderCache.h"
+#include "StaticBatcher.h"
 #include "Util.h"
 
+#include <glm/matrix.hpp>
+
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <functional>
 #include <stdio.h>
+#include <string>
 
 
 namespace
 {
 constexpr size_t framesInFlightCount = 2u;
+
+// The color pipelines are created for the color subpass, the depth prepass pipeline for the depth subpass before it
+constexpr uint32_t depthSubpass = 0u;
+constexpr uint32_t colorSubpass = 1u;
+
+// Fetch the vertices in the vertex shaders from storage buffers instead of vertex inputs, this needs the pulled variant
+// of every vertex shader that a material uses
+constexpr bool vertexPulling = false;
+
+// Returns the file name of the pulled variant of a vertex shader, "<Name>.vert.spv" becomes "<Name>Pulled.vert.spv"
+std::string getVertexShaderName(const std::string& vertexFilename)
+{
+  const std::string extension = ".vert.spv";
+  if (!vertexPulling || vertexFilename.size() < extension.size() ||
+      vertexFilename.compare(vertexFilename.size() - extension.size(), extension.size(), extension) != 0)
+  {
+    return vertexFilename;
+  }
+
+  return vertexFilename.substr(0u, vertexFilename.size() - extension.size()) + "Pulled" + extension;
+}
+
+// The mesh shader replaces the Diffuse vertex shader, materials with other vertex shaders always draw indexed
+const std::string meshShaderFilename = "shaders/Meshlet.mesh.spv";
+const std::string meshShaderVertexFilename = "shaders/Diffuse.vert.spv";
+constexpr uint32_t taskGroupSize = 32u; // Meshlets per task shader workgroup, must match the task shader
+
+// Materials that write depth and don't blend with what is behind them take part in the depth prepass
+bool isOpaque(const PipelineMaterialPayload& pipelineData)
+{
+  return pipelineData.depthWrite && !pipelineData.alphaOutput;
+}
 } // namespace
 
 Renderer::Renderer(const Context* context,
@@ -29,6 +75,13 @@ Renderer::Renderer(const Context* context,
 {
   const VkDevice device = context->getVkDevice();
 
+  // The task and mesh shaders read the same uniform data and vertex streams as the vertex shaders
+  meshShading = (context->getVkCmdDrawMeshTasksEXT() != nullptr);
+  const VkShaderStageFlags vertexStageFlags =
+    VK_SHADER_STAGE_VERTEX_BIT |
+    (meshShading ? VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT : static_cast<VkShaderStageFlags>(0u));
+  printf("\n[Renderer][log] Mesh shading %s", meshShading ? "supported" : "not supported, drawing indexed");
+
   // Create a command pool
   VkCommandPoolCreateInfo commandPoolCreateInfo{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
   commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
@@ -43,8 +96,8 @@ Renderer::Renderer(const Context* context,
   // Create a descriptor pool
   std::array<VkDescriptorPoolSize, 2u> descriptorPoolSizes;
 
-  descriptorPoolSizes.at(0u).type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-  descriptorPoolSizes.at(0u).descriptorCount = static_cast<uint32_t>(framesInFlightCount);
+  descriptorPoolSizes.at(0u).type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorPoolSizes.at(0u).descriptorCount = static_cast<uint32_t>(framesInFlightCount * 2u);
 
   descriptorPoolSizes.at(1u).type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
   descriptorPoolSizes.at(1u).descriptorCount = static_cast<uint32_t>(framesInFlightCount * 2u);
@@ -61,23 +114,29 @@ Renderer::Renderer(const Context* context,
   }
 
   // Create a descriptor set layout
-  std::array<VkDescriptorSetLayoutBinding, 3u> descriptorSetLayoutBindings;
+  std::array<VkDescriptorSetLayoutBinding, 4u> descriptorSetLayoutBindings;
 
   descriptorSetLayoutBindings.at(0u).binding = 0u;
-  descriptorSetLayoutBindings.at(0u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  descriptorSetLayoutBindings.at(0u).descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
   descriptorSetLayoutBindings.at(0u).descriptorCount = 1u;
-  descriptorSetLayoutBindings.at(0u).stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  descriptorSetLayoutBindings.at(0u).stageFlags = vertexStageFlags;
 
   descriptorSetLayoutBindings.at(1u).binding = 1u;
   descriptorSetLayoutBindings.at(1u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
   descriptorSetLayoutBindings.at(1u).descriptorCount = 1u;
-  descriptorSetLayoutBindings.at(1u).stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  descriptorSetLayoutBindings.at(1u).stageFlags = vertexStageFlags;
 
   descriptorSetLayoutBindings.at(2u).binding = 2u;
   descriptorSetLayoutBindings.at(2u).descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
   descriptorSetLayoutBindings.at(2u).descriptorCount = 1u;
   descriptorSetLayoutBindings.at(2u).stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
+  // The material table
+  descriptorSetLayoutBindings.at(3u).binding = 3u;
+  descriptorSetLayoutBindings.at(3u).descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorSetLayoutBindings.at(3u).descriptorCount = 1u;
+  descriptorSetLayoutBindings.at(3u).stageFlags = vertexStageFlags;
+
   VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
   descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(descriptorSetLayoutBindings.size());
   descriptorSetLayoutCreateInfo.pBindings = descriptorSetLayoutBindings.data();
@@ -88,10 +147,93 @@ Renderer::Renderer(const Context* context,
     return;
   }
 
-  // Create a pipeline layout
+  // Create a descriptor set layout for the position and attribute streams of a geometry buffer, for vertex pulling
+  std::array<VkDescriptorSetLayoutBinding, 2u> geometryDescriptorSetLayoutBindings;
+  for (size_t bindingIndex = 0u; bindingIndex < geometryDescriptorSetLayoutBindings.size(); ++bindingIndex)
+  {
+    VkDescriptorSetLayoutBinding& binding = geometryDescriptorSetLayoutBindings.at(bindingIndex);
+    binding.binding = static_cast<uint32_t>(bindingIndex);
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding.descriptorCount = 1u;
+    binding.stageFlags = vertexStageFlags;
+    binding.pImmutableSamplers = nullptr;
+  }
+
+  descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(geometryDescriptorSetLayoutBindings.size());
+  descriptorSetLayoutCreateInfo.pBindings = geometryDescriptorSetLayoutBindings.data();
+  if (vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &geometryDescriptorSetLayout) !=
+      VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    valid = false;
+    return;
+  }
+
+  // Create a descriptor set layout for the meshlets and the draw commands of the occlusion culler, for mesh shading
+  std::array<VkDescriptorSetLayoutBinding, 4u> meshletDescriptorSetLayoutBindings;
+  for (size_t bindingIndex = 0u; bindingIndex < meshletDescriptorSetLayoutBindings.size(); ++bindingIndex)
+  {
+    VkDescriptorSetLayoutBinding& binding = meshletDescriptorSetLayoutBindings.at(bindingIndex);
+    binding.binding = static_cast<uint32_t>(bindingIndex);
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding.descriptorCount = 1u;
+    binding.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+    binding.pImmutableSamplers = nullptr;
+  }
+
+  if (meshShading)
+  {
+    descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(meshletDescriptorSetLayoutBindings.size());
+    descriptorSetLayoutCreateInfo.pBindings = meshletDescriptorSetLayoutBindings.data();
+    if (vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &meshletDescriptorSetLayout) !=
+        VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
+  }
+
+  // Create a descriptor pool for the geometry descriptor sets, one for the shared geometry buffer and one per batch,
+  // and for the meshlet descriptor set
+  if (vertexPulling || meshShading)
+  {
+    VkDescriptorPoolSize geometryDescriptorPoolSize;
+    geometryDescriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    geometryDescriptorPoolSize.descriptorCount =
+      static_cast<uint32_t>((1u + materials.size()) * geometryDescriptorSetLayoutBindings.size() +
+                            meshletDescriptorSetLayoutBindings.size());
+
+    VkDescriptorPoolCreateInfo geometryDescriptorPoolCreateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+    geometryDescriptorPoolCreateInfo.poolSizeCount = 1u;
+    geometryDescriptorPoolCreateInfo.pPoolSizes = &geometryDescriptorPoolSize;
+    geometryDescriptorPoolCreateInfo.maxSets = static_cast<uint32_t>(2u + materials.size());
+    if (vkCreateDescriptorPool(device, &geometryDescriptorPoolCreateInfo, nullptr, &geometryDescriptorPool) !=
+        VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      valid = false;
+      return;
+    }
+  }
+
+  // Create a pipeline layout, the task and mesh shaders get the meshlet range of their draw as push constants
+  std::vector<VkDescriptorSetLayout> setLayouts = { descriptorSetLayout, geometryDescriptorSetLayout };
+  if (meshShading)
+  {
+    setLayouts.push_back(meshletDescriptorSetLayout);
+  }
+
+  VkPushConstantRange pushConstantRange;
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+  pushConstantRange.offset = 0u;
+  pushConstantRange.size = static_cast<uint32_t>(sizeof(uint32_t) * 4u);
+
   VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-  pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
-  pipelineLayoutCreateInfo.setLayoutCount = 1u;
+  pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+  pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+  pipelineLayoutCreateInfo.pushConstantRangeCount = meshShading ? 1u : 0u;
+  pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
   if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
   {
     util::error(Error::GenericVulkan);
@@ -99,6 +241,12 @@ Renderer::Renderer(const Context* context,
     return;
   }
 
+  // Each material has a slot in the material table of the render processes, which the objects locate it through
+  for (size_t materialIndex = 0u; materialIndex < materials.size(); ++materialIndex)
+  {
+    materials.at(materialIndex)->materialIndex = static_cast<uint32_t>(materialIndex);
+  }
+
   // Create a render process for each frame in flight
   renderProcesses.resize(framesInFlightCount);
   for (RenderProcess*& renderProcess : renderProcesses)
@@ -111,68 +259,203 @@ Renderer::Renderer(const Context* context,
     }
   }
 
+  // Create the frame graph and import the attachments, the swapchain image is rebound every frame
+  frameGraph = new FrameGraph(context);
+  colorBufferResource = frameGraph->importImage(headset->getColorBuffer()->getImage(), VK_IMAGE_ASPECT_COLOR_BIT);
+  depthBufferResource = frameGraph->importImage(headset->getDepthBuffer()->getImage(), VK_IMAGE_ASPECT_DEPTH_BIT);
+  swapchainImageResource =
+    frameGraph->importImage(nullptr, VK_IMAGE_ASPECT_COLOR_BIT, {},
+                            { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                              VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+  frameGraph->setOutput(swapchainImageResource, true);
+
+  // The depth swapchain image is only an output in frames that submit depth, otherwise its resolve pass is culled
+  if (headset->isDepthSubmissionSupported())
+  {
+    depthSwapchainImageResource = frameGraph->importImage(
+      nullptr, VK_IMAGE_ASPECT_DEPTH_BIT, {},
+      { VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL });
+  }
+
+  // The image of a quad layer is only an output in frames that upload new content into it
+  for (size_t quadLayerIndex = 0u; quadLayerIndex < headset->getQuadLayerCount(); ++quadLayerIndex)
+  {
+    quadLayerResources.push_back(
+      frameGraph->importImage(nullptr, VK_IMAGE_ASPECT_COLOR_BIT, {},
+                              { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL }));
+  }
+
+  // The shader cache holds the shader modules of all pipelines, including the compute pipelines of the culler
+  shaderCache = new ShaderCache(context);
+
+  // Create the occlusion culler, with a slot per game object and per static batch
+  occlusionCuller = new OcclusionCuller(context, headset, frameGraph, shaderCache,
+                                        gameObjects.size() + materials.size(), framesInFlightCount);
+  if (!occlusionCuller->isValid())
+  {
+    valid = false;
+    return;
+  }
+
+  // Add the passes of a frame in execution order
+  occlusionCuller->addCullPass(0u);
+  addScenePass(0u);
+  occlusionCuller->addDepthPyramidPass(depthBufferResource);
+  occlusionCuller->addCullPass(1u);
+  addScenePass(1u);
+  if (headset->isDepthSubmissionSupported())
+  {
+    addDepthResolvePass();
+  }
+
+  for (size_t quadLayerIndex = 0u; quadLayerIndex < quadLayerResources.size(); ++quadLayerIndex)
+  {
+    addQuadLayerUploadPass(quadLayerIndex);
+  }
+
+  if (!frameGraph->compile() || !occlusionCuller->createDescriptorSets())
+  {
+    valid = false;
+    return;
+  }
+
   // Create the pipeline
-  VkVertexInputBindingDescription vertexInputBindingDescription;
-  vertexInputBindingDescription.binding = 0u;
-  vertexInputBindingDescription.stride = sizeof(Vertex);
-  vertexInputBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+  // The positions and the other attributes are separate streams, so that depth-only pipelines only bind the positions
+  VkVertexInputBindingDescription vertexInputBindingPosition;
+  vertexInputBindingPosition.binding = 0u;
+  vertexInputBindingPosition.stride = sizeof(glm::vec3);
+  vertexInputBindingPosition.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+  VkVertexInputBindingDescription vertexInputBindingAttributes;
+  vertexInputBindingAttributes.binding = 1u;
+  vertexInputBindingAttributes.stride = sizeof(VertexAttributes);
+  vertexInputBindingAttributes.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
   VkVertexInputAttributeDescription vertexInputAttributePosition;
   vertexInputAttributePosition.binding = 0u;
   vertexInputAttributePosition.location = 0u;
   vertexInputAttributePosition.format = VK_FORMAT_R32G32B32_SFLOAT;
-  vertexInputAttributePosition.offset = offsetof(Vertex, position);
+  vertexInputAttributePosition.offset = 0u;
 
   VkVertexInputAttributeDescription vertexInputAttributeNormal;
-  vertexInputAttributeNormal.binding = 0u;
+  vertexInputAttributeNormal.binding = 1u;
   vertexInputAttributeNormal.location = 1u;
   vertexInputAttributeNormal.format = VK_FORMAT_R32G32B32_SFLOAT;
-  vertexInputAttributeNormal.offset = offsetof(Vertex, normal);
+  vertexInputAttributeNormal.offset = offsetof(VertexAttributes, normal);
 
   VkVertexInputAttributeDescription vertexInputAttributeColor;
-  vertexInputAttributeColor.binding = 0u;
+  vertexInputAttributeColor.binding = 1u;
   vertexInputAttributeColor.location = 2u;
   vertexInputAttributeColor.format = VK_FORMAT_R32G32B32_SFLOAT;
-  vertexInputAttributeColor.offset = offsetof(Vertex, color);
-  
+  vertexInputAttributeColor.offset = offsetof(VertexAttributes, color);
+
+  // Vertex pulling replaces all vertex inputs, so every pipeline shares the same empty vertex input state
+  std::vector<VkVertexInputBindingDescription> gridBindings = { vertexInputBindingPosition,
+                                                                vertexInputBindingAttributes };
+  std::vector<VkVertexInputAttributeDescription> gridAttributes = { vertexInputAttributePosition,
+                                                                    vertexInputAttributeColor };
+  std::vector<VkVertexInputBindingDescription> depthBindings = { vertexInputBindingPosition };
+  std::vector<VkVertexInputAttributeDescription> depthAttributes = { vertexInputAttributePosition };
+  vertexInputBindingDescriptions = { vertexInputBindingPosition, vertexInputBindingAttributes };
+  vertexInputAttributeDescriptions = { vertexInputAttributePosition, vertexInputAttributeNormal,
+                                       vertexInputAttributeColor };
+  if (vertexPulling)
+  {
+    gridBindings.clear();
+    gridAttributes.clear();
+    depthBindings.clear();
+    depthAttributes.clear();
+    vertexInputBindingDescriptions.clear();
+    vertexInputAttributeDescriptions.clear();
+  }
+
+  // Request the pipelines, identical requests share a pipeline and the shader modules are shared between pipelines
+  // With dynamic rendering, the headset has no render pass and the pipelines are created for its attachment formats
+  pipelineRegistry = new PipelineRegistry(context, pipelineLayout, shaderCache, headset->getColorFormat(),
+                                          headset->getDepthFormat());
+
   PipelineMaterialPayload pipelineMaterialPayload = {};
-  pipelines.resize(2);
-  pipelines[0] = new Pipeline(context, pipelineLayout, headset->getVkRenderPass(), "shaders/Grid.vert.spv", "shaders/Grid.frag.spv",
-                    { vertexInputBindingDescription }, 
-                    { vertexInputAttributePosition, vertexInputAttributeColor
-                    },
+  const size_t gridPipeline =
+    pipelineRegistry->request(headset->getVkRenderPass(), colorSubpass, getVertexShaderName("shaders/Grid.vert.spv"),
+                    "shaders/Grid.frag.spv",
+                    gridBindings,
+                    gridAttributes,
                     pipelineMaterialPayload);
-  pipelines[1] = new Pipeline(context, pipelineLayout, headset->getVkRenderPass(), "shaders/Diffuse.vert.spv", "shaders/Diffuse.frag.spv",
-                    { vertexInputBindingDescription }, 
-                    { vertexInputAttributePosition, vertexInputAttributeNormal, vertexInputAttributeColor
-                    },
+  pipelineRegistry->request(headset->getVkRenderPass(), colorSubpass, getVertexShaderName("shaders/Diffuse.vert.spv"),
+                    "shaders/Diffuse.frag.spv",
+                    vertexInputBindingDescriptions,
+                    vertexInputAttributeDescriptions,
                     pipelineMaterialPayload);
 
-  for(size_t i=0; i<materials.size(); i++){
-    int pipelineExistsAt = findExistingPipeline(materials[i]->vertShaderName, materials[i]->fragShaderName, materials[i]->pipelineData);
-    
-    if(i==0) {   
-      materials[0]->pipeline = pipelines[0];
-        
-    }
-    else if (pipelineExistsAt > -1) {
-      materials[i]->pipeline = pipelines[pipelineExistsAt];
-    }
-    else {
-      pipelines.emplace_back(new Pipeline(context, pipelineLayout, headset->getVkRenderPass(), 
-                    materials[i]->vertShaderName, materials[i]->fragShaderName,
-                    { vertexInputBindingDescription }, 
-                    { vertexInputAttributePosition, vertexInputAttributeNormal, vertexInputAttributeColor
-                    },
-                    materials[i]->pipelineData));
-      materials[i]->pipeline = pipelines[pipelines.size()-1];
-    }
-    
-    if (!materials[i]->pipeline->isValid()) {
-      valid = false;
-      return; 
+  // The depth prepass only needs the positions and has no fragment shader, all opaque materials share its pipeline
+  depthPrepassPipelineHandle =
+    pipelineRegistry->request(headset->getVkRenderPass(), depthSubpass,
+                              getVertexShaderName("shaders/DepthOnly.vert.spv"), "", depthBindings, depthAttributes,
+                              pipelineMaterialPayload);
+
+  // The visibility mask is drawn in the depth subpass of the early pass, its vertices hold the positions of both eyes
+  VkVertexInputBindingDescription vertexInputBindingVisibilityMask;
+  vertexInputBindingVisibilityMask.binding = 0u;
+  vertexInputBindingVisibilityMask.stride = sizeof(glm::vec4);
+  vertexInputBindingVisibilityMask.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+  std::vector<VkVertexInputAttributeDescription> visibilityMaskAttributes(2u);
+  for (size_t eyeIndex = 0u; eyeIndex < visibilityMaskAttributes.size(); ++eyeIndex)
+  {
+    VkVertexInputAttributeDescription& attribute = visibilityMaskAttributes.at(eyeIndex);
+    attribute.binding = 0u;
+    attribute.location = static_cast<uint32_t>(eyeIndex);
+    attribute.format = VK_FORMAT_R32G32_SFLOAT;
+    attribute.offset = static_cast<uint32_t>(sizeof(glm::vec2) * eyeIndex);
+  }
+
+  // The winding of runtime masks is not guaranteed and the fallback mask is clockwise, so the mask is never culled
+  visibilityMaskPayload = {};
+  visibilityMaskPayload.cullMode = VK_CULL_MODE_NONE;
+  visibilityMaskPipelineHandle =
+    pipelineRegistry->request(headset->getVkRenderPass(), depthSubpass, "shaders/VisibilityMask.vert.spv", "",
+                              { vertexInputBindingVisibilityMask }, visibilityMaskAttributes, visibilityMaskPayload);
+
+  // The first material always uses the grid pipeline, the others keep their vertex layout for runtime changes
+
+  materialPipelines.resize(materials.size());
+  materialPipelines[0].handle = gridPipeline;
+  for(size_t i=1; i<materials.size(); i++){
+    materialPipelines[i] = { materials[i]->vertShaderName, materials[i]->fragShaderName, materials[i]->pipelineData,
+      pipelineRegistry->request(headset->getVkRenderPass(), colorSubpass,
+                    getVertexShaderName(materials[i]->vertShaderName), materials[i]->fragShaderName,
+                    vertexInputBindingDescriptions, vertexInputAttributeDescriptions,
+                    materials[i]->pipelineData) };
+
+    // The mesh shading variant has no vertex input at all
+    materialPipelines[i].hasMeshPipeline = meshShading && materials[i]->vertShaderName == meshShaderVertexFilename;
+    if (materialPipelines[i].hasMeshPipeline)
+    {
+      materialPipelines[i].meshHandle =
+        pipelineRegistry->request(headset->getVkRenderPass(), colorSubpass, meshShaderFilename,
+                                  materials[i]->fragShaderName, {}, {}, materials[i]->pipelineData);
     }
   }
+
+  // Compile all unique pipelines in parallel
+  if (!pipelineRegistry->createPipelines())
+  {
+    valid = false;
+    return;
+  }
+
+  shaderCache->logStatistics();
+
+  depthPrepassPipeline = pipelineRegistry->getPipeline(depthPrepassPipelineHandle);
+  visibilityMaskPipeline = pipelineRegistry->getPipeline(visibilityMaskPipelineHandle);
+
+  for(size_t i=0; i<materials.size(); i++){
+    materials[i]->pipeline = pipelineRegistry->getPipeline(materialPipelines[i].handle);
+    materials[i]->meshPipeline =
+      materialPipelines[i].hasMeshPipeline ? pipelineRegistry->getPipeline(materialPipelines[i].meshHandle) : nullptr;
+  }
   
   // Create a vertex index buffer
   {
@@ -201,7 +484,7 @@ Renderer::Renderer(const Context* context,
     // Create an empty target buffer
     vertexIndexBuffer = new DataBuffer(context,
                                        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, bufferSize);
     if (!vertexIndexBuffer->isValid())
     {
@@ -221,16 +504,52 @@ Renderer::Renderer(const Context* context,
     delete stagingBuffer;
   }
 
+  attributeOffset = meshData->getAttributeOffset();
   indexOffset = meshData->getIndexOffset();
+
+  // Split the models of the game objects into meshlets for mesh shading
+  if (meshShading)
+  {
+    std::vector<const Model*> models;
+    for (const GameObject* gameObject : gameObjects)
+    {
+      if (gameObject->model)
+      {
+        models.push_back(gameObject->model);
+      }
+    }
+
+    meshletData =
+      new MeshletData(context, meshData, models, renderProcesses.at(0u)->getCommandBuffer(), context->getVkDrawQueue());
+    if (!meshletData->isValid())
+    {
+      valid = false;
+      return;
+    }
+  }
+
+  // Merge the static objects into batches, which keep their own copy of the geometry
+  staticBatcher = new StaticBatcher(context, meshData, materials);
+  if (!staticBatcher->update(gameObjects, renderProcesses.at(0u)->getCommandBuffer(), context->getVkDrawQueue()) ||
+      !updateGeometryDescriptorSets())
+  {
+    valid = false;
+    return;
+  }
 }
 
 Renderer::~Renderer()
 {
+  delete visibilityMaskBuffer;
+  delete meshletData;
+  delete staticBatcher;
   delete vertexIndexBuffer;
   
-  for (size_t i = 0; i<pipelines.size(); i++) {
-    delete pipelines[i];
-  }
+  delete pipelineRegistry;
+  delete shaderCache;
+
+  delete occlusionCuller;
+  delete frameGraph;
 
   const VkDevice device = context->getVkDevice();
   if (device)
@@ -241,6 +560,21 @@ Renderer::~Renderer()
       vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     }
 
+    if (geometryDescriptorSetLayout)
+    {
+      vkDestroyDescriptorSetLayout(device, geometryDescriptorSetLayout, nullptr);
+    }
+
+    if (meshletDescriptorSetLayout)
+    {
+      vkDestroyDescriptorSetLayout(device, meshletDescriptorSetLayout, nullptr);
+    }
+
+    if (geometryDescriptorPool)
+    {
+      vkDestroyDescriptorPool(device, geometryDescriptorPool, nullptr);
+    }
+
     if (descriptorSetLayout)
     {
       vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
@@ -263,35 +597,57 @@ Renderer::~Renderer()
   }
 }
 
-// returns i of pipeline vectors, or -1 if a pipeline for these shaders hasn't been created yet.
-const int Renderer::findExistingPipeline(const std::string& vertShader, const std::string& fragShader, const PipelineMaterialPayload& pipelineData) const{
-  for(size_t i = 0; i< pipelines.size(); i++){
-    if(pipelines[i]->getVertShaderName() == vertShader &&
-      pipelines[i]->getFragShaderName() == fragShader
-      ){
-        if(pipelineData == pipelines[i]->getPipelineMaterialData()){
-          return (int)i;
-        }
-        
-    }
-  }
-  return -1;
-}
-
-void Renderer::render(const glm::mat4& cameraMatrix, size_t swapchainImageIndex, float time)
+void Renderer::render(const glm::mat4& cameraMatrix, float time)
 {
   currentRenderProcessIndex = (currentRenderProcessIndex + 1u) % renderProcesses.size();
 
   RenderProcess* renderProcess = renderProcesses.at(currentRenderProcessIndex);
 
-  const VkFence busyFence = renderProcess->getBusyFence();
-  if (vkResetFences(context->getVkDevice(), 1u, &busyFence) != VK_SUCCESS)
+  // Wait until the GPU is done with this render process, its secondary command buffers may be re-recorded below
+  if (!context->waitForDrawTimeline(renderProcess->timelineValue))
   {
     return;
   }
 
+  // Read back how long the eye passes and the depth resolve of the last frame of this render process took on the GPU,
+  // the depth resolve timestamps are only written in frames that submit depth
+  const VkQueryPool timestampQueryPool = renderProcess->getTimestampQueryPool();
+  if (renderProcess->timestampsWritten)
+  {
+    const uint32_t timestampCount =
+      (renderProcess->depthResolveTimestampsWritten ? RenderProcess::timestampCount : 2u);
+    std::array<uint64_t, RenderProcess::timestampCount> timestamps;
+    if (vkGetQueryPoolResults(context->getVkDevice(), timestampQueryPool, 0u, timestampCount,
+                              sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+    {
+      const float millisecondsPerTick = context->getTimestampPeriod() / 1000000.0f;
+      gpuFrameTime = static_cast<float>(timestamps.at(timestampCount - 1u) - timestamps.at(0u)) * millisecondsPerTick;
+      if (renderProcess->depthResolveTimestampsWritten)
+      {
+        depthResolveTime = static_cast<float>(timestamps.at(3u) - timestamps.at(2u)) * millisecondsPerTick;
+      }
+    }
+  }
+
   const VkCommandBuffer commandBuffer = renderProcess->getCommandBuffer();
 
+  // Rebuild the static batches when the static objects have changed, after which every render process has to
+  // re-record its static draws
+  if (staticBatcher->isOutdated(gameObjects))
+  {
+    if (!staticBatcher->update(gameObjects, commandBuffer, context->getVkDrawQueue()) ||
+        !updateGeometryDescriptorSets())
+    {
+      return;
+    }
+
+    for (RenderProcess* process : renderProcesses)
+    {
+      process->staticDrawsRecorded = false;
+    }
+  }
+
   if (vkResetCommandBuffer(commandBuffer, 0u) != VK_SUCCESS)
   {
     return;
@@ -307,115 +663,980 @@ void Renderer::render(const glm::mat4& cameraMatrix, size_t swapchainImageIndex,
   {
     for (size_t goIndex = 0u; goIndex < gameObjects.size(); ++goIndex)
     {
-      renderProcess->dynamicVertexUniformData[goIndex].worldMatrix = gameObjects.at(goIndex)->worldMatrix;
-      renderProcess->dynamicVertexUniformData[goIndex].colorMultiplier = gameObjects.at(goIndex)->material->dynamicUniformData.colorMultiplier;
+      const GameObject* gameObject = gameObjects.at(goIndex);
+      renderProcess->dynamicVertexUniformData[goIndex].worldMatrix = gameObject->worldMatrix;
+      renderProcess->dynamicVertexUniformData[goIndex].materialIndex =
+        (gameObject->material ? gameObject->material->materialIndex : 0u);
     }
 
-    for (size_t eyeIndex = 0u; eyeIndex < headset->getEyeCount(); ++eyeIndex)
+    // The static batches are already in world space, and there is one per material
+    for (size_t batchIndex = 0u; batchIndex < staticBatcher->getBatchCount(); ++batchIndex)
     {
-      renderProcess->staticVertexUniformData.viewProjectionMatrices.at(eyeIndex) =
-        headset->getEyeProjectionMatrix(eyeIndex) * headset->getEyeViewMatrix(eyeIndex) * cameraMatrix;
+      RenderProcess::DynamicVertexUniformData& batchUniformData =
+        renderProcess->dynamicVertexUniformData.at(gameObjects.size() + batchIndex);
+      batchUniformData.worldMatrix = glm::mat4(1.0f);
+      batchUniformData.materialIndex = static_cast<uint32_t>(batchIndex);
     }
 
+    // Only the materials that have changed since this render process last wrote them are written again
+    for (size_t materialIndex = 0u; materialIndex < materials.size(); ++materialIndex)
+    {
+      const Material* material = materials.at(materialIndex);
+      renderProcess->updateMaterialUniformData(materialIndex, material->dynamicUniformData,
+                                               material->dynamicUniformDataVersion);
+    }
+
+    currentCameraMatrix = cameraMatrix;
+    updateEyeUniformData(renderProcess);
+
     renderProcess->staticFragmentUniformData.time = time;
 
     renderProcess->updateUniformBufferData();
   }
 
+  updateMaterialPipelines();
+
+  // Split the visible game objects into static and dynamic draws, batched game objects are drawn by their batch
+  staticDraws.clear();
+  dynamicDraws.clear();
+  for (size_t goIndex = 0u; goIndex < gameObjects.size(); ++goIndex)
+  {
+    const GameObject* gameObject = gameObjects.at(goIndex);
+    if(!gameObject->isVisible || staticBatcher->isBatched(goIndex))
+      continue;
+
+    RenderProcess::Draw draw = { goIndex, gameObject->material->pipeline, gameObject->material->pipelineData,
+                                 gameObject->model->firstIndex, gameObject->model->indexCount };
+
+    // Draw the meshlets instead where the material has a mesh pipeline
+    if (gameObject->material->meshPipeline && meshletData &&
+        meshletData->getMeshlets(gameObject->model, draw.firstMeshlet, draw.meshletCount))
+    {
+      draw.meshPipeline = gameObject->material->meshPipeline;
+    }
+
+    if (gameObject->isStatic)
+    {
+      staticDraws.push_back(draw);
+    }
+    else
+    {
+      dynamicDraws.push_back(draw);
+    }
+  }
+
+  for (size_t batchIndex = 0u; batchIndex < staticBatcher->getBatchCount(); ++batchIndex)
+  {
+    const StaticBatcher::Batch& batch = staticBatcher->getBatch(batchIndex);
+    if (batch.indexCount == 0u)
+    {
+      continue;
+    }
+
+    const Material* material = materials.at(batchIndex);
+    staticDraws.push_back({ gameObjects.size() + batchIndex, material->pipeline, material->pipelineData, 0u,
+                            batch.indexCount, batch.geometryBuffer->getBuffer(), batch.attributeOffset,
+                            batch.indexOffset });
+  }
+
+  // Sort the draws into buckets of the same pipelines and geometry buffer, so that the draw commands of a bucket follow
+  // each other and can be submitted at once. The sort is stable to keep the static draws unchanged between frames.
+  const auto isInEarlierBucket = [](const RenderProcess::Draw& a, const RenderProcess::Draw& b)
+  {
+    const std::less<const void*> less;
+    if (a.pipeline != b.pipeline)
+    {
+      return less(a.pipeline, b.pipeline);
+    }
+
+    if (a.meshPipeline != b.meshPipeline)
+    {
+      return less(a.meshPipeline, b.meshPipeline);
+    }
+
+    return less(a.geometryBuffer, b.geometryBuffer);
+  };
+  std::stable_sort(staticDraws.begin(), staticDraws.end(), isInEarlierBucket);
+  std::stable_sort(dynamicDraws.begin(), dynamicDraws.end(), isInEarlierBucket);
+
+  // The occlusion culler writes the draw commands of the static draws first, followed by those of the dynamic draws
+  drawnObjectIndices.clear();
+  for (const std::vector<RenderProcess::Draw>* draws : { &staticDraws, &dynamicDraws })
+  {
+    for (const RenderProcess::Draw& draw : *draws)
+    {
+      drawnObjectIndices.push_back(draw.gameObjectIndex);
+    }
+  }
+
+  occlusionCuller->updateFrameData(currentRenderProcessIndex,
+                                   renderProcess->staticVertexUniformData.viewProjectionMatrices, gameObjects,
+                                   staticBatcher, drawnObjectIndices);
+
+  const VkDescriptorSet descriptorSet = renderProcess->getDescriptorSet();
+
+  if (!updateVisibilityMaskBuffer())
+  {
+    return;
+  }
+
+  // Only re-record the static draws of this render process if the static set, its pipelines, the depth prepass
+  // setting, the render resolution or the visibility mask have changed, the occlusion culler decides which of them
+  // actually draw through their indirect commands
+  const VkExtent2D renderResolution = headset->getRenderResolution(0u);
+  if (!renderProcess->staticDrawsRecorded || staticDraws != renderProcess->recordedStaticDraws ||
+      depthPrepass != renderProcess->recordedDepthPrepass ||
+      renderResolution.width != renderProcess->recordedRenderResolution.width ||
+      renderResolution.height != renderProcess->recordedRenderResolution.height ||
+      visibilityMaskVersion != renderProcess->recordedVisibilityMaskVersion)
+  {
+    for (size_t passIndex = 0u; passIndex < 2u; ++passIndex)
+    {
+      for (size_t subpassIndex = 0u; subpassIndex < 2u; ++subpassIndex)
+      {
+        // The visibility mask comes first in the early pass
+        renderProcess->staticDrawsRecorded =
+          recordDraws(renderProcess->getStaticCommandBuffer(passIndex, subpassIndex), passIndex, subpassIndex,
+                      descriptorSet, staticDraws, 0u, 0u, passIndex == 0u && subpassIndex == depthSubpass);
+        if (!renderProcess->staticDrawsRecorded)
+        {
+          return;
+        }
+      }
+    }
+
+    renderProcess->recordedStaticDraws = staticDraws;
+    renderProcess->recordedDepthPrepass = depthPrepass;
+    renderProcess->recordedRenderResolution = renderResolution;
+    renderProcess->recordedVisibilityMaskVersion = visibilityMaskVersion;
+  }
+
+  // The dynamic draws are recorded every frame
+  for (size_t passIndex = 0u; passIndex < 2u; ++passIndex)
+  {
+    for (size_t subpassIndex = 0u; subpassIndex < 2u; ++subpassIndex)
+    {
+      if (!recordDraws(renderProcess->getDynamicCommandBuffer(passIndex, subpassIndex), passIndex, subpassIndex,
+                       descriptorSet, dynamicDraws, staticDraws.size(), VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                       false))
+      {
+        return;
+      }
+    }
+  }
+
+  // The passes themselves are recorded by the frame graph on submission, once the mirror view has added its pass
+}
+
+void Renderer::submit(size_t swapchainImageIndex, bool useSemaphores)
+{
+  RenderProcess* renderProcess = renderProcesses.at(currentRenderProcessIndex);
+  const VkCommandBuffer commandBuffer = renderProcess->getCommandBuffer();
+
+  // The swapchain image is acquired as late as possible, only the passes recorded below read or write it
+  currentSwapchainImageIndex = swapchainImageIndex;
+  frameGraph->setImage(swapchainImageResource, headset->getRenderTarget(swapchainImageIndex)->getImage());
+
+  // So is the depth swapchain image, in frames that submit depth
+  const RenderTarget* depthRenderTarget = headset->getDepthRenderTarget();
+  if (headset->isDepthSubmissionSupported())
+  {
+    if (depthRenderTarget)
+    {
+      frameGraph->setImage(depthSwapchainImageResource, depthRenderTarget->getImage());
+    }
+
+    frameGraph->setOutput(depthSwapchainImageResource, depthRenderTarget != nullptr);
+  }
+
+  // And so are the images of the quad layers whose content has changed, the others are left out of the frame
+  for (size_t quadLayerIndex = 0u; quadLayerIndex < quadLayerResources.size(); ++quadLayerIndex)
+  {
+    const QuadLayer* quadLayer = headset->getQuadLayer(quadLayerIndex);
+    const size_t quadLayerResource = quadLayerResources.at(quadLayerIndex);
+    if (quadLayer->isUploading())
+    {
+      frameGraph->setImage(quadLayerResource, quadLayer->getImage());
+    }
+
+    frameGraph->setOutput(quadLayerResource, quadLayer->isUploading());
+  }
+
+  // Record all passes of the frame that contribute to an output, together with the barriers in between them
+  frameGraph->execute(commandBuffer);
+
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+  {
+    return;
+  }
+
+  VkCommandBufferSubmitInfo commandBufferSubmitInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO };
+  commandBufferSubmitInfo.commandBuffer = commandBuffer;
+
+  // The frame signals the next draw timeline value once it has completed, and with the mirror view it additionally
+  // waits for the acquired swapchain image and signals the binary semaphore that presentation waits on
+  const uint64_t timelineValue = context->getNextDrawTimelineValue();
+
+  VkSemaphoreSubmitInfo waitSemaphoreSubmitInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO };
+  waitSemaphoreSubmitInfo.semaphore = renderProcess->getDrawableSemaphore();
+  waitSemaphoreSubmitInfo.stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+  std::array<VkSemaphoreSubmitInfo, 2u> signalSemaphoreSubmitInfos;
+  signalSemaphoreSubmitInfos.at(0u) = { VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO };
+  signalSemaphoreSubmitInfos.at(0u).semaphore = context->getDrawTimelineSemaphore();
+  signalSemaphoreSubmitInfos.at(0u).value = timelineValue;
+  signalSemaphoreSubmitInfos.at(0u).stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+  signalSemaphoreSubmitInfos.at(1u) = { VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO };
+  signalSemaphoreSubmitInfos.at(1u).semaphore = renderProcess->getPresentableSemaphore();
+  signalSemaphoreSubmitInfos.at(1u).stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+  VkSubmitInfo2 submitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO_2 };
+  submitInfo.commandBufferInfoCount = 1u;
+  submitInfo.pCommandBufferInfos = &commandBufferSubmitInfo;
+  submitInfo.waitSemaphoreInfoCount = useSemaphores ? 1u : 0u;
+  submitInfo.pWaitSemaphoreInfos = &waitSemaphoreSubmitInfo;
+  submitInfo.signalSemaphoreInfoCount = useSemaphores ? 2u : 1u;
+  submitInfo.pSignalSemaphoreInfos = signalSemaphoreSubmitInfos.data();
+
+  if (vkQueueSubmit2(context->getVkDrawQueue(), 1u, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+  {
+    return;
+  }
+
+  renderProcess->timelineValue = timelineValue;
+  renderProcess->timestampsWritten = (renderProcess->getTimestampQueryPool() != nullptr);
+  renderProcess->depthResolveTimestampsWritten = renderProcess->timestampsWritten && depthRenderTarget;
+}
+
+void Renderer::latchEyePoses()
+{
+  RenderProcess* renderProcess = renderProcesses.at(currentRenderProcessIndex);
+  updateEyeUniformData(renderProcess);
+  renderProcess->updateStaticVertexUniformData();
+  occlusionCuller->updateViewProjectionMatrices(renderProcess->staticVertexUniformData.viewProjectionMatrices);
+}
+
+void Renderer::updateEyeUniformData(RenderProcess* renderProcess) const
+{
+  for (size_t eyeIndex = 0u; eyeIndex < headset->getEyeCount(); ++eyeIndex)
+  {
+    const glm::mat4 viewMatrix = headset->getEyeViewMatrix(eyeIndex) * currentCameraMatrix;
+    renderProcess->staticVertexUniformData.viewProjectionMatrices.at(eyeIndex) =
+      headset->getEyeProjectionMatrix(eyeIndex) * viewMatrix;
+    renderProcess->staticVertexUniformData.eyePositions.at(eyeIndex) = glm::inverse(viewMatrix)[3];
+  }
+}
+
+void Renderer::updateMaterialPipelines()
+{
+  for (size_t materialIndex = 1u; materialIndex < materials.size(); ++materialIndex)
+  {
+    Material* material = materials.at(materialIndex);
+    MaterialPipeline& materialPipeline = materialPipelines.at(materialIndex);
+
+    // Request a new pipeline when the material has changed, dynamic state changes map to the same pipeline
+    if (material->vertShaderName != materialPipeline.vertShaderName ||
+        material->fragShaderName != materialPipeline.fragShaderName ||
+        !(material->pipelineData == materialPipeline.pipelineData))
+    {
+      materialPipeline.vertShaderName = material->vertShaderName;
+      materialPipeline.fragShaderName = material->fragShaderName;
+      materialPipeline.pipelineData = material->pipelineData;
+      materialPipeline.handle = pipelineRegistry->request(
+        headset->getVkRenderPass(), colorSubpass, getVertexShaderName(material->vertShaderName),
+        material->fragShaderName, vertexInputBindingDescriptions, vertexInputAttributeDescriptions,
+        material->pipelineData);
+
+      materialPipeline.hasMeshPipeline = meshShading && material->vertShaderName == meshShaderVertexFilename;
+      if (materialPipeline.hasMeshPipeline)
+      {
+        materialPipeline.meshHandle =
+          pipelineRegistry->request(headset->getVkRenderPass(), colorSubpass, meshShaderFilename,
+                                    material->fragShaderName, {}, {}, material->pipelineData);
+      }
+
+      pipelineRegistry->createPipelinesAsync();
+    }
+
+    // Keep drawing with the previous pipeline of the material until the new one is ready, all pipelines are compatible
+    Pipeline* pipeline = pipelineRegistry->getPipeline(materialPipeline.handle);
+    if (pipeline && pipeline != material->pipeline && pipeline->isValid())
+    {
+      material->pipeline = pipeline;
+    }
+
+    // A material that no longer uses the Diffuse vertex shader is drawn indexed right away
+    if (!materialPipeline.hasMeshPipeline)
+    {
+      material->meshPipeline = nullptr;
+      continue;
+    }
+
+    Pipeline* meshPipeline = pipelineRegistry->getPipeline(materialPipeline.meshHandle);
+    if (meshPipeline && meshPipeline != material->meshPipeline && meshPipeline->isValid())
+    {
+      material->meshPipeline = meshPipeline;
+    }
+  }
+}
+
+bool Renderer::updateGeometryDescriptorSets()
+{
+  // Only vertex pulling and mesh shading bind the geometry as storage buffers
+  if (!geometryDescriptorPool)
+  {
+    return true;
+  }
+
+  const VkDevice device = context->getVkDevice();
+
+  // The batch buffers have just been replaced and the device is idle, so all sets are simply allocated again
+  if (vkResetDescriptorPool(device, geometryDescriptorPool, 0u) != VK_SUCCESS)
+  {
+    util::error(Error::GenericVulkan);
+    return false;
+  }
+
+  geometryDescriptorSets.clear();
+  meshletDescriptorSet = nullptr;
+
+  // Collect the shared geometry buffer and the buffer of every batch, with the offsets of their streams
+  struct Geometry
+  {
+    VkBuffer buffer;
+    VkDeviceSize attributeOffset, indexOffset;
+  };
+
+  std::vector<Geometry> geometries = { { vertexIndexBuffer->getBuffer(), static_cast<VkDeviceSize>(attributeOffset),
+                                         static_cast<VkDeviceSize>(indexOffset) } };
+  for (size_t batchIndex = 0u; batchIndex < staticBatcher->getBatchCount(); ++batchIndex)
+  {
+    const StaticBatcher::Batch& batch = staticBatcher->getBatch(batchIndex);
+    if (batch.indexCount > 0u)
+    {
+      geometries.push_back({ batch.geometryBuffer->getBuffer(), batch.attributeOffset, batch.indexOffset });
+    }
+  }
+
+  for (const Geometry& geometry : geometries)
+  {
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    descriptorSetAllocateInfo.descriptorPool = geometryDescriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1u;
+    descriptorSetAllocateInfo.pSetLayouts = &geometryDescriptorSetLayout;
+
+    VkDescriptorSet descriptorSet;
+    if (vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &descriptorSet) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+
+    // The streams are aligned by the mesh data, so that they satisfy any storage buffer offset alignment
+    std::array<VkDescriptorBufferInfo, 2u> descriptorBufferInfos;
+    descriptorBufferInfos.at(0u).buffer = geometry.buffer;
+    descriptorBufferInfos.at(0u).offset = 0u;
+    descriptorBufferInfos.at(0u).range = geometry.attributeOffset;
+
+    descriptorBufferInfos.at(1u).buffer = geometry.buffer;
+    descriptorBufferInfos.at(1u).offset = geometry.attributeOffset;
+    descriptorBufferInfos.at(1u).range = geometry.indexOffset - geometry.attributeOffset;
+
+    VkWriteDescriptorSet writeDescriptorSet{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    writeDescriptorSet.dstSet = descriptorSet;
+    writeDescriptorSet.dstBinding = 0u;
+    writeDescriptorSet.dstArrayElement = 0u;
+    writeDescriptorSet.descriptorCount = static_cast<uint32_t>(descriptorBufferInfos.size());
+    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptorSet.pBufferInfo = descriptorBufferInfos.data();
+    vkUpdateDescriptorSets(device, 1u, &writeDescriptorSet, 0u, nullptr);
+
+    geometryDescriptorSets.emplace(geometry.buffer, descriptorSet);
+  }
+
+  // The meshlet sections are aligned by the meshlet data, the draw commands are read in full
+  if (meshletData && meshletData->getBuffer())
+  {
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    descriptorSetAllocateInfo.descriptorPool = geometryDescriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1u;
+    descriptorSetAllocateInfo.pSetLayouts = &meshletDescriptorSetLayout;
+    if (vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &meshletDescriptorSet) != VK_SUCCESS)
+    {
+      util::error(Error::GenericVulkan);
+      return false;
+    }
+
+    std::array<VkDescriptorBufferInfo, 4u> descriptorBufferInfos;
+    descriptorBufferInfos.at(0u).buffer = meshletData->getBuffer();
+    descriptorBufferInfos.at(0u).offset = 0u;
+    descriptorBufferInfos.at(0u).range = meshletData->getVertexOffset();
+
+    descriptorBufferInfos.at(1u).buffer = meshletData->getBuffer();
+    descriptorBufferInfos.at(1u).offset = meshletData->getVertexOffset();
+    descriptorBufferInfos.at(1u).range = meshletData->getTriangleOffset() - meshletData->getVertexOffset();
+
+    descriptorBufferInfos.at(2u).buffer = meshletData->getBuffer();
+    descriptorBufferInfos.at(2u).offset = meshletData->getTriangleOffset();
+    descriptorBufferInfos.at(2u).range = meshletData->getSize() - meshletData->getTriangleOffset();
+
+    descriptorBufferInfos.at(3u).buffer = occlusionCuller->getDrawCommandBuffer();
+    descriptorBufferInfos.at(3u).offset = 0u;
+    descriptorBufferInfos.at(3u).range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet writeDescriptorSet{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    writeDescriptorSet.dstSet = meshletDescriptorSet;
+    writeDescriptorSet.dstBinding = 0u;
+    writeDescriptorSet.dstArrayElement = 0u;
+    writeDescriptorSet.descriptorCount = static_cast<uint32_t>(descriptorBufferInfos.size());
+    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptorSet.pBufferInfo = descriptorBufferInfos.data();
+    vkUpdateDescriptorSets(device, 1u, &writeDescriptorSet, 0u, nullptr);
+  }
+
+  return true;
+}
+
+bool Renderer::updateVisibilityMaskBuffer()
+{
+  if (visibilityMaskVersion == headset->getVisibilityMaskVersion())
+  {
+    return true;
+  }
+
+  // Every vertex holds the position of both eyes, as a single multiview draw can't pick a vertex range per view. The
+  // shorter mask is padded with degenerate triangles.
+  const std::vector<glm::vec2>& leftMask = headset->getVisibilityMask(0u);
+  const std::vector<glm::vec2>& rightMask = headset->getVisibilityMask(1u);
+  std::vector<glm::vec4> vertices(std::max(leftMask.size(), rightMask.size()), glm::vec4(0.0f));
+  for (size_t vertexIndex = 0u; vertexIndex < vertices.size(); ++vertexIndex)
+  {
+    glm::vec4& vertex = vertices.at(vertexIndex);
+    if (vertexIndex < leftMask.size())
+    {
+      vertex.x = leftMask.at(vertexIndex).x;
+      vertex.y = leftMask.at(vertexIndex).y;
+    }
+
+    if (vertexIndex < rightMask.size())
+    {
+      vertex.z = rightMask.at(vertexIndex).x;
+      vertex.w = rightMask.at(vertexIndex).y;
+    }
+  }
+
+  // The previous buffer may still be in use by frames in flight, the masks only change rarely
+  context->sync();
+
+  delete visibilityMaskBuffer;
+  visibilityMaskBuffer = nullptr;
+  visibilityMaskVertexCount = 0u;
+  visibilityMaskVersion = headset->getVisibilityMaskVersion();
+
+  if (vertices.empty())
+  {
+    return true;
+  }
+
+  const VkDeviceSize bufferSize = static_cast<VkDeviceSize>(sizeof(glm::vec4) * vertices.size());
+  visibilityMaskBuffer =
+    new DataBuffer(context, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, bufferSize);
+  if (!visibilityMaskBuffer->isValid())
+  {
+    valid = false;
+    return false;
+  }
+
+  void* bufferData = visibilityMaskBuffer->map();
+  if (!bufferData)
+  {
+    valid = false;
+    return false;
+  }
+
+  memcpy(bufferData, vertices.data(), static_cast<size_t>(bufferSize));
+  visibilityMaskBuffer->unmap();
+
+  visibilityMaskVertexCount = static_cast<uint32_t>(vertices.size());
+  return true;
+}
+
+void Renderer::addScenePass(size_t passIndex)
+{
+  // The GPU frame time is measured from the start of the early pass to the end of the late pass, which includes the
+  // culling and depth pyramid in between
+  const size_t pass = frameGraph->addPass(
+    [this, passIndex](VkCommandBuffer commandBuffer)
+    {
+      const VkQueryPool timestampQueryPool = renderProcesses.at(currentRenderProcessIndex)->getTimestampQueryPool();
+      if (timestampQueryPool && passIndex == 0u)
+      {
+        vkCmdResetQueryPool(commandBuffer, timestampQueryPool, 0u, RenderProcess::timestampCount);
+        vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, timestampQueryPool, 0u);
+      }
+
+      renderScene(commandBuffer, passIndex);
+
+      if (timestampQueryPool && passIndex == 1u)
+      {
+        vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, timestampQueryPool, 1u);
+      }
+    });
+
+  // The task shaders read the draw commands as well, to skip the meshlets of objects that the culler doesn't draw
+  VkPipelineStageFlags2 drawCommandStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+  VkAccessFlags2 drawCommandAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+  if (meshShading)
+  {
+    drawCommandStageMask |= VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT;
+    drawCommandAccessMask |= VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+  }
+
+  frameGraph->read(pass, occlusionCuller->getDrawCommandResource(), { drawCommandStageMask, drawCommandAccessMask });
+
+  // The early pass clears the attachments, the late pass loads and continues on them
+  const VkAccessFlags2 colorAccessMask =
+    (passIndex == 0u ? VK_ACCESS_2_NONE : VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT) |
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+  frameGraph->write(pass, colorBufferResource,
+                    { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccessMask,
+                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+
+  const VkAccessFlags2 depthAccessMask =
+    (passIndex == 0u ? VK_ACCESS_2_NONE : VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT) |
+    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  frameGraph->write(pass, depthBufferResource,
+                    { VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                      depthAccessMask, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL });
+
+  frameGraph->write(pass, swapchainImageResource,
+                    { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+}
+
+void Renderer::addDepthResolvePass()
+{
+  const size_t pass = frameGraph->addPass(
+    [this](VkCommandBuffer commandBuffer)
+    {
+      const VkQueryPool timestampQueryPool = renderProcesses.at(currentRenderProcessIndex)->getTimestampQueryPool();
+      // The start is only written once all previous work has completed, as the top of the pipe doesn't wait for the
+      // late pass, which would then be counted as part of the resolve
+      if (timestampQueryPool)
+      {
+        vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timestampQueryPool, 2u);
+      }
+
+      // An empty rendering that loads the multisampled depth buffer and resolves it into the depth swapchain image,
+      // which the late pass can't do as it doesn't know whether depth is submitted when its draws are recorded
+      VkRenderingAttachmentInfo depthAttachmentInfo{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+      depthAttachmentInfo.imageView = headset->getDepthBuffer()->getImageView();
+      depthAttachmentInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+      depthAttachmentInfo.resolveMode = VK_RESOLVE_MODE_SAMPLE_ZERO_BIT;
+      depthAttachmentInfo.resolveImageView = headset->getDepthRenderTarget()->getImageView();
+      depthAttachmentInfo.resolveImageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+      depthAttachmentInfo.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+      depthAttachmentInfo.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+      VkRenderingInfo renderingInfo{ VK_STRUCTURE_TYPE_RENDERING_INFO };
+      renderingInfo.renderArea.offset = { 0, 0 };
+      renderingInfo.renderArea.extent = headset->getRenderResolution(0u);
+      renderingInfo.layerCount = 1u;
+      renderingInfo.viewMask = 0b00000011;
+      renderingInfo.pDepthAttachment = &depthAttachmentInfo;
+      vkCmdBeginRendering(commandBuffer, &renderingInfo);
+      vkCmdEndRendering(commandBuffer);
+
+      if (timestampQueryPool)
+      {
+        vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, timestampQueryPool, 3u);
+      }
+    });
+
+  // The depth buffer is loaded in the fragment test stages, and resolves happen in the color attachment output stage,
+  // even for depth
+  const VkPipelineStageFlags2 resolveStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                                                 VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT |
+                                                 VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+  frameGraph->read(pass, depthBufferResource,
+                   { resolveStageMask,
+                     VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT,
+                     VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL });
+  frameGraph->write(pass, depthSwapchainImageResource,
+                    { resolveStageMask,
+                      VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL });
+}
+
+void Renderer::addQuadLayerUploadPass(size_t quadLayerIndex)
+{
+  const QuadLayer* quadLayer = headset->getQuadLayer(quadLayerIndex);
+  const size_t pass =
+    frameGraph->addPass([quadLayer](VkCommandBuffer commandBuffer) { quadLayer->recordUpload(commandBuffer); });
+
+  frameGraph->write(pass, quadLayerResources.at(quadLayerIndex),
+                    { VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL });
+}
+
+void Renderer::renderScene(VkCommandBuffer commandBuffer, size_t passIndex) const
+{
+  const RenderProcess* renderProcess = renderProcesses.at(currentRenderProcessIndex);
+
   const std::array clearValues = { VkClearValue({ 0.01f, 0.01f, 0.01f, 1.0f }), VkClearValue({ 1.0f, 0u }) };
 
+  const std::array depthCommandBuffers = { renderProcess->getStaticCommandBuffer(passIndex, depthSubpass),
+                                           renderProcess->getDynamicCommandBuffer(passIndex, depthSubpass) };
+  const std::array colorCommandBuffers = { renderProcess->getStaticCommandBuffer(passIndex, colorSubpass),
+                                           renderProcess->getDynamicCommandBuffer(passIndex, colorSubpass) };
+
+  if (headset->isDynamicRendering())
+  {
+    // The early pass clears the attachments, the late pass loads them and resolves into the swapchain image. The frame
+    // graph has already transitioned all attachments into their attachment layouts.
+    VkRenderingAttachmentInfo colorAttachmentInfo{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+    colorAttachmentInfo.imageView = headset->getColorBuffer()->getImageView();
+    colorAttachmentInfo.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachmentInfo.loadOp = (passIndex == 0u ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD);
+    colorAttachmentInfo.storeOp = (passIndex == 0u ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE);
+    colorAttachmentInfo.clearValue = clearValues.at(0u);
+    if (passIndex == 1u)
+    {
+      colorAttachmentInfo.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+      colorAttachmentInfo.resolveImageView = headset->getRenderTarget(currentSwapchainImageIndex)->getImageView();
+      colorAttachmentInfo.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+
+    VkRenderingAttachmentInfo depthAttachmentInfo{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+    depthAttachmentInfo.imageView = headset->getDepthBuffer()->getImageView();
+    depthAttachmentInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachmentInfo.loadOp = colorAttachmentInfo.loadOp;
+    // The late pass keeps the depth for the depth resolve in frames that submit depth
+    const bool keepDepth = (passIndex == 0u || headset->getDepthRenderTarget() != nullptr);
+    depthAttachmentInfo.storeOp = (keepDepth ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE);
+    depthAttachmentInfo.clearValue = clearValues.at(1u);
+
+    VkRenderingInfo renderingInfo{ VK_STRUCTURE_TYPE_RENDERING_INFO };
+    renderingInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+    renderingInfo.renderArea.offset = { 0, 0 };
+    renderingInfo.renderArea.extent = headset->getRenderResolution(0u);
+    renderingInfo.layerCount = 1u;
+    renderingInfo.viewMask = 0b00000011;
+    renderingInfo.colorAttachmentCount = 1u;
+    renderingInfo.pColorAttachments = &colorAttachmentInfo;
+    renderingInfo.pDepthAttachment = &depthAttachmentInfo;
+
+    // There are no subpasses, the visibility mask and the depth prepass draws simply come first. Fragment tests happen
+    // in the order of the draws within the rendering, so the color draws see their depth without a dependency.
+    vkCmdBeginRendering(commandBuffer, &renderingInfo);
+    if (depthPrepass || passIndex == 0u)
+    {
+      vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(depthCommandBuffers.size()),
+                           depthCommandBuffers.data());
+    }
+
+    vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(colorCommandBuffers.size()), colorCommandBuffers.data());
+    vkCmdEndRendering(commandBuffer);
+    return;
+  }
+
   VkRenderPassBeginInfo renderPassBeginInfo{ VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
-  renderPassBeginInfo.renderPass = headset->getVkRenderPass();
-  renderPassBeginInfo.framebuffer = headset->getRenderTarget(swapchainImageIndex)->getFramebuffer();
+  renderPassBeginInfo.framebuffer = headset->getRenderTarget(currentSwapchainImageIndex)->getFramebuffer();
   renderPassBeginInfo.renderArea.offset = { 0, 0 };
-  renderPassBeginInfo.renderArea.extent = headset->getEyeResolution(0u);
-  renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-  renderPassBeginInfo.pClearValues = clearValues.data();
+  renderPassBeginInfo.renderArea.extent = headset->getRenderResolution(0u);
+
+  if (passIndex == 0u)
+  {
+    // Draw the objects that were visible last frame
+    renderPassBeginInfo.renderPass = headset->getVkRenderPass();
+    renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassBeginInfo.pClearValues = clearValues.data();
+  }
+  else
+  {
+    // Draw the newly revealed objects, the late pass loads the attachments instead of clearing them
+    renderPassBeginInfo.renderPass = headset->getVkLateRenderPass();
+  }
+
+  vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+  // The depth subpass of the late pass stays empty without the depth prepass, the early one has the visibility mask
+  if (depthPrepass || passIndex == 0u)
+  {
+    vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(depthCommandBuffers.size()),
+                         depthCommandBuffers.data());
+  }
 
-  vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+  vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+  vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(colorCommandBuffers.size()), colorCommandBuffers.data());
 
-  // Set the viewport
+  vkCmdEndRenderPass(commandBuffer);
+}
+
+bool Renderer::recordDraws(VkCommandBuffer commandBuffer,
+                           size_t passIndex,
+                           size_t subpassIndex,
+                           VkDescriptorSet descriptorSet,
+                           const std::vector<RenderProcess::Draw>& draws,
+                           size_t firstDrawIndex,
+                           VkCommandBufferUsageFlags usageFlags,
+                           bool drawVisibilityMask) const
+{
+  if (vkResetCommandBuffer(commandBuffer, 0u) != VK_SUCCESS)
+  {
+    return false;
+  }
+
+  // Secondary command buffers inherit the render pass but not the framebuffer, so they stay valid for every
+  // swapchain image. With dynamic rendering, they inherit the attachment formats instead, which are the same for the
+  // depth prepass and the color draws.
+  const VkFormat colorFormat = headset->getColorFormat();
+  VkCommandBufferInheritanceRenderingInfo commandBufferInheritanceRenderingInfo{
+    VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO
+  };
+  commandBufferInheritanceRenderingInfo.viewMask = 0b00000011;
+  commandBufferInheritanceRenderingInfo.colorAttachmentCount = 1u;
+  commandBufferInheritanceRenderingInfo.pColorAttachmentFormats = &colorFormat;
+  commandBufferInheritanceRenderingInfo.depthAttachmentFormat = headset->getDepthFormat();
+  commandBufferInheritanceRenderingInfo.rasterizationSamples = context->getMultisampleCount();
+
+  VkCommandBufferInheritanceInfo commandBufferInheritanceInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+  if (headset->isDynamicRendering())
+  {
+    commandBufferInheritanceInfo.pNext = &commandBufferInheritanceRenderingInfo;
+  }
+  else
+  {
+    commandBufferInheritanceInfo.renderPass =
+      (passIndex == 0u ? headset->getVkRenderPass() : headset->getVkLateRenderPass());
+    commandBufferInheritanceInfo.subpass = static_cast<uint32_t>(subpassIndex);
+  }
+  commandBufferInheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+  VkCommandBufferBeginInfo commandBufferBeginInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+  commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | usageFlags;
+  commandBufferBeginInfo.pInheritanceInfo = &commandBufferInheritanceInfo;
+  if (vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo) != VK_SUCCESS)
+  {
+    return false;
+  }
+
+  const VkExtent2D renderResolution = headset->getRenderResolution(0u);
+
+  // Set the viewport, dynamic state is not inherited from the primary command buffer
   VkViewport viewport;
-  viewport.x = static_cast<float>(renderPassBeginInfo.renderArea.offset.x);
-  viewport.y = static_cast<float>(renderPassBeginInfo.renderArea.offset.y);
-  viewport.width = static_cast<float>(renderPassBeginInfo.renderArea.extent.width);
-  viewport.height = static_cast<float>(renderPassBeginInfo.renderArea.extent.height);
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = static_cast<float>(renderResolution.width);
+  viewport.height = static_cast<float>(renderResolution.height);
   viewport.minDepth = 0.0f;
   viewport.maxDepth = 1.0f;
   vkCmdSetViewport(commandBuffer, 0u, 1u, &viewport);
 
   // Set the scissor
   VkRect2D scissor;
-  scissor.offset = renderPassBeginInfo.renderArea.offset;
-  scissor.extent = renderPassBeginInfo.renderArea.extent;
+  scissor.offset = { 0, 0 };
+  scissor.extent = renderResolution;
   vkCmdSetScissor(commandBuffer, 0u, 1u, &scissor);
 
-  // Bind the vertex section of the geometry buffer
-  VkDeviceSize vertexOffset = 0u;
-  const VkBuffer buffer = vertexIndexBuffer->getBuffer();
-  vkCmdBindVertexBuffers(commandBuffer, 0u, 1u, &buffer, &vertexOffset);
+  // Draw the hidden area of both eyes into the depth buffer at the near plane, so that the fragments of all following
+  // draws there fail the depth test early. The draws below bind their own state again.
+  if (drawVisibilityMask && visibilityMaskVertexCount > 0u)
+  {
+    visibilityMaskPipeline->bindPipeline(commandBuffer);
+    visibilityMaskPipeline->setDynamicState(commandBuffer, visibilityMaskPayload, VK_COMPARE_OP_ALWAYS);
 
-  // Bind the index section of the geometry buffer
-  vkCmdBindIndexBuffer(commandBuffer, buffer, indexOffset, VK_INDEX_TYPE_UINT32);
+    const VkBuffer visibilityMaskVertexBuffer = visibilityMaskBuffer->getBuffer();
+    const VkDeviceSize visibilityMaskVertexOffset = 0u;
+    vkCmdBindVertexBuffers(commandBuffer, 0u, 1u, &visibilityMaskVertexBuffer, &visibilityMaskVertexOffset);
+    vkCmdDraw(commandBuffer, visibilityMaskVertexCount, 1u, 0u, 0u);
+  }
 
-  // Draw each model
-  const VkDescriptorSet descriptorSet = renderProcess->getDescriptorSet();
-  for (size_t goIndex = 0u; goIndex < gameObjects.size(); ++goIndex)
+  // Draw each model, the index range and whether it is drawn at all come from the occlusion culler
+  const VkBuffer drawCommandBuffer = occlusionCuller->getDrawCommandBuffer();
+  const Pipeline* boundPipeline = nullptr;
+  VkBuffer boundGeometryBuffer = nullptr, boundGeometryDescriptorSetBuffer = nullptr;
+  PipelineMaterialPayload boundPipelineData;
+  VkCompareOp boundDepthCompareOp = VK_COMPARE_OP_NEVER;
+
+  // Consecutive indexed draws with the same state have consecutive draw commands, so they are collected and submitted
+  // as a single multi-draw right before the state changes
+  const uint32_t maxDrawIndirectCount = context->getMaxDrawIndirectCount();
+  VkDeviceSize pendingDrawCommandOffset = 0u;
+  uint32_t pendingDrawCount = 0u;
+  const auto submitPendingDraws = [&]()
   {
-    const GameObject* gameObject = gameObjects.at(goIndex);
-    if(!gameObject->isVisible)
+    if (pendingDrawCount > 0u)
+    {
+      vkCmdDrawIndexedIndirect(commandBuffer, drawCommandBuffer, pendingDrawCommandOffset, pendingDrawCount,
+                               sizeof(VkDrawIndexedIndirectCommand));
+      pendingDrawCount = 0u;
+    }
+  };
+
+  // The per object data is located through the first instance of each draw, so the set is the same for every draw
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0u, 1u, &descriptorSet, 0u,
+                          nullptr);
+
+  // The meshlets are the same for every mesh draw
+  if (meshletDescriptorSet)
+  {
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2u, 1u,
+                            &meshletDescriptorSet, 0u, nullptr);
+  }
+
+  for (size_t drawIndex = 0u; drawIndex < draws.size(); ++drawIndex)
+  {
+    const RenderProcess::Draw& draw = draws.at(drawIndex);
+
+    // The depth subpass holds the opaque draws of the depth prepass, which are then shaded with an equal depth test
+    // and no depth writes in the color subpass. Mesh draws don't take part, as their positions would not be invariant
+    // with the depth prepass.
+    const bool meshDraw = (draw.meshPipeline != nullptr);
+    const bool prepassDraw = depthPrepass && isOpaque(draw.pipelineData) && !meshDraw;
+    if (subpassIndex == depthSubpass && !prepassDraw)
+    {
       continue;
+    }
+
+    const Pipeline* pipeline = depthPrepassPipeline;
+    if (subpassIndex == colorSubpass)
+    {
+      pipeline = (meshDraw ? draw.meshPipeline : draw.pipeline);
+    }
+
+    PipelineMaterialPayload pipelineData = draw.pipelineData;
+    VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+    if (subpassIndex == colorSubpass && prepassDraw)
+    {
+      pipelineData.depthWrite = false;
+      depthCompareOp = VK_COMPARE_OP_EQUAL;
+    }
+
+    // Bind the position, attribute and index sections of the geometry buffer, which is the shared one unless the draw
+    // is a batch. The depth subpass only needs the position stream. With vertex pulling and for mesh draws, the streams
+    // are bound as storage buffers of the second descriptor set instead, and mesh draws need no index buffer.
+    const VkBuffer geometryBuffer = draw.geometryBuffer ? draw.geometryBuffer : vertexIndexBuffer->getBuffer();
+    if ((vertexPulling || meshDraw) && geometryBuffer != boundGeometryDescriptorSetBuffer)
+    {
+      submitPendingDraws();
+      const VkDescriptorSet geometryDescriptorSet = geometryDescriptorSets.at(geometryBuffer);
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1u, 1u,
+                              &geometryDescriptorSet, 0u, nullptr);
+      boundGeometryDescriptorSetBuffer = geometryBuffer;
+    }
 
-    // Bind the uniform buffer for per model/mesh dynamic, vertex
-    const uint32_t uniformBufferOffset =
-      static_cast<uint32_t>(util::align(static_cast<VkDeviceSize>(sizeof(RenderProcess::DynamicVertexUniformData)),
-                                        context->getUniformBufferOffsetAlignment()) *
-                            static_cast<VkDeviceSize>(goIndex)); 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0u, 1u, &descriptorSet, 1u,
-                            &uniformBufferOffset);
+    if (!meshDraw && geometryBuffer != boundGeometryBuffer)
+    {
+      submitPendingDraws();
+      if (!vertexPulling)
+      {
+        const std::array vertexBuffers = { geometryBuffer, geometryBuffer };
+        const std::array<VkDeviceSize, 2u> vertexOffsets = {
+          0u, draw.geometryBuffer ? draw.attributeOffset : static_cast<VkDeviceSize>(attributeOffset)
+        };
+        const uint32_t vertexBufferCount = (subpassIndex == depthSubpass ? 1u : 2u);
+        vkCmdBindVertexBuffers(commandBuffer, 0u, vertexBufferCount, vertexBuffers.data(), vertexOffsets.data());
+      }
+
+      vkCmdBindIndexBuffer(commandBuffer, geometryBuffer, draw.geometryBuffer ? draw.indexOffset : indexOffset,
+                           VK_INDEX_TYPE_UINT32);
+      boundGeometryBuffer = geometryBuffer;
+    }
 
-    // TODO: bind the DynamicMaterialxUniformData somehow... "per pipeline" uniform data...
+    // [tdbe] bind the "pipeline" of the GO's material to the command buffer.
+    if (pipeline != boundPipeline)
+    {
+      submitPendingDraws();
+      pipeline->bindPipeline(commandBuffer);
+      boundPipeline = pipeline;
+    }
+
+    // Consecutive draws with the same material state share their dynamic state, all pipelines declare the same
+    // dynamic state so it survives pipeline changes
+    if (depthCompareOp != boundDepthCompareOp || !(pipelineData == boundPipelineData))
+    {
+      submitPendingDraws();
+      pipeline->setDynamicState(commandBuffer, pipelineData, depthCompareOp);
+      boundPipelineData = pipelineData;
+      boundDepthCompareOp = depthCompareOp;
+    }
 
-    // [tdbe] fetch the material for this GO and bind its "pipeline" to the command buffer.
-    gameObject->material->pipeline->bindPipeline(commandBuffer);
-    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(gameObject->model->indexCount), 1u,
-                     static_cast<uint32_t>(gameObject->model->firstIndex), 0u, 0u);
+    const VkDeviceSize drawCommandOffset = occlusionCuller->getDrawCommandOffset(passIndex, firstDrawIndex + drawIndex);
+    if (meshDraw)
+    {
+      submitPendingDraws();
+
+      // The task shaders skip the whole object if its draw command has no instances, and cull its meshlets otherwise.
+      // Only materials that cull back faces can cull meshlets by their normal cone.
+      const std::array<uint32_t, 4u> pushConstants = {
+        static_cast<uint32_t>(draw.firstMeshlet), static_cast<uint32_t>(draw.meshletCount),
+        static_cast<uint32_t>(drawCommandOffset / sizeof(VkDrawIndexedIndirectCommand)),
+        draw.pipelineData.cullMode == VK_CULL_MODE_BACK_BIT ? 1u : 0u
+      };
+      vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT,
+                         0u, static_cast<uint32_t>(sizeof(uint32_t) * pushConstants.size()), pushConstants.data());
+
+      const uint32_t taskGroupCount = (static_cast<uint32_t>(draw.meshletCount) + taskGroupSize - 1u) / taskGroupSize;
+      context->getVkCmdDrawMeshTasksEXT()(commandBuffer, taskGroupCount, 1u, 1u);
+    }
+    else
+    {
+      // Draws skipped in the depth subpass leave a gap in the draw commands
+      if (drawCommandOffset != pendingDrawCommandOffset + sizeof(VkDrawIndexedIndirectCommand) * pendingDrawCount ||
+          pendingDrawCount == maxDrawIndirectCount)
+      {
+        submitPendingDraws();
+      }
+
+      if (pendingDrawCount == 0u)
+      {
+        pendingDrawCommandOffset = drawCommandOffset;
+      }
+
+      ++pendingDrawCount;
+    }
   }
 
-  vkCmdEndRenderPass(commandBuffer);
-}
+  submitPendingDraws();
 
-void Renderer::submit(bool useSemaphores) const
-{
-  const RenderProcess* renderProcess = renderProcesses.at(currentRenderProcessIndex);
-  const VkCommandBuffer commandBuffer = renderProcess->getCommandBuffer();
   if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
   {
-    return;
+    return false;
   }
 
-  constexpr VkPipelineStageFlags waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-  const VkSemaphore drawableSemaphore = renderProcess->getDrawableSemaphore();
-  const VkSemaphore presentableSemaphore = renderProcess->getPresentableSemaphore();
-  const VkFence busyFence = renderProcess->getBusyFence();
-
-  VkSubmitInfo submitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
-  submitInfo.pWaitDstStageMask = &waitStages;
-  submitInfo.commandBufferCount = 1u;
-  submitInfo.pCommandBuffers = &commandBuffer;
+  return true;
+}
 
-  if (useSemaphores)
+void Renderer::setDepthPrepass(bool enabled)
+{
+  if (enabled != depthPrepass)
   {
-    submitInfo.waitSemaphoreCount = 1u;
-    submitInfo.pWaitSemaphores = &drawableSemaphore;
-    submitInfo.signalSemaphoreCount = 1u;
-    submitInfo.pSignalSemaphores = &presentableSemaphore;
+    depthPrepass = enabled;
+    printf("\n[Renderer][log] Depth prepass %s", depthPrepass ? "enabled" : "disabled");
   }
+}
 
-  if (vkQueueSubmit(context->getVkDrawQueue(), 1u, &submitInfo, busyFence) != VK_SUCCESS)
-  {
-    return;
-  }
+bool Renderer::isDepthPrepassEnabled() const
+{
+  return depthPrepass;
+}
+
+void Renderer::setMinimumScreenSize(float pixels)
+{
+  occlusionCuller->setMinimumScreenSize(pixels);
+}
+
+float Renderer::getGpuFrameTime() const
+{
+  return gpuFrameTime;
+}
+
+float Renderer::getDepthResolveTime() const
+{
+  return depthResolveTime;
 }
 
 bool Renderer::isValid() const
@@ -423,6 +1644,16 @@ bool Renderer::isValid() const
   return valid;
 }
 
+FrameGraph* Renderer::getFrameGraph() const
+{
+  return frameGraph;
+}
+
+size_t Renderer::getSwapchainImageResource() const
+{
+  return swapchainImageResource;
+}
+
 VkCommandBuffer Renderer::getCurrentCommandBuffer() const
 {
   return renderProcesses.at(currentRenderProcessIndex)->getCommandBuffer();
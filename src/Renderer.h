@@ -4,25 +4,52 @@
 
 #include <vulkan/vulkan.h>
 
+#include <unordered_map>
 #include <vector>
 
 #include "GameData.h"
-
+#include "RenderProcess.h"
 
 class Context;
 class DataBuffer;
+class FrameGraph;
 class Headset;
 class MeshData;
+class MeshletData;
+class OcclusionCuller;
 struct Model;
 struct Material;
 class Pipeline;
-class RenderProcess;
+class PipelineRegistry;
+class ShaderCache;
+class StaticBatcher;
 
 /*
  * The renderer class facilitates rendering with Vulkan. It is initialized with a constant list of models to render and
  * holds the vertex/index buffer, the pipelines that define the rendering techniques to use, as well as a number of
  * render processes. Note that all resources that need to be duplicated in order to be able to render several frames in
- * parallel is held by this number of render processes.
+ * parallel is held by this number of render processes. Visibility is resolved on the GPU by an occlusion culler, which
+ * turns every game object into an indirect draw for an early and a late pass. All passes of a frame are scheduled by a
+ * frame graph, which is recorded into the command buffer when the frame is submitted. Materials that change at runtime
+ * get their new pipeline compiled in the background, until then they are drawn with their previous pipeline.
+ * Optionally, opaque objects are first drawn into the depth buffer by a position-only depth prepass, so that their color
+ * is only shaded once per sample with an equal depth test in the following color subpass. Static objects that share a
+ * material are merged into a pre-transformed static batch each, which replaces their individual draws. With vertex
+ * pulling, the vertex shaders fetch their vertices from the geometry buffers bound as storage buffers, so that every
+ * pipeline shares an empty vertex input state. On devices with mesh shaders, objects with the Diffuse vertex shader
+ * draw their meshlets instead, which a task shader culls against both eye frustums and by their normal cone first.
+ * Static batches and the depth prepass always use indexed draws. The draws are sorted into buckets of the same pipeline
+ * and geometry buffer, and the indexed draws of a bucket are submitted as a single multi-draw of their consecutive
+ * draw commands, which locate the per object data through their first instance. With dynamic rendering, each pass is a
+ * single rendering into the attachments of the headset, in which the depth prepass draws come before the color draws.
+ * The eye passes render into the render resolution of the headset, and are timed with GPU timestamps on devices that
+ * support them. Recording a frame doesn't depend on the acquired swapchain image, which is only set on submission.
+ * The early pass starts by drawing the visibility mask of the headset into the depth buffer at the near plane, so that
+ * no fragment in the hidden area of the lenses passes the early depth test. This also hides everything behind the mask
+ * from the depth pyramid, so the culler skips objects that are only in the hidden area. When the headset submits depth,
+ * a separate pass after the late pass resolves the depth buffer into the depth swapchain image, and is timed on its own
+ * so that its cost can be weighed against the reprojection quality it buys. The quad layers of the headset each get a
+ * copy pass that uploads their new content into their acquired image, which is culled in frames without new content.
  */
 
 class Renderer final
@@ -31,10 +58,29 @@ public:
   Renderer(const Context* context, const Headset* headset, const MeshData* meshData, const std::vector<Material*>& materials, const std::vector<GameObject*>& gameObjects);
   ~Renderer();
 
-  void render(const glm::mat4& cameraMatrix, size_t swapchainImageIndex, float time);
-  void submit(bool useSemaphores) const;
+  void render(const glm::mat4& cameraMatrix, float time);
+  void submit(size_t swapchainImageIndex, bool useSemaphores); // The swapchain image is only needed from here on
+
+  // Rewrites the eye matrices of the rendered frame from the current eye poses of the headset, which the frame only
+  // reads once it has been submitted. The occlusion culling of the frame is rewritten to test with the same matrices.
+  void latchEyePoses();
+
+  void setDepthPrepass(bool enabled);
+  bool isDepthPrepassEnabled() const;
+
+  // Culls objects that are smaller than this many pixels on screen, 0 only culls by frustum and occlusion
+  void setMinimumScreenSize(float pixels);
+
+  // Returns how long the GPU took for the eye passes of the last completed frame in milliseconds, 0 if not measured
+  float getGpuFrameTime() const;
+
+  // Returns how long the GPU took to resolve the depth of the last completed frame that submitted depth in
+  // milliseconds, 0 if not measured. It is included in the GPU frame time of frames that submit depth.
+  float getDepthResolveTime() const;
 
   bool isValid() const;
+  FrameGraph* getFrameGraph() const;
+  size_t getSwapchainImageResource() const;
   VkCommandBuffer getCurrentCommandBuffer() const;
   VkSemaphore getCurrentDrawableSemaphore() const;
   VkSemaphore getCurrentPresentableSemaphore() const;
@@ -48,14 +94,69 @@ private:
   VkCommandPool commandPool = nullptr;
   VkDescriptorPool descriptorPool = nullptr;
   VkDescriptorSetLayout descriptorSetLayout = nullptr;
+  VkDescriptorPool geometryDescriptorPool = nullptr;
+  VkDescriptorSetLayout geometryDescriptorSetLayout = nullptr;
+  std::unordered_map<VkBuffer, VkDescriptorSet> geometryDescriptorSets; // Per geometry buffer, for vertex pulling
+  VkDescriptorSetLayout meshletDescriptorSetLayout = nullptr;
+  VkDescriptorSet meshletDescriptorSet = nullptr;
   std::vector<RenderProcess*> renderProcesses;
+  FrameGraph* frameGraph = nullptr;
+  size_t colorBufferResource = 0u, depthBufferResource = 0u, swapchainImageResource = 0u;
+  size_t depthSwapchainImageResource = 0u; // Only imported if the headset can submit depth
+  std::vector<size_t> quadLayerResources;  // Per quad layer of the headset
+  OcclusionCuller* occlusionCuller = nullptr;
   VkPipelineLayout pipelineLayout = nullptr;
-  std::vector<Pipeline *> pipelines;
+  ShaderCache* shaderCache = nullptr;
+  PipelineRegistry* pipelineRegistry = nullptr;
   DataBuffer* vertexIndexBuffer = nullptr;
+  StaticBatcher* staticBatcher = nullptr;
+  MeshletData* meshletData = nullptr;
+  bool meshShading = false;
   std::vector<Material*> materials;
   std::vector<GameObject*> gameObjects;
-  size_t indexOffset = 0u;
+  size_t attributeOffset = 0u, indexOffset = 0u;
   size_t currentRenderProcessIndex = 0u;
+  size_t currentSwapchainImageIndex = 0u;
+  glm::mat4 currentCameraMatrix = glm::mat4(1.0f);
+  std::vector<RenderProcess::Draw> staticDraws, dynamicDraws; // Reused every frame to avoid reallocation
+  std::vector<size_t> drawnObjectIndices;                      // In the order of the draw commands
+  bool depthPrepass = false;
+  float gpuFrameTime = 0.0f, depthResolveTime = 0.0f;
+  size_t depthPrepassPipelineHandle = 0u;
+  const Pipeline* depthPrepassPipeline = nullptr;
+  size_t visibilityMaskPipelineHandle = 0u;
+  const Pipeline* visibilityMaskPipeline = nullptr;
+  PipelineMaterialPayload visibilityMaskPayload; // Its dynamic state, which the pipeline itself only has defaults for
+  DataBuffer* visibilityMaskBuffer = nullptr; // The masks of both eyes side by side in every vertex
+  uint32_t visibilityMaskVertexCount = 0u;
+  size_t visibilityMaskVersion = 0u;
+
+  // The pipeline each material last requested, to detect changes to the materials at runtime
+  struct MaterialPipeline
+  {
+    std::string vertShaderName, fragShaderName;
+    PipelineMaterialPayload pipelineData;
+    size_t handle = 0u, meshHandle = 0u;
+    bool hasMeshPipeline = false;
+  };
+  std::vector<MaterialPipeline> materialPipelines;
+  std::vector<VkVertexInputBindingDescription> vertexInputBindingDescriptions;
+  std::vector<VkVertexInputAttributeDescription> vertexInputAttributeDescriptions;
 
-  const int findExistingPipeline(const std::string& vertShader, const std::string& fragShader, const PipelineMaterialPayload& pipelineData) const;
+  void updateEyeUniformData(RenderProcess* renderProcess) const;
+  void updateMaterialPipelines();
+  bool updateGeometryDescriptorSets();
+  bool updateVisibilityMaskBuffer();
+  void addScenePass(size_t passIndex);
+  void addDepthResolvePass();
+  void addQuadLayerUploadPass(size_t quadLayerIndex);
+  void renderScene(VkCommandBuffer commandBuffer, size_t passIndex) const;
+  bool recordDraws(VkCommandBuffer commandBuffer,
+                   size_t passIndex,
+                   size_t subpassIndex,
+                   VkDescriptorSet descriptorSet,
+                   const std::vector<RenderProcess::Draw>& draws,
+                   size_t firstDrawIndex,
+                   VkCommandBufferUsageFlags usageFlags,
+                   bool drawVisibilityMask) const;
 };
\ No newline at end of file
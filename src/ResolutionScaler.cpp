@@ -0,0 +1,76 @@
+#include "ResolutionScaler.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace
+{
+constexpr float smoothingFactor = 0.1f; // Weight of the newest GPU frame time in the smoothed frame time
+constexpr float upperLoadThreshold = 0.9f;
+constexpr float lowerLoadThreshold = 0.7f;
+constexpr size_t lowerDelayFrameCount = 4u;  // Frames the load has to stay above the upper threshold to lower the scale
+constexpr size_t raiseDelayFrameCount = 30u; // Frames the load has to stay below the lower threshold to raise the scale
+constexpr float scaleStep = 0.05f;
+} // namespace
+
+ResolutionScaler::ResolutionScaler(float minimumScale, float maximumScale)
+: minimumScale(minimumScale), maximumScale(maximumScale), scale(maximumScale)
+{
+}
+
+float ResolutionScaler::update(float gpuFrameTime, float frameBudget)
+{
+  if (gpuFrameTime <= 0.0f || frameBudget <= 0.0f)
+  {
+    return scale;
+  }
+
+  smoothedGpuFrameTime = (smoothedGpuFrameTime > 0.0f ?
+                            smoothedGpuFrameTime + (gpuFrameTime - smoothedGpuFrameTime) * smoothingFactor :
+                            gpuFrameTime);
+
+  const float previousScale = scale;
+  const float load = smoothedGpuFrameTime / frameBudget;
+  if (load > upperLoadThreshold)
+  {
+    framesBelowBudget = 0u;
+    if (++framesAboveBudget >= lowerDelayFrameCount)
+    {
+      framesAboveBudget = 0u;
+      scale = std::max(scale - scaleStep, minimumScale);
+    }
+  }
+  else if (load < lowerLoadThreshold)
+  {
+    framesAboveBudget = 0u;
+    if (++framesBelowBudget >= raiseDelayFrameCount)
+    {
+      framesBelowBudget = 0u;
+      scale = std::min(scale + scaleStep, maximumScale);
+    }
+  }
+  else
+  {
+    framesAboveBudget = 0u;
+    framesBelowBudget = 0u;
+  }
+
+  if (scale != previousScale)
+  {
+    printf("\n[ResolutionScaler][log] Render scale %.2f at %.2f ms of %.2f ms GPU frame time", scale,
+           smoothedGpuFrameTime, frameBudget);
+  }
+
+  return scale;
+}
+
+void ResolutionScaler::setMinimumScale(float minimumScale)
+{
+  this->minimumScale = std::min(minimumScale, maximumScale);
+  scale = std::max(scale, this->minimumScale);
+}
+
+float ResolutionScaler::getScale() const
+{
+  return scale;
+}
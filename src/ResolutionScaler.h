@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+ * The resolution scaler class is a controller that picks the render scale of the headset from the GPU frame time. The
+ * GPU frame time is smoothed over several frames and compared to the frame budget of the runtime. Above an upper load
+ * threshold, the scale drops by one step every few frames, and below a lower threshold it rises by one step once the
+ * load has stayed there for much longer. In between, the scale is kept as it is, so that it does not oscillate around
+ * the budget. The scale only moves in small steps between the configured bounds, and starts at the upper bound.
+ */
+class ResolutionScaler final
+{
+public:
+  ResolutionScaler(float minimumScale, float maximumScale);
+
+  // Takes the GPU frame time and the frame budget in milliseconds, and returns the render scale for the next frame. A
+  // GPU frame time of 0 is treated as unmeasured and keeps the scale.
+  float update(float gpuFrameTime, float frameBudget);
+
+  // Lets the scale drop further or keeps it higher, the current scale is raised to a higher bound right away
+  void setMinimumScale(float minimumScale);
+
+  float getScale() const;
+
+private:
+  float minimumScale = 1.0f, maximumScale = 1.0f;
+  float scale = 1.0f;
+  float smoothedGpuFrameTime = 0.0f; // In milliseconds, 0 before the first measurement
+  size_t framesAboveBudget = 0u;     // Consecutive frames above the upper load threshold
+  size_t framesBelowBudget = 0u;     // Consecutive frames below the lower load threshold
+};
@@ -0,0 +1,202 @@
+#include "ShaderCache.h"
+
+#include "Context.h"
+
+#ifdef _WIN32
+  #define NOMINMAX
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include <stdio.h>
+
+namespace
+{
+// A read-only memory mapping of a whole file, which is unmapped again when it goes out of scope
+class FileMapping final
+{
+public:
+  FileMapping(const std::string& filename)
+  {
+#ifdef _WIN32
+    file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+      return;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+      return;
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0u, 0u, nullptr);
+    if (!mapping)
+    {
+      return;
+    }
+
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0u, 0u, 0u);
+    if (data)
+    {
+      size = static_cast<size_t>(fileSize.QuadPart);
+    }
+#else
+    const int file = open(filename.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+      return;
+    }
+
+    struct stat fileStatus;
+    if (fstat(file, &fileStatus) == 0 && fileStatus.st_size > 0)
+    {
+      void* const mappedData = mmap(nullptr, static_cast<size_t>(fileStatus.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+      if (mappedData != MAP_FAILED)
+      {
+        data = mappedData;
+        size = static_cast<size_t>(fileStatus.st_size);
+      }
+    }
+
+    // The mapping stays valid after the file is closed
+    close(file);
+#endif
+  }
+
+  ~FileMapping()
+  {
+#ifdef _WIN32
+    if (data)
+    {
+      UnmapViewOfFile(data);
+    }
+
+    if (mapping)
+    {
+      CloseHandle(mapping);
+    }
+
+    if (file != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(file);
+    }
+#else
+    if (data)
+    {
+      munmap(data, size);
+    }
+#endif
+  }
+
+  const void* getData() const
+  {
+    return data;
+  }
+
+  size_t getSize() const
+  {
+    return size;
+  }
+
+private:
+  void* data = nullptr;
+  size_t size = 0u;
+
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#endif
+};
+
+// Hashes SPIR-V code with 64-bit FNV-1a
+uint64_t hashCode(const void* code, size_t size)
+{
+  uint64_t hash = 14695981039346656037ull;
+  const unsigned char* bytes = static_cast<const unsigned char*>(code);
+  for (size_t index = 0u; index < size; ++index)
+  {
+    hash ^= static_cast<uint64_t>(bytes[index]);
+    hash *= 1099511628211ull;
+  }
+
+  return hash;
+}
+} // namespace
+
+ShaderCache::ShaderCache(const Context* context) : context(context)
+{
+}
+
+ShaderCache::~ShaderCache()
+{
+  const VkDevice device = context->getVkDevice();
+  if (device)
+  {
+    for (const auto& contentShaderModule : contentShaderModules)
+    {
+      vkDestroyShaderModule(device, contentShaderModule.second, nullptr);
+    }
+  }
+}
+
+bool ShaderCache::getShaderModule(const std::string& filename, VkShaderModule& shaderModule)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // Files that have been requested before are never read again
+  const auto filenameShaderModule = filenameShaderModules.find(filename);
+  if (filenameShaderModule != filenameShaderModules.end())
+  {
+    shaderModule = filenameShaderModule->second;
+    ++filenameHitCount;
+    return true;
+  }
+
+  const FileMapping fileMapping(filename);
+  const void* code = fileMapping.getData();
+  const size_t codeSize = fileMapping.getSize();
+  if (!code || codeSize % sizeof(uint32_t) != 0u)
+  {
+    return false;
+  }
+
+  // A different file with identical contents shares the module
+  const uint64_t hash = hashCode(code, codeSize);
+  const auto contentShaderModule = contentShaderModules.find(hash);
+  if (contentShaderModule != contentShaderModules.end())
+  {
+    shaderModule = contentShaderModule->second;
+    filenameShaderModules.emplace(filename, shaderModule);
+    ++contentHitCount;
+    return true;
+  }
+
+  // The mapping is page aligned, so the code can be passed to Vulkan directly
+  VkShaderModuleCreateInfo shaderModuleCreateInfo{ VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+  shaderModuleCreateInfo.codeSize = codeSize;
+  shaderModuleCreateInfo.pCode = static_cast<const uint32_t*>(code);
+  if (vkCreateShaderModule(context->getVkDevice(), &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS)
+  {
+    return false;
+  }
+
+  contentShaderModules.emplace(hash, shaderModule);
+  filenameShaderModules.emplace(filename, shaderModule);
+  ++missCount;
+  return true;
+}
+
+void ShaderCache::logStatistics() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  printf("\n[ShaderCache][log] %zu file name hits, %zu content hits, %zu misses, %zu shader modules",
+         filenameHitCount, contentHitCount, missCount, contentShaderModules.size());
+}
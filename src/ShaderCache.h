@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class Context;
+
+/*
+ * The shader cache class holds the shader modules of the renderer for its whole lifetime, so that a shader used by
+ * several pipelines is only loaded once. Modules are keyed by a hash of their SPIR-V code, which also shares a module
+ * between different files with identical contents. A file is read through a single memory mapping the first time it
+ * is requested, after that its module is found by file name without touching the filesystem. The cache is safe to use
+ * from several threads, and it counts its hits and misses for a report.
+ */
+class ShaderCache final
+{
+public:
+  ShaderCache(const Context* context);
+  ~ShaderCache();
+
+  // Returns the shader module for a SPIR-V file in 'shaderModule', returns false on error
+  bool getShaderModule(const std::string& filename, VkShaderModule& shaderModule);
+
+  void logStatistics() const;
+
+private:
+  const Context* context = nullptr;
+
+  mutable std::mutex mutex;
+  std::unordered_map<std::string, VkShaderModule> filenameShaderModules;
+  std::unordered_map<uint64_t, VkShaderModule> contentShaderModules; // Keyed by SPIR-V code hash
+
+  size_t filenameHitCount = 0u, contentHitCount = 0u, missCount = 0u;
+};
@@ -0,0 +1,229 @@
+#include "StaticBatcher.h"
+
+#include "Context.h"
+#include "DataBuffer.h"
+#include "GameData.h"
+#include "Util.h"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/matrix.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <stdio.h>
+
+namespace
+{
+constexpr size_t minimumBatchSize = 2u; // A single object gains nothing from batching
+
+bool haveSameObjects(const StaticBatcher::Batch& a, const StaticBatcher::Batch& b)
+{
+  return a.gameObjectIndices == b.gameObjectIndices && a.models == b.models && a.worldMatrices == b.worldMatrices;
+}
+} // namespace
+
+StaticBatcher::StaticBatcher(const Context* context, const MeshData* meshData, const std::vector<Material*>& materials)
+: context(context), materials(materials), vertices(meshData->getVertices()), indices(meshData->getIndices())
+{
+  batches.resize(materials.size());
+}
+
+StaticBatcher::~StaticBatcher()
+{
+  for (const Batch& batch : batches)
+  {
+    delete batch.geometryBuffer;
+  }
+}
+
+bool StaticBatcher::isOutdated(const std::vector<GameObject*>& gameObjects) const
+{
+  const std::vector<Batch> gatheredBatches = gatherBatches(gameObjects);
+  for (size_t materialIndex = 0u; materialIndex < batches.size(); ++materialIndex)
+  {
+    if (!haveSameObjects(batches.at(materialIndex), gatheredBatches.at(materialIndex)))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool StaticBatcher::update(const std::vector<GameObject*>& gameObjects, VkCommandBuffer commandBuffer, VkQueue queue)
+{
+  const std::vector<Batch> gatheredBatches = gatherBatches(gameObjects);
+
+  // The previous batch buffers may still be in use by frames in flight
+  context->sync();
+
+  size_t rebuiltBatchCount = 0u;
+  batchedGameObjects.assign(gameObjects.size(), false);
+  for (size_t materialIndex = 0u; materialIndex < batches.size(); ++materialIndex)
+  {
+    Batch& batch = batches.at(materialIndex);
+    const Batch& gatheredBatch = gatheredBatches.at(materialIndex);
+
+    // Only rebuild the batches whose objects have changed
+    if (!haveSameObjects(batch, gatheredBatch))
+    {
+      delete batch.geometryBuffer;
+      batch = gatheredBatch;
+
+      if (!batch.gameObjectIndices.empty())
+      {
+        if (!buildBatch(batch, commandBuffer, queue))
+        {
+          valid = false;
+          return false;
+        }
+
+        ++rebuiltBatchCount;
+      }
+    }
+
+    for (const size_t gameObjectIndex : batch.gameObjectIndices)
+    {
+      batchedGameObjects.at(gameObjectIndex) = true;
+    }
+  }
+
+  printf("\n[StaticBatcher][log] Rebuilt %zu static batches", rebuiltBatchCount);
+  return true;
+}
+
+bool StaticBatcher::isValid() const
+{
+  return valid;
+}
+
+bool StaticBatcher::isBatched(size_t gameObjectIndex) const
+{
+  return gameObjectIndex < batchedGameObjects.size() && batchedGameObjects.at(gameObjectIndex);
+}
+
+size_t StaticBatcher::getBatchCount() const
+{
+  return batches.size();
+}
+
+const StaticBatcher::Batch& StaticBatcher::getBatch(size_t materialIndex) const
+{
+  return batches.at(materialIndex);
+}
+
+std::vector<StaticBatcher::Batch> StaticBatcher::gatherBatches(const std::vector<GameObject*>& gameObjects) const
+{
+  std::vector<Batch> gatheredBatches(materials.size());
+  for (size_t goIndex = 0u; goIndex < gameObjects.size(); ++goIndex)
+  {
+    const GameObject* gameObject = gameObjects.at(goIndex);
+    if (!gameObject->isStatic || !gameObject->isVisible || !gameObject->model)
+    {
+      continue;
+    }
+
+    const auto material = std::find(materials.begin(), materials.end(), gameObject->material);
+    if (material == materials.end())
+    {
+      continue;
+    }
+
+    Batch& batch = gatheredBatches.at(static_cast<size_t>(material - materials.begin()));
+    batch.gameObjectIndices.push_back(goIndex);
+    batch.models.push_back(gameObject->model);
+    batch.worldMatrices.push_back(gameObject->worldMatrix);
+  }
+
+  for (Batch& batch : gatheredBatches)
+  {
+    if (batch.gameObjectIndices.size() < minimumBatchSize)
+    {
+      batch = Batch();
+    }
+  }
+
+  return gatheredBatches;
+}
+
+bool StaticBatcher::buildBatch(Batch& batch, VkCommandBuffer commandBuffer, VkQueue queue) const
+{
+  // Pre-transform the vertices of every object into world space, the source geometry is unindexed anyway
+  std::vector<Vertex> batchVertices;
+  std::vector<uint32_t> batchIndices;
+  for (size_t objectIndex = 0u; objectIndex < batch.gameObjectIndices.size(); ++objectIndex)
+  {
+    const Model* model = batch.models.at(objectIndex);
+    const glm::mat4& worldMatrix = batch.worldMatrices.at(objectIndex);
+    const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(worldMatrix)));
+
+    for (size_t index = model->firstIndex; index < model->firstIndex + model->indexCount; ++index)
+    {
+      Vertex vertex = vertices.at(indices.at(index));
+      vertex.position = glm::vec3(worldMatrix * glm::vec4(vertex.position, 1.0f));
+      vertex.normal = normalMatrix * vertex.normal;
+
+      batchIndices.push_back(static_cast<uint32_t>(batchVertices.size()));
+      batchVertices.push_back(vertex);
+    }
+  }
+
+  // Compute a bounding sphere around the center of the bounding box of the batch
+  glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+  for (const Vertex& vertex : batchVertices)
+  {
+    boundsMin = glm::min(boundsMin, vertex.position);
+    boundsMax = glm::max(boundsMax, vertex.position);
+  }
+
+  batch.boundsCenter = (boundsMin + boundsMax) * 0.5f;
+  batch.boundsRadius = 0.0f;
+  for (const Vertex& vertex : batchVertices)
+  {
+    batch.boundsRadius = glm::max(batch.boundsRadius, glm::distance(batch.boundsCenter, vertex.position));
+  }
+
+  const size_t indexOffset = MeshData::getIndexStreamOffset(batchVertices.size());
+  const VkDeviceSize bufferSize = static_cast<VkDeviceSize>(indexOffset + sizeof(uint32_t) * batchIndices.size());
+
+  // Create a staging buffer and fill it with the vertex and index data
+  DataBuffer* stagingBuffer =
+    new DataBuffer(context, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, bufferSize);
+  if (!stagingBuffer->isValid())
+  {
+    delete stagingBuffer;
+    return false;
+  }
+
+  char* bufferData = static_cast<char*>(stagingBuffer->map());
+  if (!bufferData)
+  {
+    delete stagingBuffer;
+    return false;
+  }
+
+  MeshData::writeStreams(batchVertices, batchIndices, bufferData);
+  stagingBuffer->unmap();
+
+  // Create the geometry buffer and copy from the staging buffer
+  batch.geometryBuffer = new DataBuffer(context,
+                                        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                                          VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, bufferSize);
+  if (!batch.geometryBuffer->isValid() || !stagingBuffer->copyTo(*batch.geometryBuffer, commandBuffer, queue))
+  {
+    delete stagingBuffer;
+    return false;
+  }
+
+  delete stagingBuffer;
+
+  batch.attributeOffset = static_cast<VkDeviceSize>(MeshData::getAttributeStreamOffset(batchVertices.size()));
+  batch.indexOffset = static_cast<VkDeviceSize>(indexOffset);
+  batch.indexCount = batchIndices.size();
+  return true;
+}
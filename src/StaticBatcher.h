@@ -0,0 +1,72 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "MeshData.h"
+
+class Context;
+class DataBuffer;
+struct GameObject;
+struct Material;
+struct Model;
+
+/*
+ * The static batcher class merges the geometry of visible game objects that never move into one batch per material.
+ * The vertices of each object are pre-transformed into world space, so that a batch is drawn in a single draw with an
+ * identity world matrix instead of one draw per object. Batches are only built for materials with at least two static
+ * objects, and a batch is only rebuilt when its objects, their models or their world matrices have changed. Note that
+ * the batcher keeps a copy of the source geometry for rebuilding, and that a rebuild waits for the device to be idle
+ * because the previous batch buffers may still be in use.
+ */
+class StaticBatcher final
+{
+public:
+  StaticBatcher(const Context* context, const MeshData* meshData, const std::vector<Material*>& materials);
+  ~StaticBatcher();
+
+  struct Batch
+  {
+    std::vector<size_t> gameObjectIndices;
+    std::vector<const Model*> models;
+    std::vector<glm::mat4> worldMatrices;
+
+    DataBuffer* geometryBuffer = nullptr; // In the layout of the mesh data
+    VkDeviceSize attributeOffset = 0u, indexOffset = 0u;
+    size_t indexCount = 0u;
+    glm::vec3 boundsCenter = glm::vec3(0.0f); // In world space
+    float boundsRadius = 0.0f;
+  };
+
+  // Returns true if any batch needs to be rebuilt for the current static game objects
+  bool isOutdated(const std::vector<GameObject*>& gameObjects) const;
+
+  // Rebuilds the outdated batches, returns false on error
+  bool update(const std::vector<GameObject*>& gameObjects, VkCommandBuffer commandBuffer, VkQueue queue);
+
+  bool isValid() const;
+  bool isBatched(size_t gameObjectIndex) const;
+  size_t getBatchCount() const; // One per material, most of them are usually empty
+  const Batch& getBatch(size_t materialIndex) const;
+
+private:
+  bool valid = true;
+
+  const Context* context = nullptr;
+  std::vector<Material*> materials;
+
+  // The source geometry, kept to rebuild batches after the mesh data is gone
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+
+  std::vector<Batch> batches; // One per material
+  std::vector<bool> batchedGameObjects;
+
+  // Fills the member lists of a batch per material from the current static game objects
+  std::vector<Batch> gatherBatches(const std::vector<GameObject*>& gameObjects) const;
+  bool buildBatch(Batch& batch, VkCommandBuffer commandBuffer, VkQueue queue) const;
+};
@@ -19,6 +19,7 @@ void WorldObjectsMiscBehaviour::rotateMatColor(const float gameTime){
         glm::max(0.2f, glm::sin((float)glm::pow(gameTime*0.6f,1.2))), 
         1.0f
     );
+    ++logoMat.dynamicUniformDataVersion;
 }
 
 void WorldObjectsMiscBehaviour::Update(const float deltaTime, const float gameTime, 
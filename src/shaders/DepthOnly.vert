@@ -0,0 +1,37 @@
+#extension GL_EXT_multiview : enable
+
+// Vertex pulling fetches the vertex inputs from storage buffers
+#ifdef VERTEX_PULLING
+#extension GL_GOOGLE_include_directive : require
+#include "VertexPulling.glsl"
+#define inPosition pullPosition(uint(gl_VertexIndex))
+#else
+layout(location = 0) in vec3 inPosition;
+#endif
+
+struct DynBufData
+{
+    mat4 worldMatrix;
+    uint materialIndex; // Into the material table
+};
+
+// One per object, located by the first instance of the draw command
+layout(std430, binding = 0) readonly buffer DynBufDatas
+{
+    DynBufData dynBufDatas[];
+};
+
+layout(binding = 1) uniform ViewProjection
+{
+    mat4 matrices[2];
+} viewProjection;
+
+// Must match the color shaders exactly for the equal depth test
+invariant gl_Position;
+
+void main()
+{
+  const DynBufData dynBufData = dynBufDatas[gl_InstanceIndex];
+
+  gl_Position = viewProjection.matrices[gl_ViewIndex] * (dynBufData.worldMatrix * vec4(inPosition, 1.0));
+}
\ No newline at end of file
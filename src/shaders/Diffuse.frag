@@ -1,14 +1,24 @@
+// Shader features, set per pipeline from the material payload
+layout(constant_id = 0) const bool alphaOutput = false; // Output the interpolated alpha, opaque otherwise
+layout(constant_id = 3) const int lightingModel = 0;    // 0 = diffuse, 1 = unlit
+
 layout(location = 0) in vec3 normal;
-layout(location = 1) in vec3 color;
+layout(location = 1) in vec4 color;
 
 layout(location = 0) out vec4 outColor;
 
 void main()
 {
-  const vec3 lightDir = vec3(1.0, -1.0, -1.0);
-  const float diffuse = clamp(dot(normal, -lightDir), 0.0, 1.0);
+  vec3 litColor = color.xyz;
+  if (lightingModel == 0)
+  {
+    const vec3 lightDir = vec3(1.0, -1.0, -1.0);
+    const float diffuse = clamp(dot(normal, -lightDir), 0.0, 1.0);
+
+    const vec3 ambient = vec3(0.07, 0.05, 0.1);
 
-  const vec3 ambient = vec3(0.07, 0.05, 0.1);
+    litColor = ambient + color.xyz * diffuse;
+  }
 
-  outColor = vec4(ambient + color * diffuse, 1.0);
-}
\ No newline at end of file
+  outColor = vec4(litColor, alphaOutput ? color.w : 1.0);
+}
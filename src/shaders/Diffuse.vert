@@ -1,29 +1,73 @@
 #extension GL_EXT_multiview : enable
 
-layout(binding = 0) uniform DynBufData
+// Vertex pulling fetches the vertex inputs from storage buffers
+#ifdef VERTEX_PULLING
+#extension GL_GOOGLE_include_directive : require
+#include "VertexPulling.glsl"
+#define inPosition pullPosition(uint(gl_VertexIndex))
+#define inNormal pullNormal(uint(gl_VertexIndex))
+#define inColor pullColor(uint(gl_VertexIndex))
+#else
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec3 inColor;
+#endif
+
+// Shader features, set per pipeline from the material payload
+layout(constant_id = 0) const bool alphaOutput = false;    // Output the alpha of the color multiplier
+layout(constant_id = 1) const bool vertexColor = true;     // Use the vertex color, white otherwise
+layout(constant_id = 2) const bool colorMultiplier = true; // Multiply by the color multiplier of the material
+
+struct DynBufData
 {
     mat4 worldMatrix;
+    uint materialIndex; // Into the material table
+};
+
+// One per object, located by the first instance of the draw command
+layout(std430, binding = 0) readonly buffer DynBufDatas
+{
+    DynBufData dynBufDatas[];
+};
+
+struct MaterialData
+{
     vec4 colorMultiplier;
-} dynBufData;
+};
+
+// One per material, written once whenever the material changes
+layout(std430, binding = 3) readonly buffer MaterialDatas
+{
+    MaterialData materialDatas[];
+};
 
 layout(binding = 1) uniform ViewProjection
 {
     mat4 matrices[2];
 } viewProjection;
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNormal;
-layout(location = 2) in vec3 inColor;
-//layout(location = 3) in vec3 colorMultiplier;
-
 layout(location = 0) out vec3 normal; // In world space
-layout(location = 1) out vec3 color;
+layout(location = 1) out vec4 color;
+
+// Must match the depth prepass exactly for the equal depth test
+invariant gl_Position;
 
 void main()
 {
-  gl_Position = viewProjection.matrices[gl_ViewIndex] * dynBufData.worldMatrix * vec4(inPosition, 1.0);
+  const DynBufData dynBufData = dynBufDatas[gl_InstanceIndex];
+  const MaterialData materialData = materialDatas[dynBufData.materialIndex];
+
+  gl_Position = viewProjection.matrices[gl_ViewIndex] * (dynBufData.worldMatrix * vec4(inPosition, 1.0));
 
   normal = normalize(vec3(dynBufData.worldMatrix * vec4(inNormal, 0.0)));
-  color = inColor
-          * dynBufData.colorMultiplier.xyz;
-}
\ No newline at end of file
+
+  color = vec4(vertexColor ? inColor : vec3(1.0), 1.0);
+  if (colorMultiplier)
+  {
+    color.xyz *= materialData.colorMultiplier.xyz;
+    if (alphaOutput)
+    {
+      color.w = materialData.colorMultiplier.w;
+    }
+  }
+}
@@ -1,29 +1,60 @@
 #extension GL_EXT_multiview : enable
 
-layout(binding = 0) uniform DynBufData
+// Vertex pulling fetches the vertex inputs from storage buffers
+#ifdef VERTEX_PULLING
+#extension GL_GOOGLE_include_directive : require
+#include "VertexPulling.glsl"
+#define inPosition pullPosition(uint(gl_VertexIndex))
+#define inColor pullColor(uint(gl_VertexIndex))
+#else
+layout(location = 0) in vec3 inPosition;
+layout(location = 2) in vec3 inColor;
+//layout(location = 3) in vec3 colorMultiplier;
+#endif
+
+struct DynBufData
 {
     mat4 worldMatrix;
+    uint materialIndex; // Into the material table
+};
+
+// One per object, located by the first instance of the draw command
+layout(std430, binding = 0) readonly buffer DynBufDatas
+{
+    DynBufData dynBufDatas[];
+};
+
+struct MaterialData
+{
     vec4 colorMultiplier;
-} dynBufData;
+};
+
+// One per material, written once whenever the material changes
+layout(std430, binding = 3) readonly buffer MaterialDatas
+{
+    MaterialData materialDatas[];
+};
 
 layout(binding = 1) uniform ViewProjection
 {
     mat4 matrices[2];
 } viewProjection;
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 2) in vec3 inColor;
-//layout(location = 3) in vec3 colorMultiplier;
-
 layout(location = 0) out vec3 position; // In world space
 layout(location = 1) out vec3 color;
 
+// Must match the depth prepass exactly for the equal depth test
+invariant gl_Position;
+
 void main()
 {
+  const DynBufData dynBufData = dynBufDatas[gl_InstanceIndex];
+  const MaterialData materialData = materialDatas[dynBufData.materialIndex];
+
   vec4 pos = dynBufData.worldMatrix * vec4(inPosition, 1.0);
   gl_Position = viewProjection.matrices[gl_ViewIndex] * pos;
   position = pos.xyz;
 
   color = inColor
-          *dynBufData.colorMultiplier.xyz;
+          *materialData.colorMultiplier.xyz;
 }
\ No newline at end of file
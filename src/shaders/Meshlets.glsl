@@ -0,0 +1,56 @@
+// The meshlets of the mesh data and the draw commands of the occlusion culler, shared by the task and mesh shaders
+
+struct Meshlet
+{
+  vec4 sphere; // Center and radius in model space
+  vec4 cone;   // Axis in model space and cutoff, never culls with a cutoff of 1
+  uint vertexOffset;
+  uint vertexCount;
+  uint triangleOffset;
+  uint triangleCount;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Meshlets
+{
+  Meshlet meshlets[];
+};
+
+// Indices into the vertex streams
+layout(std430, set = 2, binding = 1) readonly buffer MeshletVertices
+{
+  uint meshletVertices[];
+};
+
+// Three local vertex indices of 8 bits each per triangle
+layout(std430, set = 2, binding = 2) readonly buffer MeshletTriangles
+{
+  uint meshletTriangles[];
+};
+
+// Five uints per indexed draw command, the second of which is the instance count and the last the object index
+layout(std430, set = 2, binding = 3) readonly buffer DrawCommands
+{
+  uint drawCommands[];
+};
+
+layout(push_constant) uniform PushConstants
+{
+  uint firstMeshlet;
+  uint meshletCount;
+  uint drawCommandIndex; // Of the object in the current pass
+  uint coneCulling;      // Only for materials that cull back faces
+} pushConstants;
+
+// Meshlets tested by each task shader workgroup, one per invocation
+const uint taskGroupSize = 32u;
+
+struct TaskPayload
+{
+  uint meshletIndices[taskGroupSize];
+};
+
+// The object index is the first instance of the draw command
+uint getObjectIndex()
+{
+  return drawCommands[pushConstants.drawCommandIndex * 5u + 4u];
+}
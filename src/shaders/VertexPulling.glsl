@@ -0,0 +1,30 @@
+// Fetches the vertices from the position and attribute streams of the geometry buffer instead of vertex inputs, vertex
+// shaders pass the index of the vertex from the index buffer and mesh shaders the one from their meshlet
+
+layout(std430, set = 1, binding = 0) readonly buffer PositionStream
+{
+  float positions[]; // Tightly packed vec3s, which a vec3 array would pad to 16 bytes
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer AttributeStream
+{
+  float attributes[]; // Normal and color per vertex
+};
+
+vec3 pullPosition(uint vertexIndex)
+{
+  const uint offset = 3u * vertexIndex;
+  return vec3(positions[offset], positions[offset + 1u], positions[offset + 2u]);
+}
+
+vec3 pullNormal(uint vertexIndex)
+{
+  const uint offset = 6u * vertexIndex;
+  return vec3(attributes[offset], attributes[offset + 1u], attributes[offset + 2u]);
+}
+
+vec3 pullColor(uint vertexIndex)
+{
+  const uint offset = 6u * vertexIndex + 3u;
+  return vec3(attributes[offset], attributes[offset + 1u], attributes[offset + 2u]);
+}
@@ -0,0 +1,12 @@
+#extension GL_EXT_multiview : enable
+
+// The hidden area of both eyes, a single multiview draw gets the same vertex for each eye
+layout(location = 0) in vec2 inLeftPosition;
+layout(location = 1) in vec2 inRightPosition;
+
+void main()
+{
+  // The positions are already in normalized device coordinates, place them at the near plane so that nothing drawn
+  // afterwards passes the depth test there
+  gl_Position = vec4(gl_ViewIndex == 0 ? inLeftPosition : inRightPosition, 0.0, 1.0);
+}